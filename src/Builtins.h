@@ -14,20 +14,23 @@ public:
     }
 
     const std::vector<Name> &names() const { return builtin_symbols; }
-    const Type &type(const Name &n) { return *builtin_types[n]; }
+    const Type &type(const Name &n) const { return builtin_types.find(n)->second; }
 private:
     std::vector<Name> builtin_symbols;
-    std::map<Name, Type*> builtin_types;
+    std::map<Name, Type> builtin_types;
 
     void add(const std::string &name, const Type &type) {
         Name n(name);
         builtin_symbols.push_back(n);
-        builtin_types[n] = new Type(type);
+        builtin_types.insert(std::make_pair(n, type));
     }
 };
 
-// Singleton instance.
-static Builtins builtins;
+// The single, immutable instance.
+inline const Builtins &builtins() {
+    static const Builtins instance;
+    return instance;
+}
 
 }
 
@@ -1,9 +1,43 @@
 #include "ByReferencePass.h"
+#include "ThreadPool.h"
 
 using namespace Bish;
 
+namespace {
+
+// Passes the arguments of each call which the callee takes by
+// reference through the callee's global variable instead.
+class RewriteCalls : public IRVisitor {
+public:
+    virtual void visit(FunctionCall *node) {
+        IRVisitor::visit(node);
+        Function *f = node->function;
+        for (unsigned i = 0; i < node->args.size(); i++) {
+            Assignment *a = node->args[i];
+            if (f->args[i]->is_reference()) {
+                assert(a->location->offset == NULL);
+                a->location->variable = f->args[i]->reference;
+            }
+        }
+    }
+};
+
+// Rewrites the calls of one function, for ThreadPool::for_each.
+class RewriteFunctionCalls {
+public:
+    RewriteFunctionCalls(const std::vector<Function *> *functions) : functions(functions) {}
+
+    void operator()(unsigned i) const {
+        RewriteCalls rewrite;
+        (*functions)[i]->accept(&rewrite);
+    }
+private:
+    const std::vector<Function *> *functions;
+};
+
+}
+
 void ByReferencePass::initialize_unique_naming(Module *m) {
-    unique_id = 0;
     for (Block::iterator I = m->global_variables->begin(), E = m->global_variables->end();
          I != E; ++I) {
         if (const Assignment *A = dynamic_cast<const Assignment *>(*I)) {
@@ -12,8 +46,8 @@ void ByReferencePass::initialize_unique_naming(Module *m) {
     }
 }
 
-Name ByReferencePass::get_unique_name() {
-    std::string base = "_global_ref_" + as_string(unique_id++);
+Name ByReferencePass::get_unique_name(Function *f, unsigned arg) {
+    std::string base = "_global_ref_" + f->qualified_name() + "_" + as_string(arg);
     Name name(base);
     unsigned i = 0;
     while (used_names.count(name)) {
@@ -31,8 +65,8 @@ void ByReferencePass::visit(Module *node) {
         for (std::vector<Variable *>::const_iterator AI = f->args.begin(), AE = f->args.end(); AI != AE; ++AI, ++i) {
             Variable *v = *AI;
             if (v->type().array()) {
-                Name name = get_unique_name();
-                Variable *gv = new Variable(name);
+                Name name = get_unique_name(f, i);
+                Variable *gv = node->own(new Variable(name));
                 gv->global = true;
                 gv->set_type(v->type());
                 v->set_reference(gv);
@@ -40,19 +74,7 @@ void ByReferencePass::visit(Module *node) {
         }
     }
 
-    // Now visit as normal.
-    IRVisitor::visit(node);
-}
-
-void ByReferencePass::visit(FunctionCall *node) {
-    IRVisitor::visit(node);
-    Function *f = node->function;
-    for (unsigned i = 0; i < node->args.size(); i++) {
-        Assignment *a = node->args[i];
-        if (f->args[i]->is_reference()) {
-            delete a->location->variable;
-            assert(a->location->offset == NULL);
-            a->location->variable = f->args[i]->reference;
-        }
-    }
+    RewriteCalls rewrite;
+    node->global_variables->accept(&rewrite);
+    ThreadPool::for_each(node->functions.size(), RewriteFunctionCalls(&node->functions));
 }
@@ -12,16 +12,19 @@ namespace Bish {
  * only used for arrays, which must be passed by reference. The
  * mechanism currently used for pass-by-reference is using a unique
  * global variable to communicate between functions using the value,
- * instead of a function parameter. */
+ * instead of a function parameter.
+ *
+ * The global variables are named after the function and the position
+ * of the parameter, so a library and the scripts using it agree on
+ * them. The calls are then rewritten function by function, in
+ * parallel on the active thread pool. */
 class ByReferencePass : public IRVisitor {
 public:
     virtual void visit(Module *);
-    virtual void visit(FunctionCall *);
 private:
-    unsigned unique_id;
     std::set<Name> used_names;
     std::map<Function *, std::map<unsigned, Variable *> > reference_vars;
-    Name get_unique_name();
+    Name get_unique_name(Function *f, unsigned arg);
     void initialize_unique_naming(Module *m);
 };
 
@@ -1,70 +1,285 @@
-#include <iostream>
+#include <algorithm>
 #include <cassert>
-#include <set>
-#include <queue>
 #include "CallGraph.h"
 
 using namespace Bish;
 
-// Return a list of direct calls from f.
-const std::vector<Function *> &CallGraph::calls(Function *f) {
-    return calls_map[f];
+namespace {
+
+const unsigned Unvisited = 0xffffffff;
+
+// Sort (source, target) pairs into compressed sparse row form,
+// dropping duplicate targets but otherwise keeping their order.
+void to_csr(unsigned n, const std::vector<std::pair<unsigned, unsigned> > &edges,
+            std::vector<unsigned> &offsets, std::vector<unsigned> &targets) {
+    // Counting sort by source.
+    std::vector<unsigned> bucket(n + 1, 0);
+    for (unsigned i = 0; i < edges.size(); i++) {
+        bucket[edges[i].first + 1]++;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        bucket[i + 1] += bucket[i];
+    }
+    std::vector<unsigned> sorted(edges.size());
+    std::vector<unsigned> fill(bucket.begin(), bucket.end() - 1);
+    for (unsigned i = 0; i < edges.size(); i++) {
+        sorted[fill[edges[i].first]++] = edges[i].second;
+    }
+    // Copy each source's targets, skipping those already seen for
+    // that source.
+    std::vector<unsigned> seen(n, Unvisited);
+    offsets.assign(n + 1, 0);
+    targets.clear();
+    targets.reserve(edges.size());
+    for (unsigned s = 0; s < n; s++) {
+        offsets[s] = targets.size();
+        for (unsigned i = bucket[s]; i < bucket[s + 1]; i++) {
+            unsigned t = sorted[i];
+            if (seen[t] == s) continue;
+            seen[t] = s;
+            targets.push_back(t);
+        }
+    }
+    offsets[n] = targets.size();
+}
+
+}
+
+unsigned CallGraph::id(Function *f) const {
+    std::unordered_map<Function *, unsigned>::const_iterator I = index.find(f);
+    assert(I != index.end() && "Function is not in the call graph.");
+    return I->second;
+}
+
+CallGraph::FunctionList CallGraph::calls(Function *f) const {
+    unsigned i = id(f);
+    const unsigned *base = call_targets.data();
+    return FunctionList(base + call_offsets[i], base + call_offsets[i + 1], &functions);
+}
+
+CallGraph::FunctionList CallGraph::callers(Function *f) const {
+    unsigned i = id(f);
+    const unsigned *base = caller_targets.data();
+    return FunctionList(base + caller_offsets[i], base + caller_offsets[i + 1], &functions);
 }
 
-// Return a list of all calls (recursively) from root.
-std::vector<Function *> CallGraph::transitive_calls(Function *root) {
+unsigned CallGraph::component(Function *f) const {
+    return scc[id(f)];
+}
+
+CallGraph::FunctionList CallGraph::component_functions(unsigned c) const {
+    const unsigned *base = scc_members.data();
+    return FunctionList(base + scc_offsets[c], base + scc_offsets[c + 1], &functions);
+}
+
+bool CallGraph::is_recursive(Function *f) const {
+    return scc_cyclic[component(f)];
+}
+
+bool CallGraph::reaches(Function *from, Function *to) const {
+    const std::vector<uint64_t> &r = reachable(component(from));
+    unsigned c = component(to);
+    return (r[c / 64] >> (c % 64)) & 1;
+}
+
+std::vector<Function *> CallGraph::transitive_calls(Function *root) const {
+    const std::vector<uint64_t> &r = reachable(component(root));
+    std::vector<unsigned> ids;
+    for (unsigned w = 0; w < r.size(); w++) {
+        for (uint64_t bits = r[w]; bits; bits &= bits - 1) {
+            unsigned c = w * 64 + __builtin_ctzll(bits);
+            ids.insert(ids.end(), scc_members.begin() + scc_offsets[c],
+                       scc_members.begin() + scc_offsets[c + 1]);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
     std::vector<Function *> result;
-    std::set<Function *> visited;
-    std::queue<Function *> worklist;
-    worklist.push(root);
-    visited.insert(root);
+    result.reserve(ids.size());
+    for (unsigned i = 0; i < ids.size(); i++) {
+        result.push_back(functions[ids[i]]);
+    }
+    return result;
+}
+
+void CallGraph::build(const std::vector<std::pair<unsigned, unsigned> > &edges) {
+    const unsigned n = functions.size();
+    to_csr(n, edges, call_offsets, call_targets);
+    std::vector<std::pair<unsigned, unsigned> > reversed;
+    reversed.reserve(call_targets.size());
+    for (unsigned s = 0; s < n; s++) {
+        for (unsigned i = call_offsets[s]; i < call_offsets[s + 1]; i++) {
+            reversed.push_back(std::make_pair(call_targets[i], s));
+        }
+    }
+    to_csr(n, reversed, caller_offsets, caller_targets);
+    compute_components();
+}
+
+// Tarjan's algorithm, with an explicit stack so that long call chains
+// can't overflow the native one. Components are numbered in the order
+// they are completed, which puts callees before their callers.
+void CallGraph::compute_components() {
+    const unsigned n = functions.size();
+    std::vector<unsigned> order(n, Unvisited), low(n, 0);
+    std::vector<bool> on_stack(n, false);
+    std::vector<unsigned> stack;
+    // (function, next edge) pairs of the depth-first search.
+    std::vector<std::pair<unsigned, unsigned> > frames;
+    unsigned counter = 0;
+    scc.assign(n, Unvisited);
+    scc_offsets.assign(1, 0);
+    scc_members.clear();
+
+    for (unsigned root = 0; root < n; root++) {
+        if (order[root] != Unvisited) continue;
+        frames.push_back(std::make_pair(root, call_offsets[root]));
+        order[root] = low[root] = counter++;
+        stack.push_back(root);
+        on_stack[root] = true;
+        while (!frames.empty()) {
+            unsigned v = frames.back().first;
+            unsigned &edge = frames.back().second;
+            if (edge < call_offsets[v + 1]) {
+                unsigned w = call_targets[edge++];
+                if (order[w] == Unvisited) {
+                    frames.push_back(std::make_pair(w, call_offsets[w]));
+                    order[w] = low[w] = counter++;
+                    stack.push_back(w);
+                    on_stack[w] = true;
+                } else if (on_stack[w]) {
+                    low[v] = std::min(low[v], order[w]);
+                }
+                continue;
+            }
+            if (low[v] == order[v]) {
+                unsigned c = scc_offsets.size() - 1;
+                unsigned w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    on_stack[w] = false;
+                    scc[w] = c;
+                    scc_members.push_back(w);
+                } while (w != v);
+                // Keep members in module order.
+                std::sort(scc_members.begin() + scc_offsets[c], scc_members.end());
+                scc_offsets.push_back(scc_members.size());
+            }
+            frames.pop_back();
+            if (!frames.empty()) {
+                unsigned u = frames.back().first;
+                low[u] = std::min(low[u], low[v]);
+            }
+        }
+    }
+
+    // Build the condensed graph.
+    const unsigned nscc = num_components();
+    scc_cyclic.assign(nscc, false);
+    scc_call_offsets.assign(1, 0);
+    scc_call_targets.clear();
+    std::vector<unsigned> seen(nscc, Unvisited);
+    for (unsigned c = 0; c < nscc; c++) {
+        if (scc_offsets[c + 1] - scc_offsets[c] > 1) scc_cyclic[c] = true;
+        for (unsigned m = scc_offsets[c]; m < scc_offsets[c + 1]; m++) {
+            unsigned v = scc_members[m];
+            for (unsigned i = call_offsets[v]; i < call_offsets[v + 1]; i++) {
+                unsigned d = scc[call_targets[i]];
+                if (d == c) {
+                    scc_cyclic[c] = true;
+                } else if (seen[d] != c) {
+                    seen[d] = c;
+                    scc_call_targets.push_back(d);
+                }
+            }
+        }
+        scc_call_offsets.push_back(scc_call_targets.size());
+    }
+    reach.assign(nscc, std::vector<uint64_t>());
+    reach_computed.assign(nscc, false);
+}
+
+// Return the components reachable from component c. Computes (and
+// caches) the sets of every component reachable from c which isn't
+// cached yet, callees first, so each set is built from its callees'
+// sets in a single pass.
+const std::vector<uint64_t> &CallGraph::reachable(unsigned c) const {
+    if (reach_computed[c]) return reach[c];
+    const unsigned words = (num_components() + 63) / 64;
+
+    std::vector<unsigned> pending, worklist(1, c);
+    std::vector<bool> queued(num_components(), false);
+    queued[c] = true;
     while (!worklist.empty()) {
-        Function *f = worklist.front();
-        worklist.pop();
-        std::vector<Function *> direct = calls(f);
-        for (std::vector<Function *>::iterator I = direct.begin(), E = direct.end(); I != E; ++I) {
-            if (visited.find(*I) == visited.end()) {
-                visited.insert(*I);
-                worklist.push(*I);
-                result.push_back(*I);
+        unsigned d = worklist.back();
+        worklist.pop_back();
+        pending.push_back(d);
+        for (unsigned i = scc_call_offsets[d]; i < scc_call_offsets[d + 1]; i++) {
+            unsigned e = scc_call_targets[i];
+            if (!reach_computed[e] && !queued[e]) {
+                queued[e] = true;
+                worklist.push_back(e);
             }
         }
     }
-    return result;
+    // Components only call lower-numbered components, so ascending
+    // order computes callees first.
+    std::sort(pending.begin(), pending.end());
+    for (unsigned p = 0; p < pending.size(); p++) {
+        unsigned d = pending[p];
+        std::vector<uint64_t> bits(words, 0);
+        if (scc_cyclic[d]) bits[d / 64] |= uint64_t(1) << (d % 64);
+        for (unsigned i = scc_call_offsets[d]; i < scc_call_offsets[d + 1]; i++) {
+            unsigned e = scc_call_targets[i];
+            bits[e / 64] |= uint64_t(1) << (e % 64);
+            const std::vector<uint64_t> &sub = reach[e];
+            for (unsigned w = 0; w < words; w++) {
+                bits[w] |= sub[w];
+            }
+        }
+        reach[d].swap(bits);
+        reach_computed[d] = true;
+    }
+    return reach[c];
 }
 
-// Return a list of functions which call f.
-const std::vector<Function *> &CallGraph::callers(Function *f) {
-  return callers_map[f];
+unsigned CallGraphBuilder::add(Function *f) {
+    std::pair<std::unordered_map<Function *, unsigned>::iterator, bool> r =
+        cg.index.insert(std::make_pair(f, cg.functions.size()));
+    if (r.second) cg.functions.push_back(f);
+    return r.first->second;
+}
+
+void CallGraphBuilder::visit(Module *m) {
+    // Number the module's functions first, in module order.
+    for (std::vector<Function *>::iterator I = m->functions.begin(),
+             E = m->functions.end(); I != E; ++I) {
+        add(*I);
+    }
+    IRVisitor::visit(m);
 }
 
 void CallGraphBuilder::visit(Function *f) {
+    Function *enclosing = current;
+    current = f;
+    add(f);
     IRVisitor::visit(f);
-
-    if (cg.calls_map.find(f) == cg.calls_map.end()) {
-        cg.calls_map[f] = CallGraph::FuncVec();
-    }
-    if (cg.callers_map.find(f) == cg.callers_map.end()) {
-        cg.callers_map[f] = CallGraph::FuncVec();
-    }
+    current = enclosing;
 }
 
 void CallGraphBuilder::visit(FunctionCall *call) {
     IRVisitor::visit(call);
-
-    Block *b = dynamic_cast<Block *>(call->parent());
-    assert(b);
-    Function *f = dynamic_cast<Function *>(b->parent());
-    // The parent of a block can be null if the block is the Module
-    // global variable block. Currently, don't add function calls from
-    // the global variable initializers to the callgraph.
-    if (f) {
-        cg.calls_map[f].push_back(call->function);
-        cg.callers_map[call->function].push_back(f);
+    // Currently, don't add function calls from the global variable
+    // initializers to the callgraph.
+    if (current) {
+        unsigned from = add(current);
+        edges.push_back(std::make_pair(from, add(call->function)));
     }
 }
 
 CallGraph CallGraphBuilder::build(Module *m) {
     m->accept(this);
+    cg.build(edges);
+    edges.clear();
     return cg;
 }
@@ -1,31 +1,121 @@
 #ifndef __BISH_CALL_GRAPH_H__
 #define __BISH_CALL_GRAPH_H__
 
-#include <map>
+#include <stdint.h>
+#include <unordered_map>
 #include <vector>
 #include "IR.h"
 #include "IRVisitor.h"
 
 namespace Bish {
 
+/* The call graph of a module, stored in compressed sparse row form:
+ * functions are numbered in module order (followed by callees from
+ * outside the module), and the callees of function i are
+ * call_targets[call_offsets[i] .. call_offsets[i + 1]). Callers are
+ * stored the same way. The strongly connected components are computed
+ * once when the graph is built, and the set of functions reachable
+ * from each component is computed on first use and then cached, so
+ * repeated transitive queries are cheap.
+ *
+ * Calls from global variable initializers are not part of the graph.
+ *
+ * Example:
+ *     CallGraphBuilder cgb;
+ *     CallGraph cg = cgb.build(m);
+ *     if (cg.is_recursive(f)) ...
+ *     std::vector<Function *> reached = cg.transitive_calls(f);
+ */
 class CallGraph {
     friend class CallGraphBuilder;
 public:
-    const std::vector<Function *> &calls(Function *f);
-    std::vector<Function *> transitive_calls(Function *root);
-    const std::vector<Function *> &callers(Function *f);
+    // A list of functions, stored as indices into the graph.
+    class FunctionList {
+    public:
+        class const_iterator {
+        public:
+            const_iterator(const unsigned *p, const std::vector<Function *> *fs) : p(p), fs(fs) {}
+            Function *operator*() const { return (*fs)[*p]; }
+            const_iterator &operator++() { ++p; return *this; }
+            bool operator==(const const_iterator &b) const { return p == b.p; }
+            bool operator!=(const const_iterator &b) const { return p != b.p; }
+        private:
+            const unsigned *p;
+            const std::vector<Function *> *fs;
+        };
+        FunctionList(const unsigned *b, const unsigned *e, const std::vector<Function *> *fs) :
+            b(b), e(e), fs(fs) {}
+        const_iterator begin() const { return const_iterator(b, fs); }
+        const_iterator end() const { return const_iterator(e, fs); }
+        unsigned size() const { return e - b; }
+        bool empty() const { return b == e; }
+        Function *operator[](unsigned i) const { return (*fs)[b[i]]; }
+    private:
+        const unsigned *b, *e;
+        const std::vector<Function *> *fs;
+    };
+
+    // Return the number of functions in the graph.
+    unsigned size() const { return functions.size(); }
+    // Return true if f is in the graph.
+    bool contains(Function *f) const { return index.count(f) != 0; }
+    // Return the functions called directly from f, each once, in
+    // order of first call.
+    FunctionList calls(Function *f) const;
+    // Return the functions calling f directly, each once.
+    FunctionList callers(Function *f) const;
+    // Return every function reachable from root through one or more
+    // calls, in module order. root itself is only included if it is
+    // recursive.
+    std::vector<Function *> transitive_calls(Function *root) const;
+    // Return true if 'to' is reachable from 'from' through one or more
+    // calls.
+    bool reaches(Function *from, Function *to) const;
+    // Return true if f can call itself, directly or indirectly.
+    bool is_recursive(Function *f) const;
+    // Return the strongly connected component of f. Components are
+    // numbered so that a component only calls components with lower
+    // numbers (i.e. callees come first).
+    unsigned component(Function *f) const;
+    // Return the number of strongly connected components.
+    unsigned num_components() const { return scc_offsets.empty() ? 0 : scc_offsets.size() - 1; }
+    // Return the functions of the given component.
+    FunctionList component_functions(unsigned c) const;
+
 private:
-    typedef std::vector<Function *> FuncVec;
-    typedef std::map<Function *, FuncVec> FuncMap;
-    FuncMap calls_map;
-    FuncMap callers_map;
+    std::vector<Function *> functions;
+    std::unordered_map<Function *, unsigned> index;
+    std::vector<unsigned> call_offsets, call_targets;
+    std::vector<unsigned> caller_offsets, caller_targets;
+    // Component of each function, and the functions of each
+    // component in CSR form.
+    std::vector<unsigned> scc;
+    std::vector<unsigned> scc_offsets, scc_members;
+    // Components called from each component, excluding itself.
+    std::vector<unsigned> scc_call_offsets, scc_call_targets;
+    // True for components containing a cycle.
+    std::vector<bool> scc_cyclic;
+    // Lazily computed bit sets of the components reachable from each
+    // component through one or more calls.
+    mutable std::vector<std::vector<uint64_t> > reach;
+    mutable std::vector<bool> reach_computed;
+
+    unsigned id(Function *f) const;
+    void build(const std::vector<std::pair<unsigned, unsigned> > &edges);
+    void compute_components();
+    const std::vector<uint64_t> &reachable(unsigned c) const;
 };
 
 class CallGraphBuilder : public IRVisitor {
 public:
+    CallGraphBuilder() : current(NULL) {}
     CallGraph build(Module *m);
 private:
     CallGraph cg;
+    Function *current;
+    std::vector<std::pair<unsigned, unsigned> > edges;
+    unsigned add(Function *f);
+    virtual void visit(Module *m);
     virtual void visit(Function *f);
     virtual void visit(FunctionCall *call);
 };
@@ -4,26 +4,30 @@
 using namespace Bish;
 
 template<typename T>
-static CodeGenerator* create_instance(std::ostream &os) {
-    return new T(os);
+static CodeGenerator* create_instance(OutputBuffer &out, const CodeGenOptions &options) {
+    return new T(out, options);
 }
 
-CodeGenerators::CodeGeneratorsMap CodeGenerators::generator_map;
-
-void CodeGenerators::initialize() {
+static CodeGenerators::CodeGeneratorsMap make_generator_map() {
     /*
       We are saving a function pointer which will construct
       the actual code generator object when needed.
     */
+    CodeGenerators::CodeGeneratorsMap generator_map;
     generator_map["bash"] = &create_instance<CodeGen_Bash>;
+    return generator_map;
 }
 
+// The map is built on first use and never changes afterwards, so it
+// can be read from any thread.
 const CodeGenerators::CodeGeneratorsMap& CodeGenerators::all() {
+    static const CodeGeneratorsMap generator_map = make_generator_map();
     return generator_map;
 }
 
 CodeGenerators::CodeGeneratorConstructor CodeGenerators::get(const std::string &name) {
-    CodeGeneratorsMap::iterator it = generator_map.find(name);
+    const CodeGeneratorsMap &generator_map = all();
+    CodeGeneratorsMap::const_iterator it = generator_map.find(name);
     if (it == generator_map.end()) {
         return NULL;
     }
@@ -1,32 +1,68 @@
 #ifndef __BISH_CODEGEN_H__
 #define __BISH_CODEGEN_H__
 
-#include <iostream>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include "IRVisitor.h"
+#include "OutputBuffer.h"
 
 namespace Bish {
 
+// Options for how a code generator writes its output.
+struct CodeGenOptions {
+    // Make the output as small and quick to parse as possible,
+    // rather than readable.
+    bool minify;
+    // If not empty, put each function in a file of its own in this
+    // directory (relative to the script's), loaded the first time the
+    // function is called.
+    std::string autoload_dir;
+    // Compile the module to a library for scripts to source: its
+    // functions are defined under its namespace, and nothing is run.
+    bool library;
+    // The namespaces of the imported modules which were compiled to
+    // libraries, and which the script sources rather than defining
+    // their functions itself.
+    std::set<std::string> external_libraries;
+    // If not empty, write a source map to this file (relative to the
+    // script's directory), mapping ranges of lines of the script to
+    // the lines of Bish source they were generated from.
+    std::string source_map;
+
+    CodeGenOptions() : minify(false), library(false) {}
+};
+
+// A file generated along with the script, e.g. a function to
+// autoload. The path is relative to the script's directory.
+struct OutputFile {
+    std::string path;
+    OutputBuffer contents;
+};
+
 class CodeGenerator : public IRVisitor {
 public:
-    CodeGenerator(std::ostream &os): stream(os) {}
-    std::ostream &ostream() { return stream; }
+    CodeGenerator(OutputBuffer &out, const CodeGenOptions &options): stream(out), opts(options) {}
+    OutputBuffer &output() { return stream; }
+    // Files to write next to the script.
+    std::vector<OutputFile> &extra_output() { return files; }
+    const CodeGenOptions &options() const { return opts; }
 
 protected:
-    std::ostream &stream;
+    OutputBuffer &stream;
+    std::vector<OutputFile> files;
+    CodeGenOptions opts;
 };
 
 class CodeGenerators {
 public:
     // Starting with C++11, std::function can be used.
-    typedef CodeGenerator*(*CodeGeneratorConstructor)(std::ostream &aa);
+    typedef CodeGenerator*(*CodeGeneratorConstructor)(OutputBuffer &out, const CodeGenOptions &options);
     typedef std::map<std::string, CodeGeneratorConstructor > CodeGeneratorsMap;
 
-    static void initialize();
     static const CodeGeneratorsMap &all();
     static CodeGeneratorConstructor get(const std::string &name);
-private:
-    static CodeGeneratorsMap generator_map;
 };
 
 }
@@ -1,12 +1,345 @@
+#include <algorithm>
 #include <cassert>
 #include "CodeGen_Bash.h"
+#include "StructuralHash.h"
+#include "ThreadPool.h"
+#include "TimeReport.h"
 
 using namespace Bish;
 
+namespace {
+
+// Generates one function into its own buffer, along with its source
+// map (if asked for), for ThreadPool::for_each. A function's code
+// doesn't depend on the code around it, so each gets a fresh
+// generator.
+class GenerateFunction {
+public:
+    GenerateFunction(const CodeGen_Bash *parent, const std::vector<Function *> *functions,
+                     std::vector<OutputBuffer> *code, std::vector<CodeGen_Bash::SourceMap> *maps) :
+        parent(parent), functions(functions), code(code), maps(maps) {}
+
+    void operator()(unsigned i) const {
+        CodeGen_Bash cg((*code)[i], *parent);
+        (*functions)[i]->accept(&cg);
+        if (!parent->options().source_map.empty()) {
+            // Count the lines here, in parallel, rather than once the
+            // code is spliced into the script.
+            (*code)[i].lines();
+            (*maps)[i].swap(cg.source_map());
+        }
+    }
+private:
+    const CodeGen_Bash *parent;
+    const std::vector<Function *> *functions;
+    std::vector<OutputBuffer> *code;
+    std::vector<CodeGen_Bash::SourceMap> *maps;
+};
+
+// The version of the calling convention of library functions, part
+// of every signature a library declares. Change it whenever the
+// generated code calls functions or passes values differently.
+const char *const LibraryABIVersion = "1";
+
+// Counts the uses of every name --minify renames: every function,
+// and every variable whose name starts with '_', i.e. the compiler's
+// temporaries. Other variables keep their names, since external
+// commands may refer to them by name. A library keeps the names of its
+// functions and globals, so that the short names of the scripts using
+// it can't clash with them, and those scripts keep the names they
+// share with it.
+class CountNames : public IRVisitor {
+public:
+    CountNames(const CodeGenOptions &options) :
+        library(options.library), linked(!options.external_libraries.empty()) {}
+
+    // Each name with its number of uses, in order of first use.
+    std::vector<std::pair<std::string, unsigned> > uses;
+
+    virtual void visit(Variable *n) {
+        std::string name = n->name.str();
+        if (name[0] == '_' && !((library || linked) && n->global)) add(name);
+        if (n->reference) visit(n->reference);
+    }
+    virtual void visit(Function *n) {
+        add_function(n);
+        IRVisitor::visit(n);
+    }
+    virtual void visit(FunctionCall *n) {
+        add_function(n->function);
+        IRVisitor::visit(n);
+    }
+    virtual void visit(ExternCall *n) {
+        visit(n->body);
+    }
+    virtual void visit(String *n) {
+        visit(n->value);
+    }
+private:
+    bool library, linked;
+    std::unordered_map<std::string, unsigned> index;
+
+    void add_function(const Function *f) {
+        if (!library && !f->external) add(f->qualified_name());
+    }
+    void add(const std::string &name) {
+        std::pair<std::unordered_map<std::string, unsigned>::iterator, bool> I =
+            index.insert(std::make_pair(name, uses.size()));
+        if (I.second) uses.push_back(std::make_pair(name, 0));
+        uses[I.first->second].second++;
+    }
+    void visit(InterpolatedString *n) {
+        for (InterpolatedString::const_iterator I = n->begin(), E = n->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+};
+
+bool more_uses(const std::pair<std::string, unsigned> &a, const std::pair<std::string, unsigned> &b) {
+    return a.second > b.second;
+}
+
+// The i'th short name: '_' and a letter, followed by letters, digits
+// and '_' once the single letters run out.
+std::string short_name(unsigned i) {
+    static const char Chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    const unsigned NumLetters = 52, NumChars = sizeof(Chars) - 1;
+    std::string result = "_";
+    result += Chars[i % NumLetters];
+    i /= NumLetters;
+    while (i > 0) {
+        i--;
+        result += Chars[i % NumChars];
+        i /= NumChars;
+    }
+    return result;
+}
+
+// Give the most used names the shortest replacements. Ties keep the
+// order of first use, so the output doesn't change between runs.
+void make_short_names(Module *m, const CodeGenOptions &options, CodeGen_Bash::NameMap &names) {
+    CountNames count(options);
+    m->accept(&count);
+    std::stable_sort(count.uses.begin(), count.uses.end(), more_uses);
+    for (unsigned i = 0; i < count.uses.size(); i++) {
+        names[count.uses[i].first] = short_name(i);
+    }
+}
+
+}
+
 void CodeGen_Bash::indent() {
-    for (unsigned i = 0; i < indent_level; i++) {
-        stream << "    ";
+    if (!opts.minify) stream.indent(indent_level);
+}
+
+// A newline ends a statement as well as ';' does, so minified output
+// leaves out the ';'.
+void CodeGen_Bash::end_statement() {
+    stream << (opts.minify ? "\n" : ";\n");
+}
+
+void CodeGen_Bash::open_array() {
+    stream << (opts.minify ? "(" : "( ");
+}
+
+void CodeGen_Bash::close_array() {
+    stream << (opts.minify ? ")" : " )");
+}
+
+// Move the code defining f to a file of its own, and define f as a
+// stub which loads the file (redefining f) and calls f again.
+void CodeGen_Bash::autoload(Function *f, OutputBuffer &code) {
+    const unsigned k = files.size();
+    OutputFile file;
+    file.path = opts.autoload_dir + "/" + as_string(k) + ".sh";
+    file.contents.splice(code);
+    files.push_back(std::move(file));
+
+    if (opts.minify) {
+        output_function_name(f);
+        stream << "(){\n";
+    } else {
+        stream << "\nfunction ";
+        output_function_name(f);
+        stream << " () {\n";
+    }
+    indent_level++;
+    indent();
+    stream << ". \"$__bish_chunks/" << k << ".sh\"";
+    end_statement();
+    indent();
+    output_function_name(f);
+    stream << " \"$@\"";
+    end_statement();
+    indent_level--;
+    stream << "}\n";
+}
+
+// Return the signature of a library function: the ABI version, how
+// each argument is passed (by 'v'alue or by 'r'eference), whether the
+// value is returned through a 'g'lobal or 'p'rinted, and the hash of
+// the function's lowered key. The key covers the types its code was
+// generated for, so a script which typed the function differently
+// (e.g. comparing strings where the library compares integers) is
+// rejected.
+std::string CodeGen_Bash::abi_signature(Function *f) {
+    std::string sig = LibraryABIVersion;
+    sig += ':';
+    for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+        sig += (*I)->is_reference() ? 'r' : 'v';
+    }
+    sig += ':';
+    sig += f->return_value ? 'g' : 'p';
+    sig += ':';
+    sig += hex_string(lowered_key(f).hash);
+    return sig;
+}
+
+// Declare the signature of each function the library exports, for the
+// scripts sourcing it to check against those they were compiled with.
+void CodeGen_Bash::declare_library(Module *n) {
+    stream << "declare -gA __bish_abi_" << n->namespace_id << "=";
+    open_array();
+    bool first = true;
+    for (std::vector<Function *>::const_iterator I = n->functions.begin(),
+             E = n->functions.end(); I != E; ++I) {
+        if (!(*I)->exported) continue;
+        if (!first) stream << " ";
+        first = false;
+        stream << "[";
+        output_function_name(*I);
+        stream << "]=" << abi_signature(*I);
     }
+    close_array();
+    end_statement();
+}
+
+// Source each library the script is linked against, found the way
+// 'source' finds files (in $PATH, then in the current directory), and
+// check that it exports the functions the script calls with the
+// signatures the script was compiled with.
+void CodeGen_Bash::source_libraries(Module *n) {
+    for (std::set<std::string>::const_iterator L = opts.external_libraries.begin(),
+             LE = opts.external_libraries.end(); L != LE; ++L) {
+        std::vector<Function *> used;
+        for (std::vector<Function *>::const_iterator I = n->functions.begin(),
+                 E = n->functions.end(); I != E; ++I) {
+            const std::vector<std::string> &ns = (*I)->name.namespace_id;
+            if ((*I)->external && ns.size() == 1 && ns[0] == *L) used.push_back(*I);
+        }
+        if (used.empty()) continue;
+        stream << ". " << *L << ".sh || exit 1";
+        end_statement();
+        stream << "[[ ";
+        for (unsigned i = 0; i < used.size(); i++) {
+            if (i) stream << " && ";
+            stream << "${__bish_abi_" << *L << "[";
+            output_function_name(used[i]);
+            stream << "]} == " << abi_signature(used[i]);
+        }
+        stream << " ]] || { echo \"" << *L << ".sh is incompatible with this script, recompile both\" >&2; exit 1; }";
+        end_statement();
+    }
+}
+
+// Record that the code of statement n starts on the current line.
+// Statements the compiler added have no source position, and are
+// mapped along with the next statement which has one, which they were
+// usually added for.
+void CodeGen_Bash::map_line(const IRNode *n) {
+    const IRDebugInfo &info = n->debug_info();
+    if (info.file.empty()) {
+        if (!pending) {
+            pending = true;
+            pending_line = stream.lines();
+        }
+        return;
+    }
+    SourceMapEntry e;
+    e.line = pending ? pending_line : stream.lines();
+    e.info = &info;
+    line_map.push_back(e);
+    pending = false;
+}
+
+// Record that the code from the current line on wasn't generated from
+// any statement.
+void CodeGen_Bash::unmap_lines() {
+    SourceMapEntry e;
+    e.line = stream.lines();
+    e.info = NULL;
+    line_map.push_back(e);
+    pending = false;
+}
+
+// Write the source map as JSON: a list of the source files, and a list
+// of [first line, last line, source file, source line] for each range
+// of lines of the script (counted from 1) generated from one line of
+// source. Lines generated from no line of source are left out. Each
+// entry is on a line of its own, so that the map can be read with
+// line-based tools too.
+void CodeGen_Bash::write_source_map() {
+    TimeReport::Scope scope("source map");
+    struct Range {
+        unsigned first, last, source, line;
+    };
+    std::vector<Range> ranges;
+    std::vector<const std::string *> sources;
+    std::unordered_map<std::string, unsigned> source_index;
+    // Most entries come from the same file as the one before.
+    const std::string *last_file = NULL;
+    unsigned last_source = 0;
+    const unsigned total = stream.lines();
+    for (unsigned i = 0; i < line_map.size(); i++) {
+        const SourceMapEntry &e = line_map[i];
+        unsigned next = i + 1 < line_map.size() ? line_map[i + 1].line : total;
+        if (e.info == NULL || next <= e.line) continue;
+        if (last_file == NULL || *last_file != e.info->file) {
+            std::pair<std::unordered_map<std::string, unsigned>::iterator, bool> I =
+                source_index.insert(std::make_pair(e.info->file, sources.size()));
+            if (I.second) sources.push_back(&I.first->first);
+            last_file = &I.first->first;
+            last_source = I.first->second;
+        }
+        if (!ranges.empty() && ranges.back().last == e.line &&
+            ranges.back().source == last_source && ranges.back().line == e.info->lineno) {
+            ranges.back().last = next;
+            continue;
+        }
+        Range r;
+        r.first = e.line + 1;
+        r.last = next;
+        r.source = last_source;
+        r.line = e.info->lineno;
+        ranges.push_back(r);
+    }
+
+    OutputFile file;
+    file.path = opts.source_map;
+    OutputBuffer &out = file.contents;
+    out << "{\n  \"version\": 1,\n  \"sources\": [";
+    for (unsigned i = 0; i < sources.size(); i++) {
+        out << (i ? ",\n    " : "\n    ") << json_string(*sources[i]);
+    }
+    out << "\n  ],\n  \"lines\": [";
+    for (unsigned i = 0; i < ranges.size(); i++) {
+        const Range &r = ranges[i];
+        out << (i ? ",\n    [" : "\n    [") << r.first << ", " << r.last << ", "
+            << r.source << ", " << r.line << "]";
+    }
+    out << "\n  ]\n}\n";
+    files.push_back(std::move(file));
+}
+
+// Escape the characters special inside double quotes.
+std::string CodeGen_Bash::shell_escape(const std::string &s) {
+    std::string result;
+    for (unsigned i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '$' || s[i] == '`' || s[i] == '\\') result += '\\';
+        result += s[i];
+    }
+    return result;
 }
 
 // Return true if the given node is a statement that should be
@@ -22,24 +355,104 @@ bool CodeGen_Bash::should_use_local(const Assignment *n) const {
 }
 
 void CodeGen_Bash::visit(Module *n) {
-    // Define the functions first.
+    NameMap names;
+    if (opts.minify) {
+        make_short_names(n, opts, names);
+        short_names = &names;
+    }
+    // Minified output leaves out functions that are never called,
+    // except those a library exports. A library doesn't define main,
+    // since nothing runs it, and a script doesn't define the functions
+    // of the libraries it sources.
+    std::vector<Function *> functions;
     for (std::vector<Function *>::const_iterator I = n->functions.begin(),
              E = n->functions.end(); I != E; ++I) {
-        (*I)->accept(this);
+        Function *f = *I;
+        if (f->external || (opts.library && f == n->main)) continue;
+        if (opts.minify && f != n->main && !f->exported && f->call_sites.empty()) continue;
+        functions.push_back(f);
+    }
+
+    if (!opts.autoload_dir.empty()) {
+        // Find the directory of autoloaded functions next to this
+        // script, as an absolute path in case the script changes
+        // directory, without starting any processes.
+        stream << "__bish_chunks=${BASH_SOURCE[0]%/*}";
+        end_statement();
+        stream << "[[ $__bish_chunks == \"${BASH_SOURCE[0]}\" ]] && __bish_chunks=.";
+        end_statement();
+        stream << "[[ $__bish_chunks == /* ]] || __bish_chunks=$PWD/$__bish_chunks";
+        end_statement();
+        stream << "__bish_chunks=\"$__bish_chunks/" << shell_escape(opts.autoload_dir) << "\"";
+        end_statement();
+    }
+    if (opts.library) {
+        declare_library(n);
+    } else {
+        source_libraries(n);
+    }
+
+    // Define the functions first. They are generated in parallel, and
+    // joined in module order, moving their source maps to the lines
+    // they end up on. Autoloaded functions only leave a stub behind;
+    // main is always called, so is never autoloaded.
+    const bool mapping = !opts.source_map.empty();
+    std::vector<OutputBuffer> code(functions.size());
+    std::vector<SourceMap> maps(mapping ? functions.size() : 0);
+    ThreadPool::for_each(functions.size(), GenerateFunction(this, &functions, &code, &maps));
+    for (unsigned i = 0; i < code.size(); i++) {
+        if (mapping) unmap_lines();
+        if (opts.autoload_dir.empty() || functions[i] == n->main) {
+            unsigned base = mapping ? stream.lines() : 0;
+            stream.splice(code[i]);
+            if (!mapping) continue;
+            for (SourceMap::iterator I = maps[i].begin(), E = maps[i].end(); I != E; ++I) {
+                I->line += base;
+                line_map.push_back(*I);
+            }
+        } else {
+            autoload(functions[i], code[i]);
+        }
+    }
+    if (mapping) unmap_lines();
+    // A library only defines functions.
+    if (opts.library) {
+        if (mapping) write_source_map();
+        short_names = NULL;
+        return;
+    }
+    // Special case for command-line arguments, unless nothing uses
+    // them. TODO: tie this into Builtins somehow.
+    if (!n->unused_builtins.count("args")) {
+        stream << "args=";
+        open_array();
+        stream << "$0 \"$@\"";
+        close_array();
+        end_statement();
     }
-    // Special case for command-line arguments. TODO: tie this into Builtins somehow.
-    stream << "args=( $0 \"$@\" );\n";
     // Global variables next.
     disable_use_local();
-    n->global_variables->accept(this);
+    if (!opts.minify) {
+        n->global_variables->accept(this);
+    } else if (!n->global_variables->nodes.empty()) {
+        // The top-level statements need no braces around them.
+        disable_block_braces();
+        n->global_variables->accept(this);
+        reset_block_braces();
+    }
     reset_use_local();
 
     // Insert a call to bish_main().
     assert(n->main);
-    FunctionCall *call_main = new FunctionCall(n->main, IRDebugInfo());
-    visit(call_main);
-    stream << ";\n";
-    delete call_main;
+    if (mapping) unmap_lines();
+    FunctionCall call_main(n->main, IRDebugInfo());
+    visit(&call_main);
+    // The call only exists for printing; don't leave it in main's
+    // call-site list.
+    call_main.remove_call_site();
+    end_statement();
+    if (mapping) write_source_map();
+    short_names = NULL;
 }
 
 void CodeGen_Bash::visit(Block *n) {
@@ -52,15 +465,18 @@ void CodeGen_Bash::visit(Block *n) {
         unsigned i = 1;
         for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
             indent();
-            stream << "local " << (*I)->name.str() << "=";
+            stream << "local ";
+            output_name((*I)->name);
+            stream << "=";
             if ((*I)->is_reference()) {
                 bool array = (*I)->type().array();
-                if (array) stream << "( ";
+                if (array) open_array();
                 (*I)->reference->accept(this);
-                if (array) stream << " )";
-                stream << ";\n";
+                if (array) close_array();
+                end_statement();
             } else {
-                stream << "\"$" << i++ << "\";\n";
+                stream << "\"$" << i++ << "\"";
+                end_statement();
             }
         }
     }
@@ -68,17 +484,18 @@ void CodeGen_Bash::visit(Block *n) {
     for (std::vector<IRNode *>::const_iterator I = n->nodes.begin(), E = n->nodes.end();
          I != E; ++I) {
         if (should_emit_statement(*I)) {
+            if (!opts.source_map.empty()) map_line(*I);
             indent();
             (*I)->accept(this);
-            if (!dynamic_cast<Block *>(*I)) {
-                stream << ";\n";
-            }
+            if (!dynamic_cast<Block *>(*I)) end_statement();
         }
     }
+    // Code added at the end of a block belongs to the statement before.
+    pending = false;
     // Bash doesn't allow empty functions: must insert a call to a null command.
     if (n->nodes.empty()) {
         indent();
-        stream << ": # Empty function\n";
+        stream << (opts.minify ? ":\n" : ": # Empty function\n");
     }
     indent_level--;
     if (should_print_block_braces()) {
@@ -92,7 +509,7 @@ void CodeGen_Bash::visit(Variable *n) {
     bool array = n->type().array();
     stream << "$";
     if (array) stream << "{";
-    stream << lookup_name(n);
+    output_name(n);
     if (array) stream << "[@]}";
     if (should_quote_variable()) stream << "\"";
 }
@@ -103,11 +520,13 @@ void CodeGen_Bash::visit(Location *n) {
         bool array = n->variable->type().array();
         stream << "$";
         if (array) stream << "{";
-        stream << lookup_name(n->variable);
+        output_name(n->variable);
         if (array) stream << "[@]}";
     } else {
         assert(n->is_array_ref());
-        stream << "${" << lookup_name(n->variable) << "[";
+        stream << "${";
+        output_name(n->variable);
+        stream << "[";
         n->offset->accept(this);
         stream << "]}";
     }
@@ -183,7 +602,9 @@ void CodeGen_Bash::visit(IfStatement *n) {
 }
 
 void CodeGen_Bash::visit(ForLoop *n) {
-    stream << "for " << lookup_name(n->variable) << " in ";
+    stream << "for ";
+    output_name(n->variable);
+    stream << " in ";
     if (n->upper) {
         stream << "$(seq ";
         n->lower->accept(this);
@@ -205,8 +626,14 @@ void CodeGen_Bash::visit(ForLoop *n) {
 
 void CodeGen_Bash::visit(Function *n) {
     if (n->body == NULL) return;
-    stream << "\nfunction " << function_name(n) << " ";
-    stream << "() ";
+    if (opts.minify) {
+        output_function_name(n);
+        stream << "()";
+    } else {
+        stream << "\nfunction ";
+        output_function_name(n);
+        stream << " () ";
+    }
     push_function_args_insert(n);
     if (n->body) n->body->accept(this);
 }
@@ -214,7 +641,7 @@ void CodeGen_Bash::visit(Function *n) {
 void CodeGen_Bash::visit(FunctionCall *n) {
     const int nargs = n->args.size();
     if (should_functioncall_wrap()) stream << "$(";
-    stream << function_name(n->function);
+    output_function_name(n->function);
     for (int i = 0; i < nargs; i++) {
         // Variables passed by reference are communicated by a global
         // variable, not a function argument.
@@ -270,10 +697,12 @@ void CodeGen_Bash::visit(Assignment *n) {
     Location *loc = n->location;
     if (should_use_local(n)) stream << "local ";
     if (loc->is_variable()) {
-        stream << lookup_name(loc->variable) << "=";
+        output_name(loc->variable);
+        stream << "=";
     } else {
         assert(loc->is_array_ref());
-        stream << lookup_name(loc->variable) << "[";
+        output_name(loc->variable);
+        stream << "[";
         loc->offset->accept(this);
         stream << "]=";
     }
@@ -281,12 +710,12 @@ void CodeGen_Bash::visit(Assignment *n) {
     const int nvals = n->values.size();
     assert(nvals > 0);
     bool array = nvals > 1 || n->values[0]->type().array();
-    if (array) stream << "( ";
+    if (array) open_array();
     for (int i = 0; i < nvals; i++) {
         n->values[i]->accept(this);
         if (i < nvals - 1) stream << " ";
     }
-    if (array) stream << " )";
+    if (array) close_array();
     reset_functioncall_wrap();
 }
 
@@ -357,7 +786,13 @@ void CodeGen_Bash::visit(BinOp *n) {
     if (!comparison) stream << "$((";
     if (!string) disable_quote_variable();
     n->a->accept(this);
-    stream << " " << bash_op << " ";
+    // Arithmetic needs no spaces, except that "a - -1" would become
+    // a decrement.
+    if (comparison || n->op == BinOp::Sub || !opts.minify) {
+        stream << " " << bash_op << " ";
+    } else {
+        stream << bash_op;
+    }
     n->b->accept(this);
     if (comparison && should_comparison_wrap()) stream << " ]] && echo 1 || echo 0)";
     if (!comparison) stream << "))";
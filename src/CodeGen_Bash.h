@@ -3,6 +3,8 @@
 
 #include <stack>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include "IR.h"
 #include "IRVisitor.h"
 #include "CodeGen.h"
@@ -30,14 +32,30 @@ private:
 
 class CodeGen_Bash : public CodeGenerator {
 public:
-    CodeGen_Bash(std::ostream &os) : CodeGenerator(os) {
-        indent_level = 0;
-        enable_block_braces();
-        disable_functioncall_wrap();
-        enable_quote_variable();
-        enable_comparison_wrap();
-        enable_use_local();
+    // Maps the names of symbols renamed by --minify to their new
+    // names.
+    typedef std::unordered_map<std::string, std::string> NameMap;
+    // A line of output (counted from 0) where the code generated from
+    // the given source position starts, or where code with no source
+    // position starts if info is NULL.
+    struct SourceMapEntry {
+        unsigned line;
+        const IRDebugInfo *info;
+    };
+    typedef std::vector<SourceMapEntry> SourceMap;
+
+    CodeGen_Bash(OutputBuffer &out, const CodeGenOptions &options) :
+        CodeGenerator(out, options), short_names(NULL) {
+        init();
     }
+    // A generator for one function of the module 'parent' is
+    // generating, sharing its options and names.
+    CodeGen_Bash(OutputBuffer &out, const CodeGen_Bash &parent) :
+        CodeGenerator(out, parent.opts), short_names(parent.short_names) {
+        init();
+    }
+    // The source map of the code generated so far, if asked for.
+    SourceMap &source_map() { return line_map; }
     virtual void visit(Module *);
     virtual void visit(Block *);
     virtual void visit(Variable *);
@@ -58,7 +76,7 @@ public:
     virtual void visit(String *);
     virtual void visit(Boolean *);
 private:
-    std::stack<LetScope *> let_stack;
+    std::vector<LetScope *> let_stack;
     std::stack<Function *> function_args_insert;
     std::stack<bool> block_print_braces;
     std::stack<bool> functioncall_wrap;
@@ -66,6 +84,23 @@ private:
     std::stack<bool> comparison_wrap;
     std::stack<bool> use_local;
     unsigned indent_level;
+    // Set while generating a minified module.
+    const NameMap *short_names;
+    SourceMap line_map;
+    // Set if statements with no source position were generated since
+    // the last one with a position, from pending_line on.
+    bool pending;
+    unsigned pending_line;
+
+    void init() {
+        indent_level = 0;
+        pending = false;
+        enable_block_braces();
+        disable_functioncall_wrap();
+        enable_quote_variable();
+        enable_comparison_wrap();
+        enable_use_local();
+    }
 
     inline void disable_block_braces() { block_print_braces.push(false); }
     inline void enable_block_braces() { block_print_braces.push(true); }
@@ -95,6 +130,14 @@ private:
     inline bool should_emit_statement(const IRNode *node) const;
 
     void output_interpolated_string(InterpolatedString *n);
+    void autoload(Function *f, OutputBuffer &code);
+    void declare_library(Module *n);
+    void map_line(const IRNode *n);
+    void unmap_lines();
+    void write_source_map();
+    void source_libraries(Module *n);
+    static std::string abi_signature(Function *f);
+    static std::string shell_escape(const std::string &s);
 
     bool is_equals_op(IRNode *n) const {
         if (BinOp *b = dynamic_cast<BinOp*>(n)) {
@@ -104,47 +147,56 @@ private:
     }
 
     void indent();
-    void push_let_scope(LetScope *s) { let_stack.push(s); }
-    LetScope *pop_let_scope() { LetScope *s = let_stack.top(); let_stack.pop(); return s; }
+    void end_statement();
+    void open_array();
+    void close_array();
+    void push_let_scope(LetScope *s) { let_stack.push_back(s); }
+    LetScope *pop_let_scope() { LetScope *s = let_stack.back(); let_stack.pop_back(); return s; }
     void push_function_args_insert(Function *f) { function_args_insert.push(f); }
     void pop_function_args_insert() { function_args_insert.pop(); }
 
     bool lookup_let(const Variable *v, std::string &out) {
-        std::stack<LetScope *> aux;
-        std::string tmp;
-        bool found = false;
-        while (!let_stack.empty()) {
-            if (let_stack.top()->lookup(v, tmp)) {
-                out = tmp;
-                found = true;
-                break;
-            }
-            aux.push(let_stack.top());
-            let_stack.pop();
+        for (std::vector<LetScope *>::reverse_iterator I = let_stack.rbegin(),
+                 E = let_stack.rend(); I != E; ++I) {
+            if ((*I)->lookup(v, out)) return true;
         }
-        while (!aux.empty()) {
-            let_stack.push(aux.top());
-            aux.pop();
+        return false;
+    }
+
+    // Names are written piece by piece rather than built as strings
+    // first, since they make up much of the output.
+    void output_name(const Name &n, const char *prefix="") {
+        if (short_names) {
+            output_short_name(prefix + n.str());
+            return;
+        }
+        stream << prefix;
+        for (std::vector<std::string>::const_iterator I = n.namespace_id.begin(),
+                 E = n.namespace_id.end(); I != E; ++I) {
+            stream << *I << '_';
         }
-        return found;
+        stream << n.name;
     }
 
-    std::string lookup_name(const Variable *v) {
+    void output_name(const Variable *v) {
         std::string tmp;
         if (lookup_let(v, tmp)) {
             assert(false);
-            return tmp;
+            stream << tmp;
         } else {
-            return v->name.str();
+            output_name(v->name);
         }
     }
 
-    std::string function_name(const Function *f) {
-        // Ensure a function name is always qualified somehow.
-        if (f->name.namespace_id.empty()) {
-            return "bish_" + f->name.str();
-        }
-        return f->name.str();
+    // Writes Function::qualified_name().
+    void output_function_name(const Function *f) {
+        output_name(f->name, f->name.namespace_id.empty() ? "bish_" : "");
+    }
+
+    // Names which weren't renamed are written as they are.
+    void output_short_name(const std::string &name) {
+        NameMap::const_iterator I = short_names->find(name);
+        stream << (I == short_names->end() ? name : I->second);
     }
 };
 
@@ -1,13 +1,12 @@
 #include <cassert>
 #include <cstdlib>
-#include "ByReferencePass.h"
 #include "CodeGen.h"
 #include "CodeGen_Bash.h"
 #include "Compile.h"
 #include "Config.h"
 #include "Parser.h"
-#include "ReturnValuesPass.h"
-#include "TypeChecker.h"
+#include "PassManager.h"
+#include "TimeReport.h"
 #include "Util.h"
 
 using namespace Bish;
@@ -15,46 +14,78 @@ using namespace Bish;
 namespace {
 
 // Add necessary stdlib functions to the given module.
-void link_stdlib(Bish::Module *m) {
-    Parser p;
-    Module *stdlib = p.parse(get_stdlib_path());
+void link_stdlib(Bish::Module *m, ModuleCache *cache) {
+    Module *stdlib;
+    if (cache) {
+        stdlib = cache->parse(get_stdlib_path());
+    } else {
+        Parser p;
+        stdlib = p.parse(get_stdlib_path());
+    }
     // TODO: this seems clunky. Trying to avoid importing stdlib if
     // the user is compiling stdlib itself.
     if (m->path.compare(stdlib->path) != 0) {
         m->import(stdlib);
+    } else {
+        delete stdlib;
     }
 }
 
-// Run an ordered list of post-link passes over the IR.
-void link_time_passes(Bish::Module *m) {
-    // Type checking
-    TypeChecker types;
-    m->accept(&types);
-
-    // Adjust the IR to handle values that should be passed by
-    // reference (e.g. arrays) to functions.
-    ByReferencePass refs;
-    m->accept(&refs);
-
-    // Convert function return values into global variable
-    // assignments.
-    ReturnValuesPass retvals;
-    m->accept(&retvals);
+// Mark the functions of a library, or of the libraries the module is
+// linked against. Every function of a library is put in its
+// namespace, so that the library can't clash with the script sourcing
+// it, and the library's own functions are exported. Functions imported
+// from a linked library (including those it imported in turn) come
+// from it at run time.
+void link_libraries(Bish::Module *m, const CodeGenOptions &options) {
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (f == m->main) continue;
+        const std::vector<std::string> &ns = f->name.namespace_id;
+        if (options.library) {
+            f->exported = ns.empty();
+            f->name.add_namespace(m->namespace_id);
+        } else if (!ns.empty() && options.external_libraries.count(ns[0])) {
+            f->external = true;
+        }
+    }
 }
 
 }
 
-// Link and compile the given Module using the given code generator.
+// Link and compile the given Module using the given code generator,
+// with the default optimization level.
 void Bish::compile(Module *m, CodeGenerator *cg) {
-    link_stdlib(m);
-
-    link_time_passes(m);
-    
-    cg->ostream() << "#!/usr/bin/env bash\n"
-    << "# Autogenerated script, compiled from the Bish language.\n"
-    << "# Bish version " << BISH_VERSION << "\n"
-    << "# Please see " << BISH_URL << " for more information about Bish.\n";
-    m->accept(cg);
+    PassManager passes;
+    passes.add_pipeline(PassManager::pipeline(DefaultOptLevel));
+    compile(m, cg, passes);
+}
+
+// Link and compile the given Module using the given code generator,
+// running the given link-time passes. The standard library and any
+// imports are taken from the given cache, if any.
+void Bish::compile(Module *m, CodeGenerator *cg, PassManager &passes, ModuleCache *cache) {
+    {
+        TimeReport::Scope scope("link stdlib");
+        link_stdlib(m, cache);
+        link_libraries(m, cg->options());
+    }
 
-    cg->ostream().flush();
+    {
+        TimeReport::Scope scope("passes");
+        passes.run(m);
+        // Code generation relies on every node having its type.
+        passes.require(m, "types");
+    }
+
+    TimeReport::Scope scope("codegen");
+    scope.set_ir_nodes(m->num_nodes());
+
+    cg->output() << "#!/usr/bin/env bash\n";
+    if (!cg->options().minify) {
+        cg->output() << "# Autogenerated script, compiled from the Bish language.\n"
+        << "# Bish version " << BISH_VERSION << "\n"
+        << "# Please see " << BISH_URL << " for more information about Bish.\n";
+    }
+    m->accept(cg);
 }
@@ -4,10 +4,15 @@
 #include <iostream>
 #include "CodeGen.h"
 #include "IR.h"
+#include "ModuleCache.h"
+#include "PassManager.h"
 
 namespace Bish {
 
+const unsigned DefaultOptLevel = 1;
+
 void compile(Module *m, Bish::CodeGenerator *c);
+void compile(Module *m, Bish::CodeGenerator *c, PassManager &passes, ModuleCache *cache=NULL);
 
 }
 
@@ -0,0 +1,80 @@
+#include <memory>
+#include "CompilerInstance.h"
+#include "Compile.h"
+#include "Errors.h"
+#include "Parser.h"
+#include "PassManager.h"
+
+using namespace Bish;
+
+CompilerInstance::CompilerInstance() :
+    cg_constructor(CodeGenerators::get("bash")),
+    pipeline(PassManager::pipeline(DefaultOptLevel)),
+    cache(NULL),
+    jobs(1) {}
+
+bool CompilerInstance::set_code_generator(const std::string &name) {
+    CodeGenerators::CodeGeneratorConstructor c = CodeGenerators::get(name);
+    if (c == NULL) return false;
+    cg_constructor = c;
+    return true;
+}
+
+bool CompilerInstance::set_opt_level(unsigned level) {
+    if (level > PassManager::MaxOptLevel) return false;
+    pipeline = PassManager::pipeline(level);
+    return true;
+}
+
+bool CompilerInstance::set_passes(const std::string &names) {
+    PassManager check;
+    if (!check.add_pipeline(names)) return false;
+    pipeline = names;
+    return true;
+}
+
+void CompilerInstance::set_jobs(unsigned n) {
+    if (n == jobs) return;
+    jobs = n;
+    pool.reset();
+}
+
+bool CompilerInstance::compile_file(const std::string &path) {
+    return compile(path, NULL);
+}
+
+bool CompilerInstance::compile_string(const std::string &text, const std::string &path) {
+    return compile(path, &text);
+}
+
+// Errors anywhere in the compiler are thrown as CompileErrors, and
+// stop here.
+bool CompilerInstance::compile(const std::string &path, const std::string *text) {
+    out.clear();
+    extra.clear();
+    diags.clear();
+    deps.clear();
+    if (jobs > 1 && !pool) pool.reset(new ThreadPool(jobs));
+    ThreadPool::Scope scope(pool.get());
+    try {
+        Parser p(cache);
+        std::unique_ptr<Module> m(text ? p.parse_string(*text, path) :
+                                  cache ? cache->parse(path) : p.parse(path));
+        PassManager passes;
+        passes.add_pipeline(pipeline);
+        std::unique_ptr<CodeGenerator> cg(cg_constructor(out, cg_options));
+        Bish::compile(m.get(), cg.get(), passes, cache);
+        extra.swap(cg->extra_output());
+        deps = m->dependencies;
+        return true;
+    } catch (const CompileError &e) {
+        out.clear();
+        extra.clear();
+        Diagnostic d;
+        d.message = e.what();
+        d.file = e.file;
+        d.line = e.line;
+        diags.push_back(d);
+        return false;
+    }
+}
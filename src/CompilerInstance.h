@@ -0,0 +1,99 @@
+#ifndef __BISH_COMPILER_INSTANCE_H__
+#define __BISH_COMPILER_INSTANCE_H__
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "CodeGen.h"
+#include "ModuleCache.h"
+#include "OutputBuffer.h"
+#include "ThreadPool.h"
+
+namespace Bish {
+
+// A problem found while compiling a script.
+struct Diagnostic {
+    std::string message;
+    // Path and line of the script the diagnostic refers to; the path
+    // is empty if unknown.
+    std::string file;
+    unsigned line;
+};
+
+/* An in-process compiler: takes a script and gives back the compiled
+ * script, or the diagnostics explaining why it couldn't be
+ * compiled. Errors never abort the process. Instances share no state,
+ * so each thread can compile with its own instance; instances given
+ * the same ModuleCache share parsed modules through it.
+ *
+ * Example:
+ *     CompilerInstance ci;
+ *     ci.set_opt_level(2);
+ *     if (ci.compile_string("println(1 + 2)", "add.bish")) {
+ *         std::string bash = ci.output();
+ *     } else {
+ *         const std::vector<Diagnostic> &errors = ci.diagnostics();
+ *     }
+ */
+class CompilerInstance {
+public:
+    CompilerInstance();
+
+    // Use the named code generator. Returns false if there is none.
+    bool set_code_generator(const std::string &name);
+    // Use the default pass pipeline of an optimization level. Returns
+    // false if the level doesn't exist.
+    bool set_opt_level(unsigned level);
+    // Use a comma-separated list of passes. Returns false, changing
+    // nothing, if any of them doesn't exist.
+    bool set_passes(const std::string &names);
+    // Take the script, the standard library and imported modules from
+    // the given cache, which may be shared with other instances.
+    void set_module_cache(ModuleCache *c) { cache = c; }
+    // Spread the per-function work of each compile (the passes that
+    // rewrite functions one at a time, and code generation) over the
+    // given number of threads. The output doesn't depend on it. The
+    // default is 1, i.e. everything runs on the calling thread.
+    void set_jobs(unsigned n);
+    // Options for the code generator, e.g. to minify the output.
+    void set_code_gen_options(const CodeGenOptions &o) { cg_options = o; }
+
+    // Compile the script at the given path. Returns true on success.
+    bool compile_file(const std::string &path);
+    // Compile the given script text. Imports are resolved and the
+    // module named as if the script were at the given path.
+    bool compile_string(const std::string &text, const std::string &path);
+
+    // The compiled script of the last successful compile.
+    std::string output() const { return out.str(); }
+    // The same, without copying it out of the code generator's buffer.
+    const OutputBuffer &output_buffer() const { return out; }
+    // The files to write next to the compiled script, e.g. the
+    // functions it autoloads.
+    const std::vector<OutputFile> &extra_output() const { return extra; }
+    // The diagnostics of the last compile.
+    const std::vector<Diagnostic> &diagnostics() const { return diags; }
+    // The paths of the modules the last successful compile linked in,
+    // including the standard library.
+    const std::set<std::string> &dependencies() const { return deps; }
+
+private:
+    CodeGenerators::CodeGeneratorConstructor cg_constructor;
+    CodeGenOptions cg_options;
+    std::string pipeline;
+    ModuleCache *cache;
+    // Created on first use when more than one job is asked for.
+    unsigned jobs;
+    std::unique_ptr<ThreadPool> pool;
+    OutputBuffer out;
+    std::vector<OutputFile> extra;
+    std::vector<Diagnostic> diags;
+    std::set<std::string> deps;
+
+    bool compile(const std::string &path, const std::string *text);
+};
+
+}
+
+#endif
@@ -1,39 +1,75 @@
 #ifndef __BISH_ERRORS_H__
 #define __BISH_ERRORS_H__
 
-#include <cstdlib>
-#include <iostream>
+#include <exception>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <sstream>
 
 namespace Bish {
 
+class IRDebugInfo;
+
+// Thrown when a script can't be compiled. Holds the script location
+// the error refers to, if known.
+class CompileError : public std::runtime_error {
+public:
+    CompileError(const std::string &msg, const std::string &file="", unsigned line=0) :
+        std::runtime_error(msg), file(file), line(line) {}
+    // Path of the script, empty if unknown.
+    std::string file;
+    unsigned line;
+};
+
 class ErrorReport {
 public:
     ErrorReport(const char *f, int l, bool abort=false) {
         file = f;
         lineno = l;
         abort_condition = abort;
+        location_line = 0;
     }
 
-    ~ErrorReport() {
-        if (abort_condition) {
-            std::cerr << "Bish error: " << msg.str() << "\n";
-            abort();
+    ~ErrorReport() noexcept(false) {
+        // Don't throw while the stack is already unwinding from
+        // another error.
+        if (abort_condition && std::uncaught_exceptions() == 0) {
+            throw CompileError(msg ? msg->str() : "", location_file, location_line);
         }
     }
-    
+
+    // Set the script location the error refers to.
+    ErrorReport &at(const std::string &f, unsigned line) {
+        location_file = f;
+        location_line = line;
+        return *this;
+    }
+
+    // Nothing is formatted unless the report will be thrown, since
+    // checks which pass are far more common than errors.
     template<typename T>
     ErrorReport &operator<<(T x) {
-        msg << x;
+        if (abort_condition) stream() << x;
         return *this;
     }
+    // Prints the debug information, and takes the location from it if
+    // none is set yet.
+    ErrorReport &operator<<(const IRDebugInfo &info);
 
 private:
     const char *file;
     int lineno;
-    std::ostringstream msg;
+    // Created on first use.
+    std::unique_ptr<std::ostringstream> msg;
     bool abort_condition;
+    std::string location_file;
+    unsigned location_line;
+
+    std::ostringstream &stream() {
+        if (!msg) msg.reset(new std::ostringstream());
+        return *msg;
+    }
 };
 
 #define bish_abort()      Bish::ErrorReport(__FILE__, __LINE__, true)
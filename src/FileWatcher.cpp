@@ -0,0 +1,98 @@
+#include <unistd.h>
+#include "FileWatcher.h"
+#include "Util.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace Bish;
+
+#ifdef __linux__
+
+namespace {
+
+// Events meaning a file in a watched directory has new contents (or
+// is gone).
+const uint32_t ChangeEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+
+}
+
+FileWatcher::FileWatcher() {
+    fd = inotify_init1(IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher() {
+    if (fd >= 0) close(fd);
+}
+
+void FileWatcher::watch(const std::set<std::string> &paths) {
+    if (fd < 0) return;
+    files.clear();
+    std::set<std::string> dirs;
+    for (std::set<std::string>::const_iterator I = paths.begin(), E = paths.end(); I != E; ++I) {
+        std::string dir = abspath(dirname(*I));
+        if (dir.empty()) continue;
+        dirs.insert(dir);
+        files[std::make_pair(dir, basename(*I))] = *I;
+    }
+    // Stop watching directories which no longer hold a watched file.
+    for (std::map<std::string, int>::iterator I = dir_watches.begin(); I != dir_watches.end();) {
+        if (dirs.count(I->first)) {
+            ++I;
+            continue;
+        }
+        inotify_rm_watch(fd, I->second);
+        watched_dirs.erase(I->second);
+        dir_watches.erase(I++);
+    }
+    for (std::set<std::string>::iterator I = dirs.begin(), E = dirs.end(); I != E; ++I) {
+        if (dir_watches.count(*I)) continue;
+        int wd = inotify_add_watch(fd, I->c_str(), ChangeEvents);
+        if (wd < 0) continue;
+        dir_watches[*I] = wd;
+        watched_dirs[wd] = *I;
+    }
+}
+
+std::set<std::string> FileWatcher::wait(unsigned debounce_ms) {
+    std::set<std::string> changed;
+    if (fd < 0) return changed;
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    // Wait as long as it takes for the first change, then only for
+    // the debounce interval.
+    while (changed.empty()) {
+        if (poll(&p, 1, -1) > 0) read_events(changed);
+    }
+    while (poll(&p, 1, debounce_ms) > 0) {
+        read_events(changed);
+    }
+    return changed;
+}
+
+void FileWatcher::read_events(std::set<std::string> &changed) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(fd, buf, sizeof(buf));
+    for (char *p = buf; n > 0 && p < buf + n;) {
+        const struct inotify_event *e = reinterpret_cast<const struct inotify_event *>(p);
+        p += sizeof(struct inotify_event) + e->len;
+        std::map<int, std::string>::iterator D = watched_dirs.find(e->wd);
+        if (D == watched_dirs.end() || e->len == 0) continue;
+        std::map<std::pair<std::string, std::string>, std::string>::iterator F =
+            files.find(std::make_pair(D->second, std::string(e->name)));
+        if (F != files.end()) changed.insert(F->second);
+    }
+}
+
+#else
+
+FileWatcher::FileWatcher() : fd(-1) {}
+FileWatcher::~FileWatcher() {}
+void FileWatcher::watch(const std::set<std::string> &paths) {}
+std::set<std::string> FileWatcher::wait(unsigned debounce_ms) { return std::set<std::string>(); }
+void FileWatcher::read_events(std::set<std::string> &changed) {}
+
+#endif
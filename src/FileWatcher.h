@@ -0,0 +1,48 @@
+#ifndef __BISH_FILE_WATCHER_H__
+#define __BISH_FILE_WATCHER_H__
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace Bish {
+
+/* Waits for a set of files to change, using inotify (so only on
+ * Linux). The directories containing the files are watched rather
+ * than the files themselves, so that a file which an editor replaces
+ * (by writing a new file and renaming it over the old one) is still
+ * noticed.
+ *
+ * Example:
+ *     FileWatcher w;
+ *     w.watch(files);
+ *     std::set<std::string> changed = w.wait(100);
+ */
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+    // Return false if files can't be watched on this system.
+    bool supported() const { return fd >= 0; }
+    // Watch exactly the given files from now on.
+    void watch(const std::set<std::string> &paths);
+    // Block until a watched file changes, then keep collecting
+    // changes until none arrive for debounce_ms milliseconds. Returns
+    // the changed files, as they were given to watch().
+    std::set<std::string> wait(unsigned debounce_ms);
+private:
+    int fd;
+    // Watch descriptor of each watched directory, and back.
+    std::map<std::string, int> dir_watches;
+    std::map<int, std::string> watched_dirs;
+    // Watched files by (absolute directory, name), mapped to the path
+    // given to watch().
+    std::map<std::pair<std::string, std::string>, std::string> files;
+
+    // Read the pending events, adding changed files to 'changed'.
+    void read_events(std::set<std::string> &changed);
+};
+
+}
+
+#endif
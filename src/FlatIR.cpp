@@ -0,0 +1,1028 @@
+#include <cassert>
+#include <cstring>
+#include "FlatIR.h"
+#include "IRAncestorsPass.h"
+
+namespace Bish {
+
+// Encodes a Module into a FlatModule. Children are always encoded
+// before their parent, so that every child list can be appended to
+// the side table as one contiguous range.
+class FlatModuleBuilder : public IRVisitor {
+public:
+    FlatModuleBuilder(FlatModule *f) : flat(f), current_function(FlatNullIndex), result(FlatNullRef) {}
+
+    void build(Module *m) {
+        flat->path = m->path;
+        flat->namespace_id = m->namespace_id;
+        for (std::vector<Function *>::const_iterator I = m->functions.begin(),
+                 E = m->functions.end(); I != E; ++I) {
+            FlatIndex i = function(*I);
+            flat->module_functions.push_back(i);
+            if (*I == m->main) flat->main = i;
+        }
+        flat->global_variables = flatten(m->global_variables);
+        // Defining a function can discover new (e.g. not yet linked)
+        // callees, so the list may grow while iterating.
+        for (unsigned i = 0; i < function_nodes.size(); i++) {
+            define_function(i);
+        }
+    }
+
+    virtual void visit(Block *n) {
+        std::vector<FlatRef> refs;
+        for (std::vector<IRNode *>::const_iterator I = n->nodes.begin(),
+                 E = n->nodes.end(); I != E; ++I) {
+            refs.push_back(flatten(*I));
+        }
+        FlatBlock b;
+        b.nodes = flat->add_children(refs);
+        result = add(flat->blocks, FlatModule::BlockKind, b, n);
+    }
+
+    virtual void visit(Variable *n) {
+        result = FlatModule::make_ref(FlatModule::VariableKind, variable(n));
+    }
+
+    virtual void visit(Location *n) {
+        FlatLocation l;
+        l.variable = variable(n->variable);
+        l.offset = flatten(n->offset);
+        result = add(flat->locations, FlatModule::LocationKind, l, n);
+    }
+
+    virtual void visit(Function *n) {
+        result = FlatModule::make_ref(FlatModule::FunctionKind, function(n));
+    }
+
+    virtual void visit(FunctionCall *n) {
+        std::vector<FlatRef> refs;
+        for (std::vector<Assignment *>::const_iterator I = n->args.begin(),
+                 E = n->args.end(); I != E; ++I) {
+            refs.push_back(flatten(*I));
+        }
+        FlatFunctionCall c;
+        c.function = function(n->function);
+        c.caller = current_function;
+        c.args = flat->add_children(refs);
+        result = add(flat->calls, FlatModule::FunctionCallKind, c, n);
+    }
+
+    virtual void visit(ExternCall *n) {
+        FlatExternCall e;
+        e.body = interp(n->body);
+        result = add(flat->extern_calls, FlatModule::ExternCallKind, e, n);
+    }
+
+    virtual void visit(IORedirection *n) {
+        FlatIORedirection r;
+        r.op = n->op;
+        r.a = flatten(n->a);
+        r.b = flatten(n->b);
+        result = add(flat->redirections, FlatModule::IORedirectionKind, r, n);
+    }
+
+    virtual void visit(IfStatement *n) {
+        std::vector<FlatRef> refs;
+        refs.push_back(flatten(n->pblock->condition));
+        refs.push_back(flatten(n->pblock->body));
+        for (std::vector<PredicatedBlock *>::const_iterator I = n->elses.begin(),
+                 E = n->elses.end(); I != E; ++I) {
+            refs.push_back(flatten((*I)->condition));
+            refs.push_back(flatten((*I)->body));
+        }
+        FlatIfStatement s;
+        s.elseblock = flatten(n->elseblock);
+        s.clauses = flat->add_children(refs);
+        result = add(flat->ifs, FlatModule::IfStatementKind, s, n);
+    }
+
+    virtual void visit(ForLoop *n) {
+        FlatForLoop l;
+        l.variable = variable(n->variable);
+        l.lower = flatten(n->lower);
+        l.upper = flatten(n->upper);
+        l.body = flatten(n->body);
+        result = add(flat->loops, FlatModule::ForLoopKind, l, n);
+    }
+
+    virtual void visit(Assignment *n) {
+        FlatAssignment a;
+        a.location = FlatModule::index(flatten(n->location));
+        std::vector<FlatRef> refs;
+        for (std::vector<IRNode *>::const_iterator I = n->values.begin(),
+                 E = n->values.end(); I != E; ++I) {
+            refs.push_back(flatten(*I));
+        }
+        a.values = flat->add_children(refs);
+        result = add(flat->assignments, FlatModule::AssignmentKind, a, n);
+    }
+
+    virtual void visit(ImportStatement *n) {
+        FlatImportStatement s;
+        s.module_name = flat->intern_string(n->module_name);
+        s.path = flat->intern_string(n->path);
+        result = add(flat->imports, FlatModule::ImportStatementKind, s, n);
+    }
+
+    virtual void visit(ReturnStatement *n) {
+        FlatReturnStatement r;
+        r.value = flatten(n->value);
+        result = add(flat->returns, FlatModule::ReturnStatementKind, r, n);
+    }
+
+    virtual void visit(LoopControlStatement *n) {
+        FlatLoopControlStatement l;
+        l.op = n->op;
+        result = add(flat->loop_controls, FlatModule::LoopControlStatementKind, l, n);
+    }
+
+    virtual void visit(BinOp *n) {
+        FlatBinOp b;
+        b.op = n->op;
+        b.a = flatten(n->a);
+        b.b = flatten(n->b);
+        result = add(flat->binops, FlatModule::BinOpKind, b, n);
+    }
+
+    virtual void visit(UnaryOp *n) {
+        FlatUnaryOp u;
+        u.op = n->op;
+        u.a = flatten(n->a);
+        result = add(flat->unaryops, FlatModule::UnaryOpKind, u, n);
+    }
+
+    virtual void visit(Integer *n) {
+        FlatInteger i;
+        i.value = n->value;
+        result = add(flat->integers, FlatModule::IntegerKind, i, n);
+    }
+
+    virtual void visit(Fractional *n) {
+        FlatFractional f;
+        f.value = n->value;
+        result = add(flat->fractionals, FlatModule::FractionalKind, f, n);
+    }
+
+    virtual void visit(String *n) {
+        FlatString s;
+        s.value = interp(n->value);
+        result = add(flat->string_literals, FlatModule::StringKind, s, n);
+    }
+
+    virtual void visit(Boolean *n) {
+        FlatBoolean b;
+        b.value = n->value;
+        result = add(flat->booleans, FlatModule::BooleanKind, b, n);
+    }
+
+private:
+    FlatModule *flat;
+    FlatIndex current_function;
+    FlatRef result;
+    std::map<IRNode *, FlatRef> node_map;
+    std::map<Variable *, FlatIndex> variable_map;
+    std::map<Function *, FlatIndex> function_map;
+    std::vector<Function *> function_nodes;
+    std::vector<bool> function_defined;
+
+    FlatRef flatten(IRNode *n) {
+        if (n == NULL) return FlatNullRef;
+        // Nodes may be shared (e.g. call argument assignments also
+        // appear in the enclosing block), so encode each only once.
+        std::map<IRNode *, FlatRef>::iterator I = node_map.find(n);
+        if (I != node_map.end()) return I->second;
+        result = FlatNullRef;
+        n->accept(this);
+        assert(result != FlatNullRef);
+        node_map[n] = result;
+        return result;
+    }
+
+    template <typename T>
+    FlatRef add(std::vector<T> &table, FlatModule::Kind k, const T &node, IRNode *n) {
+        FlatIndex i = table.size();
+        table.push_back(node);
+        FlatNodeInfo info;
+        info.type = flat->intern_type(n->type());
+        info.debug = flat->add_debug_info(n->debug_info());
+        flat->info[k].push_back(info);
+        return FlatModule::make_ref(k, i);
+    }
+
+    FlatIndex variable(Variable *v) {
+        std::map<Variable *, FlatIndex>::iterator I = variable_map.find(v);
+        if (I != variable_map.end()) return I->second;
+        FlatVariable fv;
+        fv.name = flat->intern_name(v->name);
+        fv.global = v->global;
+        fv.reference = FlatNullIndex;
+        FlatRef r = add(flat->variables, FlatModule::VariableKind, fv, v);
+        FlatIndex i = FlatModule::index(r);
+        variable_map[v] = i;
+        if (v->reference) {
+            FlatIndex ref = variable(v->reference);
+            flat->variables[i].reference = ref;
+        }
+        return i;
+    }
+
+    FlatIndex function(Function *f) {
+        std::map<Function *, FlatIndex>::iterator I = function_map.find(f);
+        if (I != function_map.end()) return I->second;
+        FlatFunction ff;
+        ff.name = flat->intern_name(f->name);
+        ff.body = FlatNullRef;
+        FlatIndex i = FlatModule::index(add(flat->functions, FlatModule::FunctionKind, ff, f));
+        function_map[f] = i;
+        function_nodes.push_back(f);
+        function_defined.push_back(false);
+        return i;
+    }
+
+    void define_function(FlatIndex i) {
+        if (function_defined[i]) return;
+        function_defined[i] = true;
+        Function *f = function_nodes[i];
+        FlatIndex saved = current_function;
+        current_function = i;
+        std::vector<FlatRef> args;
+        for (std::vector<Variable *>::const_iterator I = f->args.begin(),
+                 E = f->args.end(); I != E; ++I) {
+            args.push_back(FlatModule::make_ref(FlatModule::VariableKind, variable(*I)));
+        }
+        FlatRef body = flatten(f->body);
+        flat->functions[i].args = flat->add_children(args);
+        flat->functions[i].body = body;
+        current_function = saved;
+    }
+
+    uint32_t interp(InterpolatedString *s) {
+        std::vector<FlatInterpItem> items;
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            FlatInterpItem item;
+            item.is_var = (*I).is_var();
+            item.value = item.is_var ? variable((*I).var()) : flat->intern_string((*I).str());
+            items.push_back(item);
+        }
+        FlatRange r;
+        r.begin = flat->interp_items.size();
+        r.size = items.size();
+        flat->interp_items.insert(flat->interp_items.end(), items.begin(), items.end());
+        flat->interps.push_back(r);
+        return flat->interps.size() - 1;
+    }
+};
+
+namespace {
+
+// Decodes a FlatModule back into IR.
+class FlatModuleReader {
+public:
+    FlatModuleReader(const FlatModule &f) : flat(f), module(NULL) {}
+
+    Module *read() {
+        Module *m = new Module();
+        module = m;
+        m->path = flat.path;
+        m->namespace_id = flat.namespace_id;
+
+        for (unsigned i = 0; i < flat.variables.size(); i++) {
+            Variable *v = module->own(new Variable(flat.names[flat.variables[i].name]));
+            v->global = flat.variables[i].global;
+            set_info(v, FlatModule::VariableKind, i);
+            vars.push_back(v);
+        }
+        for (unsigned i = 0; i < flat.variables.size(); i++) {
+            if (flat.variables[i].reference != FlatNullIndex) {
+                vars[i]->set_reference(vars[flat.variables[i].reference]);
+            }
+        }
+        for (unsigned i = 0; i < flat.functions.size(); i++) {
+            Function *f = module->own(new Function(flat.names[flat.functions[i].name]));
+            set_info(f, FlatModule::FunctionKind, i);
+            funcs.push_back(f);
+        }
+        for (unsigned i = 0; i < flat.functions.size(); i++) {
+            const FlatFunction &ff = flat.functions[i];
+            std::vector<Variable *> args;
+            for (const FlatRef *I = flat.range_begin(ff.args), *E = flat.range_end(ff.args); I != E; ++I) {
+                args.push_back(vars[FlatModule::index(*I)]);
+            }
+            funcs[i]->set_args(args);
+            if (ff.body != FlatNullRef) funcs[i]->set_body(block(ff.body));
+        }
+        for (std::vector<FlatIndex>::const_iterator I = flat.module_functions.begin(),
+                 E = flat.module_functions.end(); I != E; ++I) {
+            if (*I == flat.main) {
+                m->set_main(funcs[*I]);
+            } else {
+                m->add_function(funcs[*I]);
+            }
+        }
+        for (unsigned i = 0; i < funcs.size(); i++) {
+            if (funcs[i]->body == NULL) m->add_unresolved(funcs[i]);
+        }
+        m->global_variables = block(flat.global_variables);
+
+        IRAncestorsPass ancestors;
+        m->accept(&ancestors);
+        return m;
+    }
+
+private:
+    const FlatModule &flat;
+    Module *module;
+    std::vector<Variable *> vars;
+    std::vector<Function *> funcs;
+    std::map<FlatRef, IRNode *> nodes;
+
+    void set_info(IRNode *n, FlatModule::Kind k, FlatIndex i) {
+        n->set_type(flat.types[flat.info[k][i].type]);
+    }
+
+    const IRDebugInfo &debug_info(FlatModule::Kind k, FlatIndex i) {
+        return flat.debug_infos[flat.info[k][i].debug];
+    }
+
+    Block *block(FlatRef r) {
+        Block *b = dynamic_cast<Block *>(node(r));
+        assert(b);
+        return b;
+    }
+
+    Location *location(FlatIndex i) {
+        Location *loc = dynamic_cast<Location *>(node(FlatModule::make_ref(FlatModule::LocationKind, i)));
+        assert(loc);
+        return loc;
+    }
+
+    Assignment *assignment(FlatIndex i) {
+        Assignment *a = dynamic_cast<Assignment *>(node(FlatModule::make_ref(FlatModule::AssignmentKind, i)));
+        assert(a);
+        return a;
+    }
+
+    InterpolatedString *interp(uint32_t i) {
+        InterpolatedString *s = new InterpolatedString();
+        const FlatRange &r = flat.interps[i];
+        for (unsigned j = r.begin; j < r.begin + r.size; j++) {
+            const FlatInterpItem &item = flat.interp_items[j];
+            if (item.is_var) {
+                s->push_var(vars[item.value]);
+            } else {
+                s->push_str(flat.strings[item.value]);
+            }
+        }
+        return s;
+    }
+
+    // Return the IR node for the given reference, decoding it on first
+    // use so that shared nodes stay shared.
+    IRNode *node(FlatRef r) {
+        if (r == FlatNullRef) return NULL;
+        std::map<FlatRef, IRNode *>::iterator I = nodes.find(r);
+        if (I != nodes.end()) return I->second;
+        IRNode *n = decode(r);
+        nodes[r] = n;
+        return n;
+    }
+
+    IRNode *decode(FlatRef r) {
+        FlatModule::Kind k = FlatModule::kind(r);
+        FlatIndex i = FlatModule::index(r);
+        IRNode *n = NULL;
+        switch (k) {
+        case FlatModule::BlockKind: {
+            const FlatBlock &fb = flat.blocks[i];
+            Block *b = module->own(new Block());
+            for (const FlatRef *I = flat.range_begin(fb.nodes), *E = flat.range_end(fb.nodes); I != E; ++I) {
+                b->nodes.push_back(node(*I));
+            }
+            n = b;
+            break;
+        }
+        case FlatModule::VariableKind:
+            return vars[i];
+        case FlatModule::LocationKind: {
+            const FlatLocation &l = flat.locations[i];
+            n = module->own(new Location(vars[l.variable], node(l.offset)));
+            break;
+        }
+        case FlatModule::FunctionKind:
+            return funcs[i];
+        case FlatModule::FunctionCallKind: {
+            const FlatFunctionCall &c = flat.calls[i];
+            std::vector<Assignment *> args;
+            for (const FlatRef *I = flat.range_begin(c.args), *E = flat.range_end(c.args); I != E; ++I) {
+                args.push_back(assignment(FlatModule::index(*I)));
+            }
+            n = module->own(new FunctionCall(funcs[c.function], args, debug_info(k, i)));
+            break;
+        }
+        case FlatModule::ExternCallKind:
+            n = module->own(new ExternCall(interp(flat.extern_calls[i].body), debug_info(k, i)));
+            break;
+        case FlatModule::IORedirectionKind: {
+            const FlatIORedirection &ior = flat.redirections[i];
+            n = module->own(new IORedirection(ior.op, node(ior.a), node(ior.b), debug_info(k, i)));
+            break;
+        }
+        case FlatModule::IfStatementKind: {
+            const FlatIfStatement &s = flat.ifs[i];
+            const FlatRef *c = flat.range_begin(s.clauses);
+            std::vector<PredicatedBlock *> elses;
+            for (unsigned j = 2; j < s.clauses.size; j += 2) {
+                elses.push_back(new PredicatedBlock(node(c[j]), node(c[j + 1])));
+            }
+            n = module->own(new IfStatement(node(c[0]), node(c[1]), elses, node(s.elseblock), debug_info(k, i)));
+            break;
+        }
+        case FlatModule::ForLoopKind: {
+            const FlatForLoop &l = flat.loops[i];
+            n = module->own(new ForLoop(vars[l.variable], node(l.lower), node(l.upper), node(l.body), debug_info(k, i)));
+            break;
+        }
+        case FlatModule::AssignmentKind: {
+            const FlatAssignment &a = flat.assignments[i];
+            std::vector<IRNode *> values;
+            for (const FlatRef *I = flat.range_begin(a.values), *E = flat.range_end(a.values); I != E; ++I) {
+                values.push_back(node(*I));
+            }
+            n = module->own(new Assignment(location(a.location), values, debug_info(k, i)));
+            break;
+        }
+        case FlatModule::ImportStatementKind: {
+            const FlatImportStatement &s = flat.imports[i];
+            n = module->own(new ImportStatement(flat.strings[s.module_name], flat.strings[s.path], debug_info(k, i)));
+            break;
+        }
+        case FlatModule::ReturnStatementKind:
+            n = module->own(new ReturnStatement(node(flat.returns[i].value), debug_info(k, i)));
+            break;
+        case FlatModule::LoopControlStatementKind:
+            n = module->own(new LoopControlStatement(flat.loop_controls[i].op, debug_info(k, i)));
+            break;
+        case FlatModule::BinOpKind: {
+            const FlatBinOp &b = flat.binops[i];
+            n = module->own(new BinOp(b.op, node(b.a), node(b.b), debug_info(k, i)));
+            break;
+        }
+        case FlatModule::UnaryOpKind: {
+            const FlatUnaryOp &u = flat.unaryops[i];
+            n = module->own(new UnaryOp(u.op, node(u.a), debug_info(k, i)));
+            break;
+        }
+        case FlatModule::IntegerKind:
+            n = module->constants.integer(flat.integers[i].value);
+            break;
+        case FlatModule::FractionalKind:
+            n = module->constants.fractional(flat.fractionals[i].value);
+            break;
+        case FlatModule::StringKind:
+            n = module->constants.string(interp(flat.string_literals[i].value));
+            break;
+        case FlatModule::BooleanKind:
+            n = module->constants.boolean(flat.booleans[i].value);
+            break;
+        default:
+            assert(false && "Invalid flat IR node kind.");
+        }
+        set_info(n, k, i);
+        return n;
+    }
+};
+
+}
+
+FlatModule::FlatModule(Module *m) : main(FlatNullIndex), global_variables(FlatNullRef) {
+    // Index 0 is reserved for "no debug information".
+    debug_infos.push_back(IRDebugInfo());
+    FlatModuleBuilder builder(this);
+    builder.build(m);
+}
+
+Module *FlatModule::to_module() const {
+    FlatModuleReader reader(*this);
+    return reader.read();
+}
+
+unsigned FlatModule::size() const {
+    return blocks.size() + variables.size() + locations.size() + functions.size() +
+        calls.size() + extern_calls.size() + redirections.size() + ifs.size() +
+        loops.size() + assignments.size() + imports.size() + returns.size() +
+        loop_controls.size() + binops.size() + unaryops.size() + integers.size() +
+        fractionals.size() + string_literals.size() + booleans.size();
+}
+
+std::vector<unsigned> FlatModule::call_site_counts() const {
+    std::vector<unsigned> counts(functions.size(), 0);
+    for (std::vector<FlatFunctionCall>::const_iterator I = calls.begin(), E = calls.end(); I != E; ++I) {
+        counts[I->function]++;
+    }
+    return counts;
+}
+
+uint32_t FlatModule::intern_name(const Name &n) {
+    std::map<Name, uint32_t>::iterator I = name_map.find(n);
+    if (I != name_map.end()) return I->second;
+    names.push_back(n);
+    name_map[n] = names.size() - 1;
+    return names.size() - 1;
+}
+
+uint32_t FlatModule::intern_string(const std::string &s) {
+    std::map<std::string, uint32_t>::iterator I = string_map.find(s);
+    if (I != string_map.end()) return I->second;
+    strings.push_back(s);
+    string_map[s] = strings.size() - 1;
+    return strings.size() - 1;
+}
+
+uint32_t FlatModule::intern_type(const Type &t) {
+    // There are only a handful of distinct types in any module.
+    for (unsigned i = 0; i < types.size(); i++) {
+        if (types[i] == t) return i;
+    }
+    types.push_back(t);
+    return types.size() - 1;
+}
+
+uint32_t FlatModule::add_debug_info(const IRDebugInfo &d) {
+    if (d.file.empty() && d.lineno == 0) return 0;
+    debug_infos.push_back(d);
+    return debug_infos.size() - 1;
+}
+
+FlatRange FlatModule::add_children(const std::vector<FlatRef> &refs) {
+    FlatRange r;
+    r.begin = children.size();
+    r.size = refs.size();
+    children.insert(children.end(), refs.begin(), refs.end());
+    return r;
+}
+
+namespace {
+
+// Tags the serialized form, so that reading anything else fails.
+const char FlatMagic[] = "BISHFLAT";
+
+template <typename T>
+void write_pod(std::ostream &os, const T &v) {
+    os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+// The fields of each table entry, in the order they are serialized.
+// Entries are written a field at a time rather than as raw structs,
+// so that no padding bytes end up in the output, and the same output
+// is written for the same module every time.
+template <typename F> void fields(F &f, uint32_t &v) { f(v); }
+template <typename F> void fields(F &f, FlatRange &r) { f(r.begin); f(r.size); }
+template <typename F> void fields(F &f, FlatNodeInfo &n) { f(n.type); f(n.debug); }
+template <typename F> void fields(F &f, FlatBlock &b) { fields(f, b.nodes); }
+template <typename F> void fields(F &f, FlatVariable &v) { f(v.name); f(v.global); f(v.reference); }
+template <typename F> void fields(F &f, FlatLocation &l) { f(l.variable); f(l.offset); }
+template <typename F> void fields(F &f, FlatFunction &fn) { f(fn.name); fields(f, fn.args); f(fn.body); }
+template <typename F> void fields(F &f, FlatFunctionCall &c) {
+    f(c.function);
+    f(c.caller);
+    fields(f, c.args);
+}
+template <typename F> void fields(F &f, FlatExternCall &c) { f(c.body); }
+template <typename F> void fields(F &f, FlatIORedirection &r) { f(r.op); f(r.a); f(r.b); }
+template <typename F> void fields(F &f, FlatIfStatement &s) { fields(f, s.clauses); f(s.elseblock); }
+template <typename F> void fields(F &f, FlatForLoop &l) { f(l.variable); f(l.lower); f(l.upper); f(l.body); }
+template <typename F> void fields(F &f, FlatAssignment &a) { f(a.location); fields(f, a.values); }
+template <typename F> void fields(F &f, FlatImportStatement &s) { f(s.module_name); f(s.path); }
+template <typename F> void fields(F &f, FlatReturnStatement &r) { f(r.value); }
+template <typename F> void fields(F &f, FlatLoopControlStatement &l) { f(l.op); }
+template <typename F> void fields(F &f, FlatBinOp &b) { f(b.op); f(b.a); f(b.b); }
+template <typename F> void fields(F &f, FlatUnaryOp &u) { f(u.op); f(u.a); }
+template <typename F> void fields(F &f, FlatInteger &i) { f(i.value); }
+template <typename F> void fields(F &f, FlatFractional &d) { f(d.value); }
+template <typename F> void fields(F &f, FlatString &s) { f(s.value); }
+template <typename F> void fields(F &f, FlatBoolean &b) { f(b.value); }
+template <typename F> void fields(F &f, FlatInterpItem &i) { f(i.is_var); f(i.value); }
+
+// The number of values of each operator enum, for checking read
+// values.
+uint32_t num_values(IORedirection::Operator) { return IORedirection::Pipe + 1; }
+uint32_t num_values(LoopControlStatement::Operator) { return LoopControlStatement::Continue + 1; }
+uint32_t num_values(BinOp::Operator) { return BinOp::Or + 1; }
+uint32_t num_values(UnaryOp::Operator) { return UnaryOp::Not + 1; }
+
+class FieldWriter {
+public:
+    FieldWriter(std::ostream &os) : os(os) {}
+    void operator()(uint32_t v) { write_pod(os, v); }
+    void operator()(int v) { write_pod(os, (int32_t)v); }
+    void operator()(double v) { write_pod(os, v); }
+    void operator()(bool v) { write_pod(os, (uint8_t)v); }
+    // Operator enums.
+    template <typename E>
+    void operator()(E v) { write_pod(os, (uint32_t)v); }
+private:
+    std::ostream &os;
+};
+
+// Tables are written as a count followed by the entries.
+template <typename T>
+void write_table(std::ostream &os, const std::vector<T> &v) {
+    write_pod(os, (uint32_t)v.size());
+    FieldWriter w(os);
+    for (typename std::vector<T>::const_iterator I = v.begin(), E = v.end(); I != E; ++I) {
+        // fields() only reads the entry when given a writer.
+        fields(w, const_cast<T &>(*I));
+    }
+}
+
+// Checks that every reference, index and range in a FlatModule read
+// from a stream is within its table, and that references are of the
+// kinds decoding expects, so that a damaged stream can't make
+// decoding read outside the tables.
+class FlatModuleChecker {
+public:
+    FlatModuleChecker(const FlatModule &flat) : flat(flat) {}
+
+    bool check() const {
+        typedef FlatModule M;
+        if (flat.debug_infos.empty()) return false;
+        for (unsigned k = 0; k < M::NumKinds; k++) {
+            if (flat.info[k].size() != table_size((M::Kind)k)) return false;
+            for (unsigned i = 0; i < flat.info[k].size(); i++) {
+                const FlatNodeInfo &n = flat.info[k][i];
+                if (n.type >= flat.types.size() || n.debug >= flat.debug_infos.size()) return false;
+            }
+        }
+        for (unsigned i = 0; i < flat.blocks.size(); i++) {
+            if (!nodes(flat.blocks[i].nodes)) return false;
+        }
+        for (unsigned i = 0; i < flat.variables.size(); i++) {
+            const FlatVariable &v = flat.variables[i];
+            if (v.name >= flat.names.size() ||
+                !optional_index(v.reference, flat.variables.size())) return false;
+        }
+        for (unsigned i = 0; i < flat.locations.size(); i++) {
+            const FlatLocation &l = flat.locations[i];
+            if (l.variable >= flat.variables.size() || !optional(l.offset)) return false;
+        }
+        for (unsigned i = 0; i < flat.functions.size(); i++) {
+            const FlatFunction &f = flat.functions[i];
+            if (f.name >= flat.names.size() || !nodes(f.args, M::VariableKind)) return false;
+            if (f.body != FlatNullRef && !node(f.body, M::BlockKind)) return false;
+        }
+        for (unsigned i = 0; i < flat.calls.size(); i++) {
+            const FlatFunctionCall &c = flat.calls[i];
+            if (c.function >= flat.functions.size() || !optional_index(c.caller, flat.functions.size()) ||
+                !nodes(c.args, M::AssignmentKind)) return false;
+        }
+        for (unsigned i = 0; i < flat.extern_calls.size(); i++) {
+            if (flat.extern_calls[i].body >= flat.interps.size()) return false;
+        }
+        for (unsigned i = 0; i < flat.redirections.size(); i++) {
+            if (!node(flat.redirections[i].a) || !node(flat.redirections[i].b)) return false;
+        }
+        for (unsigned i = 0; i < flat.ifs.size(); i++) {
+            const FlatIfStatement &s = flat.ifs[i];
+            if (s.clauses.size < 2 || s.clauses.size % 2 != 0 || !nodes(s.clauses) ||
+                !optional(s.elseblock)) return false;
+        }
+        for (unsigned i = 0; i < flat.loops.size(); i++) {
+            const FlatForLoop &l = flat.loops[i];
+            if (l.variable >= flat.variables.size() || !node(l.lower) || !node(l.upper) ||
+                !node(l.body)) return false;
+        }
+        for (unsigned i = 0; i < flat.assignments.size(); i++) {
+            const FlatAssignment &a = flat.assignments[i];
+            if (a.location >= flat.locations.size() || a.values.size == 0 || !nodes(a.values)) return false;
+        }
+        for (unsigned i = 0; i < flat.imports.size(); i++) {
+            const FlatImportStatement &s = flat.imports[i];
+            if (s.module_name >= flat.strings.size() || s.path >= flat.strings.size()) return false;
+        }
+        for (unsigned i = 0; i < flat.returns.size(); i++) {
+            if (!optional(flat.returns[i].value)) return false;
+        }
+        for (unsigned i = 0; i < flat.binops.size(); i++) {
+            if (!node(flat.binops[i].a) || !node(flat.binops[i].b)) return false;
+        }
+        for (unsigned i = 0; i < flat.unaryops.size(); i++) {
+            if (!node(flat.unaryops[i].a)) return false;
+        }
+        for (unsigned i = 0; i < flat.string_literals.size(); i++) {
+            if (flat.string_literals[i].value >= flat.interps.size()) return false;
+        }
+        for (unsigned i = 0; i < flat.interps.size(); i++) {
+            if (!range(flat.interps[i], flat.interp_items.size())) return false;
+        }
+        for (unsigned i = 0; i < flat.interp_items.size(); i++) {
+            const FlatInterpItem &item = flat.interp_items[i];
+            if (item.value >= (item.is_var ? flat.variables.size() : flat.strings.size())) return false;
+        }
+        for (unsigned i = 0; i < flat.module_functions.size(); i++) {
+            if (flat.module_functions[i] >= flat.functions.size()) return false;
+        }
+        return optional_index(flat.main, flat.functions.size()) &&
+            node(flat.global_variables, M::BlockKind);
+    }
+
+private:
+    const FlatModule &flat;
+
+    size_t table_size(FlatModule::Kind k) const {
+        switch (k) {
+        case FlatModule::BlockKind: return flat.blocks.size();
+        case FlatModule::VariableKind: return flat.variables.size();
+        case FlatModule::LocationKind: return flat.locations.size();
+        case FlatModule::FunctionKind: return flat.functions.size();
+        case FlatModule::FunctionCallKind: return flat.calls.size();
+        case FlatModule::ExternCallKind: return flat.extern_calls.size();
+        case FlatModule::IORedirectionKind: return flat.redirections.size();
+        case FlatModule::IfStatementKind: return flat.ifs.size();
+        case FlatModule::ForLoopKind: return flat.loops.size();
+        case FlatModule::AssignmentKind: return flat.assignments.size();
+        case FlatModule::ImportStatementKind: return flat.imports.size();
+        case FlatModule::ReturnStatementKind: return flat.returns.size();
+        case FlatModule::LoopControlStatementKind: return flat.loop_controls.size();
+        case FlatModule::BinOpKind: return flat.binops.size();
+        case FlatModule::UnaryOpKind: return flat.unaryops.size();
+        case FlatModule::IntegerKind: return flat.integers.size();
+        case FlatModule::FractionalKind: return flat.fractionals.size();
+        case FlatModule::StringKind: return flat.string_literals.size();
+        case FlatModule::BooleanKind: return flat.booleans.size();
+        default: return 0;
+        }
+    }
+
+    bool optional_index(uint32_t i, size_t size) const {
+        return i == FlatNullIndex || i < size;
+    }
+
+    bool range(const FlatRange &r, size_t size) const {
+        return r.begin <= size && r.size <= size - r.begin;
+    }
+
+    // A reference to an existing node.
+    bool node(FlatRef r) const {
+        return r != FlatNullRef && FlatModule::kind(r) < FlatModule::NumKinds &&
+            FlatModule::index(r) < table_size(FlatModule::kind(r));
+    }
+
+    bool node(FlatRef r, FlatModule::Kind k) const {
+        return node(r) && FlatModule::kind(r) == k;
+    }
+
+    bool optional(FlatRef r) const {
+        return r == FlatNullRef || node(r);
+    }
+
+    // A range of references to existing nodes, of kind k unless it is
+    // NumKinds.
+    bool nodes(const FlatRange &r, FlatModule::Kind k=FlatModule::NumKinds) const {
+        if (!range(r, flat.children.size())) return false;
+        for (uint32_t i = r.begin; i < r.begin + r.size; i++) {
+            FlatRef child = flat.children[i];
+            if (k == FlatModule::NumKinds ? !node(child) : !node(child, k)) return false;
+        }
+        return true;
+    }
+};
+
+void write_string(std::ostream &os, const std::string &s) {
+    write_pod(os, (uint32_t)s.size());
+    os.write(s.data(), s.size());
+}
+
+void write_type(std::ostream &os, const Type &t) {
+    uint8_t k = t.integer() ? 1 : t.fractional() ? 2 : t.string() ? 3 :
+        t.boolean() ? 4 : t.array() ? 5 : 0;
+    write_pod(os, k);
+    if (t.array()) write_type(os, t.element());
+}
+
+}
+
+void FlatModule::write(std::ostream &os) const {
+    os.write(FlatMagic, sizeof(FlatMagic));
+    write_table(os, blocks);
+    write_table(os, variables);
+    write_table(os, locations);
+    write_table(os, functions);
+    write_table(os, calls);
+    write_table(os, extern_calls);
+    write_table(os, redirections);
+    write_table(os, ifs);
+    write_table(os, loops);
+    write_table(os, assignments);
+    write_table(os, imports);
+    write_table(os, returns);
+    write_table(os, loop_controls);
+    write_table(os, binops);
+    write_table(os, unaryops);
+    write_table(os, integers);
+    write_table(os, fractionals);
+    write_table(os, string_literals);
+    write_table(os, booleans);
+    for (unsigned k = 0; k < NumKinds; k++) {
+        write_table(os, info[k]);
+    }
+    write_table(os, children);
+    write_table(os, interps);
+    write_table(os, interp_items);
+
+    write_pod(os, (uint32_t)names.size());
+    for (std::vector<Name>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
+        write_pod(os, (uint32_t)I->namespace_id.size());
+        for (unsigned i = 0; i < I->namespace_id.size(); i++) {
+            write_string(os, I->namespace_id[i]);
+        }
+        write_string(os, I->name);
+    }
+    write_pod(os, (uint32_t)strings.size());
+    for (unsigned i = 0; i < strings.size(); i++) {
+        write_string(os, strings[i]);
+    }
+    write_pod(os, (uint32_t)types.size());
+    for (unsigned i = 0; i < types.size(); i++) {
+        write_type(os, types[i]);
+    }
+    write_pod(os, (uint32_t)debug_infos.size());
+    for (unsigned i = 0; i < debug_infos.size(); i++) {
+        const IRDebugInfo &d = debug_infos[i];
+        write_string(os, d.file);
+        write_pod(os, d.start);
+        write_pod(os, d.end);
+        write_pod(os, d.lineno);
+    }
+
+    write_table(os, module_functions);
+    write_pod(os, main);
+    write_pod(os, global_variables);
+    write_string(os, path);
+    write_string(os, namespace_id);
+    os.write(FlatMagic, sizeof(FlatMagic));
+}
+
+// Reads the serialized form back, giving up at the first short read
+// or out of range value.
+class FlatModuleDeserializer {
+public:
+    FlatModuleDeserializer(std::istream &is) : is(is), ok(true) {}
+
+    FlatModule *read() {
+        FlatModule *flat = new FlatModule();
+        magic();
+        table(flat->blocks);
+        table(flat->variables);
+        table(flat->locations);
+        table(flat->functions);
+        table(flat->calls);
+        table(flat->extern_calls);
+        table(flat->redirections);
+        table(flat->ifs);
+        table(flat->loops);
+        table(flat->assignments);
+        table(flat->imports);
+        table(flat->returns);
+        table(flat->loop_controls);
+        table(flat->binops);
+        table(flat->unaryops);
+        table(flat->integers);
+        table(flat->fractionals);
+        table(flat->string_literals);
+        table(flat->booleans);
+        for (unsigned k = 0; k < FlatModule::NumKinds; k++) {
+            table(flat->info[k]);
+        }
+        table(flat->children);
+        table(flat->interps);
+        table(flat->interp_items);
+
+        for (uint32_t n = count(); ok && n > 0; n--) {
+            uint32_t namespaces = count();
+            std::vector<std::string> ns;
+            for (uint32_t i = 0; ok && i < namespaces; i++) {
+                ns.push_back(string());
+            }
+            Name name(string());
+            name.namespace_id = ns;
+            flat->names.push_back(name);
+        }
+        for (uint32_t n = count(); ok && n > 0; n--) {
+            flat->strings.push_back(string());
+        }
+        for (uint32_t n = count(); ok && n > 0; n--) {
+            flat->types.push_back(type(0));
+        }
+        for (uint32_t n = count(); ok && n > 0; n--) {
+            IRDebugInfo d;
+            d.file = string();
+            d.start = pod<unsigned>();
+            d.end = pod<unsigned>();
+            d.lineno = pod<unsigned>();
+            flat->debug_infos.push_back(d);
+        }
+
+        table(flat->module_functions);
+        flat->main = pod<FlatIndex>();
+        flat->global_variables = pod<FlatRef>();
+        flat->path = string();
+        flat->namespace_id = string();
+        magic();
+        if (ok) ok = FlatModuleChecker(*flat).check();
+        if (!ok) {
+            delete flat;
+            return NULL;
+        }
+        return flat;
+    }
+
+private:
+    std::istream &is;
+    bool ok;
+
+    void bytes(void *p, size_t n) {
+        if (!ok) return;
+        is.read(static_cast<char *>(p), n);
+        ok = (size_t)is.gcount() == n;
+    }
+
+    template <typename T>
+    T pod() {
+        T v = T();
+        bytes(&v, sizeof(T));
+        return v;
+    }
+
+    // Read an entry count, rejecting counts too large to be real so
+    // that a damaged stream can't trigger a huge allocation.
+    uint32_t count() {
+        uint32_t n = pod<uint32_t>();
+        if (n > (1u << 27)) ok = false;
+        return ok ? n : 0;
+    }
+
+    template <typename T>
+    void table(std::vector<T> &v) {
+        v.resize(count());
+        for (typename std::vector<T>::iterator I = v.begin(), E = v.end(); ok && I != E; ++I) {
+            fields(*this, *I);
+        }
+    }
+
+public:
+    // Field readers, called back by fields().
+    void operator()(uint32_t &v) { v = pod<uint32_t>(); }
+    void operator()(int &v) { v = pod<int32_t>(); }
+    void operator()(double &v) { v = pod<double>(); }
+    void operator()(bool &v) {
+        uint8_t b = pod<uint8_t>();
+        if (b > 1) ok = false;
+        v = b == 1;
+    }
+    // Operator enums.
+    template <typename E>
+    void operator()(E &v) {
+        uint32_t i = pod<uint32_t>();
+        if (i >= num_values(E())) {
+            ok = false;
+            i = 0;
+        }
+        v = (E)i;
+    }
+
+private:
+
+    std::string string() {
+        std::string s(count(), '\0');
+        if (!s.empty()) bytes(&s[0], s.size());
+        return s;
+    }
+
+    Type type(unsigned depth) {
+        switch (pod<uint8_t>()) {
+        case 1: return Type::Integer();
+        case 2: return Type::Fractional();
+        case 3: return Type::String();
+        case 4: return Type::Boolean();
+        case 5:
+            if (depth < 64) return Type::Array(type(depth + 1));
+            ok = false;
+            return Type::Undef();
+        default: return Type::Undef();
+        }
+    }
+
+    void magic() {
+        char m[sizeof(FlatMagic)];
+        bytes(m, sizeof(m));
+        if (ok && std::memcmp(m, FlatMagic, sizeof(m)) != 0) ok = false;
+    }
+};
+
+FlatModule *FlatModule::read(std::istream &is) {
+    FlatModuleDeserializer reader(is);
+    return reader.read();
+}
+
+}
@@ -0,0 +1,263 @@
+#ifndef __BISH_FLAT_IR_H__
+#define __BISH_FLAT_IR_H__
+
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "IR.h"
+
+namespace Bish {
+
+/* A compact, index-based encoding of a Module, meant for
+ * whole-program analyses over large linked modules. Instead of a
+ * graph of heap-allocated polymorphic nodes, every node kind is
+ * stored contiguously in its own table, and nodes refer to each other
+ * with 32-bit references. Variable-length child lists (block
+ * statements, call arguments, if/else clauses) live in a shared side
+ * table and are referred to by ranges.
+ *
+ * Example:
+ *     FlatModule flat(m);
+ *     for (unsigned i = 0; i < flat.calls.size(); i++) {
+ *         // flat.calls[i].function is the callee's function index.
+ *     }
+ *     Module *copy = flat.to_module();
+ */
+
+// A reference to a node in a FlatModule. The node kind is stored in
+// the top bits and the index into that kind's table in the rest.
+typedef uint32_t FlatRef;
+
+// An index into one of the FlatModule tables.
+typedef uint32_t FlatIndex;
+
+static const FlatRef FlatNullRef = 0xffffffff;
+static const FlatIndex FlatNullIndex = 0xffffffff;
+
+// A contiguous range of entries in a side table.
+struct FlatRange {
+    uint32_t begin;
+    uint32_t size;
+    FlatRange() : begin(0), size(0) {}
+};
+
+// Cold per-node data, kept apart from the node tables so that passes
+// which don't look at types or debug information don't pay for them.
+struct FlatNodeInfo {
+    // Index into FlatModule::types.
+    uint32_t type;
+    // Index into FlatModule::debug_infos, 0 for no debug information.
+    uint32_t debug;
+};
+
+struct FlatBlock {
+    // Statement references in FlatModule::children.
+    FlatRange nodes;
+};
+
+struct FlatVariable {
+    // Index into FlatModule::names.
+    uint32_t name;
+    bool global;
+    // Index of the referenced variable, or FlatNullIndex.
+    FlatIndex reference;
+};
+
+struct FlatLocation {
+    FlatIndex variable;
+    FlatRef offset;
+};
+
+struct FlatFunction {
+    // Index into FlatModule::names.
+    uint32_t name;
+    // Variable references in FlatModule::children.
+    FlatRange args;
+    // Block reference, or FlatNullRef for undefined functions.
+    FlatRef body;
+};
+
+struct FlatFunctionCall {
+    FlatIndex function;
+    // Function containing the call, or FlatNullIndex for calls from
+    // global variable initializers.
+    FlatIndex caller;
+    // Assignment references in FlatModule::children.
+    FlatRange args;
+};
+
+struct FlatExternCall {
+    // Index into FlatModule::interps.
+    uint32_t body;
+};
+
+struct FlatIORedirection {
+    IORedirection::Operator op;
+    FlatRef a, b;
+};
+
+struct FlatIfStatement {
+    // Alternating condition and body references in
+    // FlatModule::children, starting with the 'if' clause.
+    FlatRange clauses;
+    FlatRef elseblock;
+};
+
+struct FlatForLoop {
+    FlatIndex variable;
+    FlatRef lower, upper, body;
+};
+
+struct FlatAssignment {
+    FlatIndex location;
+    // Value references in FlatModule::children.
+    FlatRange values;
+};
+
+struct FlatImportStatement {
+    // Indices into FlatModule::strings.
+    uint32_t module_name;
+    uint32_t path;
+};
+
+struct FlatReturnStatement {
+    FlatRef value;
+};
+
+struct FlatLoopControlStatement {
+    LoopControlStatement::Operator op;
+};
+
+struct FlatBinOp {
+    BinOp::Operator op;
+    FlatRef a, b;
+};
+
+struct FlatUnaryOp {
+    UnaryOp::Operator op;
+    FlatRef a;
+};
+
+struct FlatInteger {
+    int value;
+};
+
+struct FlatFractional {
+    double value;
+};
+
+struct FlatString {
+    // Index into FlatModule::interps.
+    uint32_t value;
+};
+
+struct FlatBoolean {
+    bool value;
+};
+
+// An interpolated string item: either a literal (index into
+// FlatModule::strings) or a variable index.
+struct FlatInterpItem {
+    bool is_var;
+    uint32_t value;
+};
+
+class FlatModule {
+public:
+    typedef enum { BlockKind, VariableKind, LocationKind, FunctionKind,
+                   FunctionCallKind, ExternCallKind, IORedirectionKind,
+                   IfStatementKind, ForLoopKind, AssignmentKind,
+                   ImportStatementKind, ReturnStatementKind,
+                   LoopControlStatementKind, BinOpKind, UnaryOpKind,
+                   IntegerKind, FractionalKind, StringKind, BooleanKind,
+                   NumKinds } Kind;
+
+    static FlatRef make_ref(Kind k, FlatIndex i) { return ((uint32_t)k << 27) | i; }
+    static Kind kind(FlatRef r) { return (Kind)(r >> 27); }
+    static FlatIndex index(FlatRef r) { return r & 0x07ffffff; }
+
+    // Node tables, one per kind.
+    std::vector<FlatBlock> blocks;
+    std::vector<FlatVariable> variables;
+    std::vector<FlatLocation> locations;
+    std::vector<FlatFunction> functions;
+    std::vector<FlatFunctionCall> calls;
+    std::vector<FlatExternCall> extern_calls;
+    std::vector<FlatIORedirection> redirections;
+    std::vector<FlatIfStatement> ifs;
+    std::vector<FlatForLoop> loops;
+    std::vector<FlatAssignment> assignments;
+    std::vector<FlatImportStatement> imports;
+    std::vector<FlatReturnStatement> returns;
+    std::vector<FlatLoopControlStatement> loop_controls;
+    std::vector<FlatBinOp> binops;
+    std::vector<FlatUnaryOp> unaryops;
+    std::vector<FlatInteger> integers;
+    std::vector<FlatFractional> fractionals;
+    std::vector<FlatString> string_literals;
+    std::vector<FlatBoolean> booleans;
+
+    // Per-kind cold data, parallel to the node tables.
+    std::vector<FlatNodeInfo> info[NumKinds];
+
+    // Side tables.
+    std::vector<FlatRef> children;
+    std::vector<FlatRange> interps;
+    std::vector<FlatInterpItem> interp_items;
+    std::vector<Name> names;
+    std::vector<std::string> strings;
+    std::vector<Type> types;
+    std::vector<IRDebugInfo> debug_infos;
+
+    // Functions belonging to the module, in module order. Functions
+    // in the table but not in this list are called but not defined
+    // here (e.g. before linking).
+    std::vector<FlatIndex> module_functions;
+    FlatIndex main;
+    FlatRef global_variables;
+    std::string path;
+    std::string namespace_id;
+
+    // Encode the given Module.
+    FlatModule(Module *m);
+    // Decode this FlatModule back into a newly allocated Module, which
+    // the caller owns.
+    Module *to_module() const;
+
+    // Write this FlatModule to the given stream, in a binary format
+    // only meant to be read back by the same build of bish.
+    void write(std::ostream &os) const;
+    // Read a FlatModule written by write(). Returns NULL if the stream
+    // ends early, doesn't hold a FlatModule, or holds one referring to
+    // entries outside its tables.
+    static FlatModule *read(std::istream &is);
+
+    // Return the children of the given range.
+    const FlatRef *range_begin(const FlatRange &r) const { return children.empty() ? NULL : &children[0] + r.begin; }
+    const FlatRef *range_end(const FlatRange &r) const { return range_begin(r) + r.size; }
+    // Return the total number of nodes.
+    unsigned size() const;
+    // Return the number of call sites targeting each function,
+    // indexed by function index.
+    std::vector<unsigned> call_site_counts() const;
+
+private:
+    FlatModule() : main(FlatNullIndex), global_variables(FlatNullRef) {}
+
+    std::map<Name, uint32_t> name_map;
+    std::map<std::string, uint32_t> string_map;
+
+    friend class FlatModuleBuilder;
+    friend class FlatModuleDeserializer;
+    uint32_t intern_name(const Name &n);
+    uint32_t intern_string(const std::string &s);
+    uint32_t intern_type(const Type &t);
+    uint32_t add_debug_info(const IRDebugInfo &d);
+    FlatRange add_children(const std::vector<FlatRef> &refs);
+};
+
+}
+
+#endif
@@ -1,23 +1,227 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
-#include "CallGraph.h"
-#include "FindCalls.h"
+#include <queue>
+#include <set>
+#include "Errors.h"
 #include "IR.h"
 #include "Util.h"
 
 namespace Bish {
 
+namespace {
+
+// Collects the functions called from a subtree, in call order.
+class FindCallees : public IRVisitor {
+public:
+    std::vector<Function *> callees;
+    virtual void visit(FunctionCall *call) {
+        IRVisitor::visit(call);
+        callees.push_back(call->function);
+    }
+};
+
+// Drops every call in a subtree from its callee's call-site list.
+class RemoveCallSites : public IRVisitor {
+public:
+    virtual void visit(FunctionCall *call) {
+        IRVisitor::visit(call);
+        call->remove_call_site();
+    }
+};
+
+// Makes sure every call in a subtree is in its callee's call-site
+// list.
+class AddCallSites : public IRVisitor {
+public:
+    virtual void visit(FunctionCall *call) {
+        IRVisitor::visit(call);
+        call->set_function(call->function);
+    }
+};
+
+// Gives the blocks in a subtree the given parent (a function, or the
+// module for blocks of global statements). Blocks that already have
+// it are not walked, since the blocks within them have it too.
+class SetBlockParents : public IRVisitor {
+public:
+    SetBlockParents(IRNode *owner) : owner(owner) {}
+
+    virtual void visit(Block *node) {
+        if (node->parent() == owner) return;
+        node->set_parent(owner);
+        IRVisitor::visit(node);
+    }
+private:
+    IRNode *owner;
+};
+
+// Gives a statement placed in a block, and the expressions within it,
+// the block as their parent, as IRAncestorsPass does. The statements
+// of blocks nested in it keep their parents, so those blocks are only
+// walked if the statement moved to another function.
+class SetParents : public IRVisitor {
+public:
+    SetParents(Block *block) : block(block) {}
+
+    virtual void visit(Block *node) {
+        SetBlockParents owners(block->parent());
+        node->accept(&owners);
+    }
+    virtual void visit(ReturnStatement *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(IfStatement *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(ForLoop *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(FunctionCall *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(ExternCall *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(Assignment *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(BinOp *node) { IRVisitor::visit(node); node->set_parent(block); }
+    virtual void visit(UnaryOp *node) { IRVisitor::visit(node); node->set_parent(block); }
+private:
+    Block *block;
+};
+
+void set_parents(Block *b, IRNode *stmt) {
+    SetParents set(b);
+    stmt->accept(&set);
+    // A block placed directly in another still belongs to it.
+    stmt->set_parent(b);
+}
+
+}
+
+Block::iterator Block::insert_before(iterator pos, IRNode *n) {
+    set_parents(this, n);
+    return nodes.insert(pos, n);
+}
+
+void Block::push_back(IRNode *n) {
+    set_parents(this, n);
+    nodes.push_back(n);
+}
+
+Block::iterator Block::replace(iterator pos, IRNode *n) {
+    RemoveCallSites remove;
+    (*pos)->accept(&remove);
+    // The replacement may contain calls from the old statement (e.g.
+    // if it wraps it), which stay in the IR.
+    AddCallSites add;
+    n->accept(&add);
+    set_parents(this, n);
+    *pos = n;
+    return pos;
+}
+
+Block::iterator Block::erase(iterator pos) {
+    RemoveCallSites remove;
+    (*pos)->accept(&remove);
+    return nodes.erase(pos);
+}
+
+Integer *ConstantPool::integer(int v) {
+    Integer *&n = integers[v];
+    if (n == NULL) n = module->own(new Integer(v));
+    return n;
+}
+
+Integer *ConstantPool::integer(const std::string &s) {
+    int v = 0;
+    bish_assert(parse_number(s, v)) << "Invalid integer literal " << s;
+    return integer(v);
+}
+
+Fractional *ConstantPool::fractional(double v) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    Fractional *&n = fractionals[bits];
+    if (n == NULL) n = module->own(new Fractional(v));
+    return n;
+}
+
+Fractional *ConstantPool::fractional(const std::string &s) {
+    double v = 0;
+    bish_assert(parse_number(s, v)) << "Invalid fractional literal " << s;
+    return fractional(v);
+}
+
+Boolean *ConstantPool::boolean(bool v) {
+    Boolean *&n = booleans[v];
+    if (n == NULL) n = module->own(new Boolean(v));
+    return n;
+}
+
+String *ConstantPool::string(InterpolatedString *s) {
+    if (!s->is_literal()) return module->own(new String(s));
+    String *&n = strings[s->literal()];
+    if (n == NULL) {
+        n = module->own(new String(s));
+    } else {
+        delete s;
+    }
+    return n;
+}
+
+Module::~Module() {
+    for (std::vector<IRNode *>::iterator I = owned.begin(), E = owned.end(); I != E; ++I) {
+        delete *I;
+    }
+    for (std::vector<Module *>::iterator I = adopted.begin(), E = adopted.end(); I != E; ++I) {
+        delete *I;
+    }
+}
+
+void Module::adopt(Module *m) {
+    assert(m != this);
+    adopted.push_back(m);
+}
+
 void Module::set_main(Function *f) {
     add_function(f);
     main = f;
 }
 
 void Module::add_function(Function *f) {
+    remove_unresolved(f);
+    f->set_parent(this);
     functions.push_back(f);
+    // Namespaces added to f later don't change its unqualified name,
+    // so the index stays valid.
+    function_index.insert(std::make_pair(f->name.name, f));
+}
+
+void Module::remove_functions(const std::set<Function *> &fs) {
+    assert(fs.count(main) == 0);
+    std::vector<Function *> kept;
+    kept.reserve(functions.size());
+    function_index.clear();
+    for (std::vector<Function *>::iterator I = functions.begin(), E = functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (fs.count(f)) {
+            RemoveCallSites remove;
+            if (f->body) f->body->accept(&remove);
+            continue;
+        }
+        kept.push_back(f);
+        function_index.insert(std::make_pair(f->name.name, f));
+    }
+    functions.swap(kept);
+}
+
+void Module::add_unresolved(Function *f) {
+    std::vector<Function *> &fs = unresolved[f->name];
+    if (std::find(fs.begin(), fs.end(), f) == fs.end()) fs.push_back(f);
+}
+
+void Module::remove_unresolved(Function *f) {
+    UnresolvedMap::iterator I = unresolved.find(f->name);
+    if (I == unresolved.end()) return;
+    std::vector<Function *> &fs = I->second;
+    fs.erase(std::remove(fs.begin(), fs.end(), f), fs.end());
+    if (fs.empty()) unresolved.erase(I);
 }
 
 void Module::add_global(Assignment *a) {
-    global_variables->nodes.push_back(a);
+    global_variables->push_back(a);
 }
 
 void Module::set_path(const std::string &p) {
@@ -27,79 +231,90 @@ void Module::set_path(const std::string &p) {
 }
 
 Function *Module::get_function(const Name &name) const {
-    for (std::vector<Function *>::const_iterator I = functions.begin(),
-             E = functions.end(); I != E; ++I) {
-        if (name.name == (*I)->name.name) {
-            return *I;
-        }
-    }
-    return NULL;
+    std::unordered_map<std::string, Function *>::const_iterator I = function_index.find(name.name);
+    return I == function_index.end() ? NULL : I->second;
 }
 
 void Module::import(Module *m) {
-    FindCallsToModule find(m);
-    accept(&find);
-    CallGraphBuilder cgb;
-    CallGraph cg = cgb.build(m);
+    // Calls without a namespace are matched against the imported
+    // module by name alone, to allow the standard library functions
+    // to be called without a namespace.
+    std::vector<Function *> roots;
+    std::vector<Function *> candidates;
+    for (UnresolvedMap::iterator I = unresolved.begin(), E = unresolved.end(); I != E; ++I) {
+        const Name &name = I->first;
+        Function *f = m->get_function(name);
+        if (f == NULL || f == m->main) continue;
+        candidates.insert(candidates.end(), I->second.begin(), I->second.end());
+        // Functions with the same name but belonging to a different
+        // namespace are not linked from here.
+        if (!name.namespace_id.empty() && !name.has_namespace(m->namespace_id)) continue;
+        roots.push_back(f);
+    }
 
-    std::set<Name> to_link = find.functions();
+    // Link each called function, followed by the functions it calls
+    // in turn (breadth first) unless they are called directly
+    // too. Calls out of the linked functions that m left unresolved
+    // become unresolved calls of this module.
+    std::set<Function *> root_set(roots.begin(), roots.end());
     std::map<Name, Function *> linked;
-    for (std::set<Name>::iterator I = to_link.begin(), E = to_link.end(); I != E; ++I) {
-        const Name &name = *I;
-        // FindCallsToModule only compares function names to allow the
-        // standard library functions to be called without a
-        // namespace. Therefore, to_link can contain functions with
-        // the same name but belonging to a different namespace. Don't
-        // process those here:
-        if (!name.namespace_id.empty() && !name.has_namespace(m->namespace_id)) continue;
-        Function *f = m->get_function(name);
-        assert(f);
-        assert(f->name.namespace_id.empty());
-        f->name.add_namespace(m->namespace_id);
-        add_function(f);
-        linked[f->name] = f;
-        // Make sure to pull in functions that f calls as well.
-        std::vector<Function *> calls = cg.transitive_calls(f);
-        for (std::vector<Function *>::iterator CI = calls.begin(), CE = calls.end(); CI != CE; ++CI) {
-            f = *CI;
-            // Avoid dummy functions and duplicates.
-            if (f->body == NULL || to_link.count(f->name) || linked.count(f->name)) continue;
+    std::set<Function *> seen;
+    for (std::vector<Function *>::iterator I = roots.begin(), E = roots.end(); I != E; ++I) {
+        if (seen.count(*I)) continue;
+        std::queue<Function *> worklist;
+        worklist.push(*I);
+        seen.insert(*I);
+        while (!worklist.empty()) {
+            Function *f = worklist.front();
+            worklist.pop();
             f->name.add_namespace(m->namespace_id);
             add_function(f);
             linked[f->name] = f;
+
+            FindCallees find;
+            f->body->accept(&find);
+            for (std::vector<Function *>::iterator CI = find.callees.begin(),
+                     CE = find.callees.end(); CI != CE; ++CI) {
+                Function *g = *CI;
+                if (seen.count(g) || root_set.count(g)) continue;
+                seen.insert(g);
+                if (g->body == NULL) {
+                    add_unresolved(g);
+                } else {
+                    worklist.push(g);
+                }
+            }
         }
     }
 
-    // Now patch up the function pointers, replacing the "dummy"
+    // Now patch up the function pointers, replacing the placeholder
     // functions inserted at parse time with the real functions from
     // the imported module.
-    std::vector<FunctionCall *> calls = find.function_calls();
-    std::set<Function *> to_erase;
-    for (std::vector<FunctionCall *>::iterator I = calls.begin(), E = calls.end(); I != E; ++I) {
-        FunctionCall *call = *I;
-        Name &name = call->function->name;
+    const bool is_stdlib = m->path == get_stdlib_path();
+    for (std::vector<Function *>::iterator I = candidates.begin(), E = candidates.end(); I != E; ++I) {
+        Function *dummy = *I;
+        Name name = dummy->name;
         // Special case for stdlib functions: they can be called
         // without a namespace, so add it here.
-        if (m->path == get_stdlib_path()) {
-            if (!name.has_namespace("stdlib")) name.add_namespace("stdlib");
+        if (is_stdlib && !name.has_namespace("stdlib")) {
+            remove_unresolved(dummy);
+            dummy->name.add_namespace("stdlib");
+            add_unresolved(dummy);
         }
-        if (linked.find(name) != linked.end()) {
-            assert(call->function->body == NULL);
-            to_erase.insert(call->function);
-            call->function = linked[name];
-            assert(call->function->body != NULL);
+        std::map<Name, Function *>::iterator L = linked.find(dummy->name);
+        if (L == linked.end()) continue;
+        remove_unresolved(dummy);
+        while (!dummy->call_sites.empty()) {
+            dummy->call_sites.back()->set_function(L->second);
         }
     }
 
-    // Finally, erase the old dummy functions.
-    for (std::vector<Function *>::iterator I = functions.begin(), E = functions.end(); I != E; ) {
-        if (to_erase.find(*I) != to_erase.end()) {
-            delete *I;
-            I = functions.erase(I);
-        } else {
-            ++I;
-        }
-    }
+    dependencies.insert(m->path);
+    dependencies.insert(m->dependencies.begin(), m->dependencies.end());
+
+    // Linked functions still belong to m, so keep it alive as long as
+    // this module.
+    adopt(m);
 }
 
 Type get_primitive_type(const IRNode *n) {
@@ -121,4 +336,11 @@ std::ostream &operator<<(std::ostream &os, const IRDebugInfo &a) {
     return os;
 }
 
+ErrorReport &ErrorReport::operator<<(const IRDebugInfo &info) {
+    if (!abort_condition) return *this;
+    if (location_file.empty()) at(info.file, info.lineno);
+    stream() << info;
+    return *this;
+}
+
 }
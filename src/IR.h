@@ -3,9 +3,14 @@
 
 #include <iostream>
 #include <cassert>
+#include <map>
+#include <set>
 #include <sstream>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "Errors.h"
 #include "IRVisitor.h"
 #include "Util.h"
 #include "Type.h"
@@ -33,8 +38,11 @@ public:
     std::string str() const {
         std::stringstream s;
         if (file.empty()) return "";
-        s << "in file '" << file << "' line " << lineno << ":\n    ";
-        s << strip(read_line_from_file(file, lineno));
+        s << "in file '" << file << "' line " << lineno << ":";
+        // The script may not exist on disk, if it was compiled from a
+        // string.
+        std::string line;
+        if (read_line_from_file(file, lineno, line)) s << "\n    " << strip(line);
         return s.str();
     }
 };
@@ -50,7 +58,7 @@ public:
     void set_type(const Type &t) { type_ = t; }
     IRNode *parent() const { return parent_; }
     void set_parent(IRNode *p) { parent_ = p; }
-    IRDebugInfo debug_info() const { return debug_info_; }
+    const IRDebugInfo &debug_info() const { return debug_info_; }
 protected:
     Type type_;
     IRNode *parent_;
@@ -70,6 +78,18 @@ public:
     }
 };
 
+/* Passes that restructure a block after parsing should go through
+ * the mutation methods below rather than editing 'nodes' directly:
+ * they keep the parent pointers of the affected statements, the
+ * expressions in them and the blocks nested in them (and the
+ * call-site lists of any functions called from removed statements) up
+ * to date, so the IR never needs another IRAncestorsPass.
+ *
+ * None of them is O(1): placing a statement walks its expressions,
+ * but not the statements of nested blocks unless it moved to another
+ * function, and removing one walks all of it to find its calls.
+ * Variables keep no use lists: finding the uses of a variable still
+ * takes a walk over the IR. */
 class Block : public BaseIRNode<Block> {
 public:
     typedef std::vector<IRNode *>::iterator iterator;
@@ -80,6 +100,19 @@ public:
     }
     iterator begin() { return nodes.begin(); }
     iterator end() { return nodes.end(); }
+
+    // Insert n before pos, returning an iterator to n.
+    iterator insert_before(iterator pos, IRNode *n);
+    // Append n to the block.
+    void push_back(IRNode *n);
+    // Replace the statement at pos with n, returning an iterator to n.
+    // Calls within the replaced statement but not within n are
+    // dropped from their callees' call-site lists.
+    iterator replace(iterator pos, IRNode *n);
+    // Remove the statement at pos from the IR, returning an iterator
+    // to the statement following it. Calls within the removed
+    // statement are dropped from their callees' call-site lists.
+    iterator erase(iterator pos);
 };
 
 // The name of a symbol, with optional namespace qualifier(s).
@@ -166,20 +199,40 @@ public:
     Name name;
     std::vector<Variable *> args;
     Block *body;
-
-    Function(const Name &n) : name(n) {
+    // Every FunctionCall targeting this function, in no particular
+    // order. Maintained by FunctionCall; do not modify directly.
+    std::vector<FunctionCall *> call_sites;
+    // Part of the interface of a library (see --library), so kept and
+    // given a fixed calling convention even if nothing calls it.
+    bool exported;
+    // Defined by a separately compiled library the script sources
+    // (see --link-external), rather than by the script itself.
+    bool external;
+    // The global variable the function's value is returned through,
+    // set by the return-values pass. NULL if the value is printed.
+    Variable *return_value;
+
+    Function(const Name &n) : name(n), exported(false), external(false), return_value(NULL) {
         body = NULL;
     }
 
-    Function(const Name &n, Block *b) : name(n) {
+    Function(const Name &n, Block *b) : name(n), exported(false), external(false), return_value(NULL) {
         body = b;
     }
 
-    Function(const Name &n, const std::vector<Variable *> &a, Block *b) : name(n) {
+    Function(const Name &n, const std::vector<Variable *> &a, Block *b) :
+        name(n), exported(false), external(false), return_value(NULL) {
         args.insert(args.begin(), a.begin(), a.end());
         body = b;
     }
 
+    // Return the name the function is defined with in generated code:
+    // its name qualified with its namespaces, or with "bish" if it has
+    // none so that it can't clash with a command.
+    std::string qualified_name() const {
+        return (name.namespace_id.empty() ? "bish_" : "") + name.str();
+    }
+
     void set_args(const std::vector<Variable *> &a) {
         args.clear();
         args.insert(args.begin(), a.begin(), a.end());
@@ -190,9 +243,54 @@ public:
     }
 };
 
+class InterpolatedString;
+
+/* Shares immutable literal nodes by value: every request for the
+ * same constant returns the same node, so the IR holds a single node
+ * per distinct literal and two constants are equal exactly when their
+ * node pointers are. Strings are only shared if they contain no
+ * interpolated variables. Nodes are owned by the pool's module.
+ * Example:
+ *     Integer *zero = m->constants.integer(0);
+ *     assert(zero == m->constants.integer("0"));
+ * Shared nodes have no parent and must not be modified in place. */
+class ConstantPool {
+public:
+    ConstantPool(Module *m) : module(m) {
+        booleans[0] = booleans[1] = NULL;
+    }
+    Integer *integer(int v);
+    Integer *integer(const std::string &s);
+    Fractional *fractional(double v);
+    Fractional *fractional(const std::string &s);
+    Boolean *boolean(bool v);
+    // Return a String node for the given value, taking ownership of
+    // it. If an equal literal string is already pooled, s is deleted
+    // and the existing node is returned.
+    String *string(InterpolatedString *s);
+private:
+    Module *module;
+    std::map<int, Integer *> integers;
+    // Keyed by bit pattern, so that e.g. 0.0 and -0.0 stay distinct.
+    std::map<uint64_t, Fractional *> fractionals;
+    Boolean *booleans[2];
+    std::map<std::string, String *> strings;
+    ConstantPool(const ConstantPool &);
+    ConstantPool &operator=(const ConstantPool &);
+};
+
+/* A Module owns every IRNode created for it, including nodes which
+ * were later unlinked from the tree (e.g. replaced by a pass), as
+ * well as any modules imported into it. Deleting the root Module
+ * therefore frees the whole IR. Nodes are handed to a module with
+ * own() when they are created:
+ *     Variable *v = m->own(new Variable(name));
+ * Individual nodes should never be deleted directly. */
 class Module : public BaseIRNode<Module> {
 public:
-    // List of all functions in the module (including main)
+    // List of all functions in the module (including main). Use
+    // add_function() to add to it, which keeps the lookup index for
+    // get_function() up to date.
     std::vector<Function *> functions;
     // Global variables initializers.
     Block *global_variables;
@@ -202,15 +300,50 @@ public:
     std::string path;
     // Namespace identifier
     std::string namespace_id;
+    // Literal constants used in the module.
+    ConstantPool constants;
+    // Functions called from this module but not defined in it, keyed
+    // by the name they were called with. Each is a bodiless
+    // placeholder whose call_sites are the unresolved calls; import()
+    // redirects those calls once it finds the real function.
+    typedef std::map<Name, std::vector<Function *> > UnresolvedMap;
+    UnresolvedMap unresolved;
+    // Paths of the modules imported into this one, directly or
+    // through other imports.
+    std::set<std::string> dependencies;
+    // Names of the built-in symbols (see Builtins.h) nothing in the
+    // module refers to, which the code generator need not define.
+    // Filled in by the tree-shake pass.
+    std::set<std::string> unused_builtins;
+
+    Module() : main(NULL), constants(this) {
+        global_variables = own(new Block());
+    }
+    ~Module();
 
-    Module() : main(NULL) {
-        global_variables = new Block();
+    // Take ownership of the given node, returning it.
+    template <typename T>
+    T *own(T *n) {
+        owned.push_back(n);
+        return n;
     }
+    // Take ownership of the given module.
+    void adopt(Module *m);
+    // Return the number of IR nodes owned by this module (not
+    // counting adopted modules).
+    unsigned num_nodes() const { return owned.size(); }
 
     // Set the module's main function.
     void set_main(Function *f);
     // Add the given function to this module.
     void add_function(Function *f);
+    // Record the given placeholder function as called but not
+    // defined in this module.
+    void add_unresolved(Function *f);
+    // Remove the given functions (which mustn't include main) from
+    // this module. Calls within them are dropped from their callees'
+    // call-site lists.
+    void remove_functions(const std::set<Function *> &fs);
     // Add the given global variable assignment.
     void add_global(Assignment *a);
     // Set the module's path on disk and corresponding namespace.
@@ -219,8 +352,18 @@ public:
     // name, or NULL if no such function exists.
     Function *get_function(const Name &name) const;
     // Import functions from the given module if they are called from
-    // this module.
+    // this module. This module takes ownership of m. Only the
+    // unresolved calls of this module and the imported functions are
+    // examined, so the cost doesn't grow with the size of this module.
     void import(Module *m);
+private:
+    std::vector<IRNode *> owned;
+    std::vector<Module *> adopted;
+    // The first function added with each (unqualified) name.
+    std::unordered_map<std::string, Function *> function_index;
+    void remove_unresolved(Function *f);
+    Module(const Module &);
+    Module &operator=(const Module &);
 };
 
 class Assignment : public BaseIRNode<Assignment> {
@@ -240,10 +383,12 @@ public:
     ImportStatement(const Module *m, const std::string &qual_name, const IRDebugInfo &info) : BaseIRNode(info) {
         std::string path_ = dirname(m->path) + "/" + qual_name + ".bish";
         path = abspath(path_);
-        assert(!path.empty() && "Could not resolve module path from import.");
+        bish_assert(!path.empty()).at(info.file, info.lineno) << "Could not find module " << path_;
         module_name = module_name_from_path(qual_name);
         assert(!module_name.empty());
     }
+    ImportStatement(const std::string &name, const std::string &p, const IRDebugInfo &info) :
+        BaseIRNode(info), module_name(name), path(p) {}
 };
 
 class ReturnStatement : public BaseIRNode<ReturnStatement> {
@@ -286,11 +431,19 @@ public:
         elseblock = e;
     }
 
-    IfStatement(IRNode *c, IRNode *b, const std::vector<PredicatedBlock *> &es, IRNode *e) {
+    IfStatement(IRNode *c, IRNode *b, const std::vector<PredicatedBlock *> &es, IRNode *e,
+                const IRDebugInfo &info) : BaseIRNode(info) {
         pblock = new PredicatedBlock(c, b);
         elseblock = e;
         elses.insert(elses.begin(), es.begin(), es.end());
     }
+
+    ~IfStatement() {
+        delete pblock;
+        for (std::vector<PredicatedBlock *>::iterator I = elses.begin(), E = elses.end(); I != E; ++I) {
+            delete *I;
+        }
+    }
 };
 
 class ForLoop : public BaseIRNode<ForLoop> {
@@ -302,17 +455,48 @@ public:
         variable(v), lower(l), upper(u), body(b), BaseIRNode(info) {}
 };
 
+/* A call registers itself in its callee's call_sites list, so the
+ * callee must only be changed through set_function(). Both operations
+ * are O(1): each call remembers its position in the list and removal
+ * swaps the last entry into its place. */
 class FunctionCall : public BaseIRNode<FunctionCall> {
 public:
     Function *function;
     std::vector<Assignment *> args;
-    FunctionCall(Function *f, const IRDebugInfo &info) : BaseIRNode(info) {
-        function = f;
+    FunctionCall(Function *f, const IRDebugInfo &info) :
+        BaseIRNode(info), function(NULL), call_site_index(NotACallSite) {
+        set_function(f);
     }
-    FunctionCall(Function *f, const std::vector<Assignment *> &a, const IRDebugInfo &info) : BaseIRNode(info) {
-        function = f;
+    FunctionCall(Function *f, const std::vector<Assignment *> &a, const IRDebugInfo &info) :
+        BaseIRNode(info), function(NULL), call_site_index(NotACallSite) {
+        set_function(f);
         args.insert(args.begin(), a.begin(), a.end());
     }
+
+    // Redirect this call to the given function.
+    void set_function(Function *f) {
+        remove_call_site();
+        function = f;
+        if (f) {
+            call_site_index = f->call_sites.size();
+            f->call_sites.push_back(this);
+        }
+    }
+
+    // Drop this call from its callee's call-site list, e.g. because
+    // the call was removed from the IR.
+    void remove_call_site() {
+        if (call_site_index == NotACallSite) return;
+        std::vector<FunctionCall *> &sites = function->call_sites;
+        FunctionCall *last = sites.back();
+        sites[call_site_index] = last;
+        last->call_site_index = call_site_index;
+        sites.pop_back();
+        call_site_index = NotACallSite;
+    }
+private:
+    static const unsigned NotACallSite = 0xffffffff;
+    unsigned call_site_index;
 };
 
 // Helper class to represent interpolated strings.
@@ -345,6 +529,24 @@ public:
         return "";
     }
 
+    // Return true if the string contains no variables.
+    bool is_literal() const {
+        for (const_iterator I = items.begin(), E = items.end(); I != E; ++I) {
+            if (I->is_var()) return false;
+        }
+        return true;
+    }
+
+    // Return the concatenated text of a literal string.
+    std::string literal() const {
+        std::string result;
+        for (const_iterator I = items.begin(), E = items.end(); I != E; ++I) {
+            assert(I->is_str());
+            result += I->str();
+        }
+        return result;
+    }
+
     typedef std::vector<Item>::const_iterator const_iterator;
     const_iterator begin() { return items.begin(); }
     const_iterator end() { return items.end(); }
@@ -358,6 +560,7 @@ class ExternCall : public BaseIRNode<ExternCall> {
 public:
     InterpolatedString *body;
     ExternCall(InterpolatedString *b, const IRDebugInfo &info) : body(b), BaseIRNode(info) {}
+    ~ExternCall() { delete body; }
 };
 
 class IORedirection : public BaseIRNode<IORedirection> {
@@ -387,19 +590,20 @@ public:
 class Integer : public BaseIRNode<Integer> {
 public:
     int value;
-    Integer(const std::string &s) : value(convert_string<int>(s)) {}
+    Integer(int v) : value(v) {}
 };
 
 class Fractional : public BaseIRNode<Fractional> {
 public:
     double value;
-    Fractional(const std::string &s) : value(convert_string<double>(s)) {}
+    Fractional(double v) : value(v) {}
 };
 
 class String : public BaseIRNode<String> {
 public:
     InterpolatedString *value;
     String(InterpolatedString *s) : value(s) {}
+    ~String() { delete value; }
 };
 
 class Boolean : public BaseIRNode<Boolean> {
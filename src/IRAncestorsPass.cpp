@@ -5,10 +5,7 @@ using namespace Bish;
 
 void IRAncestorsPass::visit(Module *node) {
     module_stack.push(node);
-    // Add dummy root-level block.
-    block_stack.push(new Block());
     IRVisitor::visit(node);
-    block_stack.pop();
     module_stack.pop();
 }
 
@@ -18,8 +15,8 @@ void IRAncestorsPass::visit(Block *node) {
     block_stack.pop();
     if (function_stack.empty()) {
         // True for global variables block.
-        assert(!block_stack.empty());
-        node->set_parent(block_stack.top());
+        assert(!module_stack.empty());
+        node->set_parent(module_stack.top());
     } else {
         node->set_parent(function_stack.top());
     }
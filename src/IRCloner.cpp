@@ -0,0 +1,242 @@
+#include <set>
+#include "IRCloner.h"
+
+using namespace Bish;
+
+namespace {
+
+// Collects the non-global variables referenced in a subtree, in order
+// of first appearance.
+class FindLocalVariables : public IRVisitor {
+public:
+    std::vector<Variable *> locals;
+
+    virtual void visit(Variable *node) {
+        if (node->global || seen.count(node)) return;
+        seen.insert(node);
+        locals.push_back(node);
+    }
+
+    virtual void visit(ExternCall *node) {
+        visit(node->body);
+    }
+
+    virtual void visit(String *node) {
+        visit(node->value);
+    }
+private:
+    void visit(InterpolatedString *s) {
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if (I->is_var()) I->var()->accept(this);
+        }
+    }
+
+    std::set<Variable *> seen;
+};
+
+}
+
+IRNode *IRCloner::clone(IRNode *n) {
+    copies.clear();
+    created.clear();
+    IRNode *root = copy(n);
+    // Point the copies at the copies of their parents, if those were
+    // copied too.
+    for (std::vector<std::pair<IRNode *, IRNode *> >::iterator I = created.begin(),
+             E = created.end(); I != E; ++I) {
+        IRNode *parent = I->first->parent();
+        std::map<IRNode *, IRNode *>::iterator P = copies.find(parent);
+        I->second->set_parent(P == copies.end() ? parent : P->second);
+    }
+    copies.clear();
+    created.clear();
+    return root;
+}
+
+Function *IRCloner::clone_function(Function *f, const Name &name) {
+    // Give the copy its own arguments and locals, unless they have
+    // been explicitly mapped elsewhere.
+    std::map<Variable *, Variable *> saved_variables = variables;
+    FindLocalVariables find;
+    f->accept(&find);
+    std::vector<Variable *> fresh;
+    for (std::vector<Variable *>::iterator I = find.locals.begin(),
+             E = find.locals.end(); I != E; ++I) {
+        Variable *v = *I;
+        if (variables.count(v)) continue;
+        Variable *c = module->own(new Variable(v->name));
+        c->global = v->global;
+        c->set_type(v->type());
+        variables[v] = c;
+        fresh.push_back(v);
+    }
+    for (std::vector<Variable *>::iterator I = fresh.begin(), E = fresh.end(); I != E; ++I) {
+        if ((*I)->reference) variables[*I]->set_reference(lookup((*I)->reference));
+    }
+
+    Function *g = module->own(new Function(name));
+    functions[f] = g;
+    Function *result = static_cast<Function *>(clone(f));
+    functions.erase(f);
+    variables.swap(saved_variables);
+    return result;
+}
+
+void IRCloner::map_variable(Variable *from, Variable *to) {
+    variables[from] = to;
+}
+
+IRNode *IRCloner::copy(IRNode *n) {
+    if (n == NULL) return NULL;
+    std::map<IRNode *, IRNode *>::iterator I = copies.find(n);
+    if (I != copies.end()) return I->second;
+    result = NULL;
+    n->accept(this);
+    IRNode *c = result;
+    copies[n] = c;
+    if (c != n) {
+        c->set_type(n->type());
+        created.push_back(std::make_pair(n, c));
+    }
+    return c;
+}
+
+Variable *IRCloner::lookup(Variable *v) {
+    std::map<Variable *, Variable *>::iterator I = variables.find(v);
+    return I == variables.end() ? v : I->second;
+}
+
+InterpolatedString *IRCloner::clone(InterpolatedString *s) {
+    InterpolatedString *c = new InterpolatedString();
+    for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+        if (I->is_str()) {
+            c->push_str(I->str());
+        } else {
+            c->push_var(lookup(I->var()));
+        }
+    }
+    return c;
+}
+
+void IRCloner::visit(Module *node) {
+    assert(false && "Cannot clone a module.");
+}
+
+void IRCloner::visit(Block *node) {
+    Block *b = module->own(new Block());
+    // Register the block before copying its contents so that nested
+    // copies see it as their parent.
+    copies[node] = b;
+    for (std::vector<IRNode *>::const_iterator I = node->nodes.begin(),
+             E = node->nodes.end(); I != E; ++I) {
+        b->nodes.push_back(copy(*I));
+    }
+    result = b;
+}
+
+void IRCloner::visit(Variable *node) {
+    result = lookup(node);
+}
+
+void IRCloner::visit(Location *node) {
+    result = module->own(new Location(lookup(node->variable), copy(node->offset)));
+}
+
+void IRCloner::visit(Function *node) {
+    std::map<Function *, Function *>::iterator I = functions.find(node);
+    Function *f = I == functions.end() ? module->own(new Function(node->name)) : I->second;
+    copies[node] = f;
+    std::vector<Variable *> args;
+    for (std::vector<Variable *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        args.push_back(lookup(*I));
+    }
+    f->set_args(args);
+    f->set_body(static_cast<Block *>(copy(node->body)));
+    result = f;
+}
+
+void IRCloner::visit(FunctionCall *node) {
+    std::map<Function *, Function *>::iterator F = functions.find(node->function);
+    Function *callee = F == functions.end() ? node->function : F->second;
+    std::vector<Assignment *> args;
+    for (std::vector<Assignment *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        args.push_back(static_cast<Assignment *>(copy(*I)));
+    }
+    result = module->own(new FunctionCall(callee, args, node->debug_info()));
+}
+
+void IRCloner::visit(ExternCall *node) {
+    result = module->own(new ExternCall(clone(node->body), node->debug_info()));
+}
+
+void IRCloner::visit(IORedirection *node) {
+    result = module->own(new IORedirection(node->op, copy(node->a), copy(node->b), node->debug_info()));
+}
+
+void IRCloner::visit(IfStatement *node) {
+    std::vector<PredicatedBlock *> elses;
+    IRNode *condition = copy(node->pblock->condition);
+    IRNode *body = copy(node->pblock->body);
+    for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
+             E = node->elses.end(); I != E; ++I) {
+        IRNode *c = copy((*I)->condition);
+        elses.push_back(new PredicatedBlock(c, copy((*I)->body)));
+    }
+    result = module->own(new IfStatement(condition, body, elses, copy(node->elseblock), node->debug_info()));
+}
+
+void IRCloner::visit(ImportStatement *node) {
+    result = module->own(new ImportStatement(node->module_name, node->path, node->debug_info()));
+}
+
+void IRCloner::visit(ReturnStatement *node) {
+    result = module->own(new ReturnStatement(copy(node->value), node->debug_info()));
+}
+
+void IRCloner::visit(LoopControlStatement *node) {
+    result = module->own(new LoopControlStatement(node->op, node->debug_info()));
+}
+
+void IRCloner::visit(ForLoop *node) {
+    IRNode *lower = copy(node->lower);
+    IRNode *upper = copy(node->upper);
+    result = module->own(new ForLoop(lookup(node->variable), lower, upper,
+                                     copy(node->body), node->debug_info()));
+}
+
+void IRCloner::visit(Assignment *node) {
+    Location *location = static_cast<Location *>(copy(node->location));
+    std::vector<IRNode *> values;
+    for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
+             E = node->values.end(); I != E; ++I) {
+        values.push_back(copy(*I));
+    }
+    result = module->own(new Assignment(location, values, node->debug_info()));
+}
+
+void IRCloner::visit(BinOp *node) {
+    IRNode *a = copy(node->a);
+    result = module->own(new BinOp(node->op, a, copy(node->b), node->debug_info()));
+}
+
+void IRCloner::visit(UnaryOp *node) {
+    result = module->own(new UnaryOp(node->op, copy(node->a), node->debug_info()));
+}
+
+void IRCloner::visit(Integer *node) {
+    result = module->constants.integer(node->value);
+}
+
+void IRCloner::visit(Fractional *node) {
+    result = module->constants.fractional(node->value);
+}
+
+void IRCloner::visit(String *node) {
+    result = module->constants.string(clone(node->value));
+}
+
+void IRCloner::visit(Boolean *node) {
+    result = module->constants.boolean(node->value);
+}
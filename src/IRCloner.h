@@ -0,0 +1,77 @@
+#ifndef __BISH_IR_CLONER_H__
+#define __BISH_IR_CLONER_H__
+
+#include <map>
+#include <utility>
+#include <vector>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/* Deep-copies IR subtrees. Copies are owned by the given module. Nodes
+ * shared within a subtree (e.g. call argument assignments, which are
+ * both statements and arguments) stay shared in the copy, and parent
+ * pointers in the copy mirror those of the original.
+ *
+ * Variables are shared with the original unless mapped to another
+ * variable, so a copied expression refers to the same variables as
+ * the original. Copying a function with clone_function() instead
+ * gives it fresh copies of its arguments and local variables, and
+ * recursive calls are redirected to the copy.
+ *
+ * Example:
+ *     IRCloner cloner(m);
+ *     Function *g = cloner.clone_function(f, Name("g"));
+ *     m->add_function(g);
+ */
+class IRCloner : public IRVisitor {
+public:
+    IRCloner(Module *m) : module(m), result(NULL) {}
+    // Return a copy of the given subtree.
+    IRNode *clone(IRNode *n);
+    template <typename T>
+    T *clone_as(T *n) { return static_cast<T *>(clone(n)); }
+    // Return a copy of the given function with the given name. The
+    // copy is not added to any module.
+    Function *clone_function(Function *f, const Name &name);
+    // Replace references to 'from' with 'to' in subsequent copies.
+    void map_variable(Variable *from, Variable *to);
+
+    virtual void visit(Module *);
+    virtual void visit(Block *);
+    virtual void visit(Variable *);
+    virtual void visit(Location *);
+    virtual void visit(Function *);
+    virtual void visit(FunctionCall *);
+    virtual void visit(ExternCall *);
+    virtual void visit(IORedirection *);
+    virtual void visit(IfStatement *);
+    virtual void visit(ImportStatement *);
+    virtual void visit(ReturnStatement *);
+    virtual void visit(LoopControlStatement *);
+    virtual void visit(ForLoop *);
+    virtual void visit(Assignment *);
+    virtual void visit(BinOp *);
+    virtual void visit(UnaryOp *);
+    virtual void visit(Integer *);
+    virtual void visit(Fractional *);
+    virtual void visit(String *);
+    virtual void visit(Boolean *);
+private:
+    Module *module;
+    IRNode *result;
+    std::map<IRNode *, IRNode *> copies;
+    std::map<Variable *, Variable *> variables;
+    std::map<Function *, Function *> functions;
+    // Originals and copies created by the current clone() call.
+    std::vector<std::pair<IRNode *, IRNode *> > created;
+
+    IRNode *copy(IRNode *n);
+    Variable *lookup(Variable *v);
+    InterpolatedString *clone(InterpolatedString *s);
+};
+
+}
+
+#endif
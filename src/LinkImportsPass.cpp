@@ -1,30 +1,29 @@
 #include "Parser.h"
 #include "LinkImportsPass.h"
+#include "ModuleCache.h"
+#include "TimeReport.h"
 
 using namespace Bish;
 
 void LinkImportsPass::visit(Module *node) {
     module = node;
     node->global_variables->accept(this);
-    // There's probably a better way to do this. The issue is that
-    // visiting functions which have import statements in them can
-    // cause the list of functions in the module to change. Thus, we
-    // can't simply iterate over the list at this point, as it might
-    // change dynamically.
-    std::set<Function *> functions(node->functions.begin(), node->functions.end());
-    std::set<Function *> finished;
-    while (!functions.empty()) {
-        Function *f = *functions.begin();
-        functions.erase(functions.begin());
-        if (finished.find(f) != finished.end()) continue;
-        finished.insert(f);
-        f->accept(this);
-        functions.insert(node->functions.begin(), node->functions.end());
+    // Visiting functions which have import statements in them can add
+    // functions to the module. Functions are only ever appended, so
+    // walking the list by index picks up the new ones as well.
+    for (unsigned i = 0; i < node->functions.size(); i++) {
+        node->functions[i]->accept(this);
     }
 }
 
 void LinkImportsPass::visit(ImportStatement *node) {
-    Parser p;
-    Module *m = p.parse(node->path);
+    TimeReport::Scope scope("import " + node->path);
+    Module *m;
+    if (cache) {
+        m = cache->parse(node->path);
+    } else {
+        Parser p;
+        m = p.parse(node->path);
+    }
     module->import(m);
 }
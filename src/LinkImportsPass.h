@@ -6,6 +6,8 @@
 
 namespace Bish {
 
+class ModuleCache;
+
 /* This pass performs the linking of modules specified by import
  * statements. Each Module maintains a list of "external" functions
  * (functions belonging to other modules). This pass parses modules
@@ -14,9 +16,12 @@ namespace Bish {
  * calling module's list of external functions. */
 class LinkImportsPass : public IRVisitor {
 public:
+    // Imported modules are looked up in the given cache, if any.
+    LinkImportsPass(ModuleCache *cache=NULL) : cache(cache), module(NULL) {}
     virtual void visit(Module *);
     virtual void visit(ImportStatement *);
 private:
+    ModuleCache *cache;
     Module *module;
 };
 
@@ -0,0 +1,63 @@
+#include <map>
+#include <unordered_map>
+#include "CallGraph.h"
+#include "MergeFunctionsPass.h"
+#include "StructuralHash.h"
+
+using namespace Bish;
+
+void MergeFunctionsPass::visit(Module *node) {
+    // Main isn't called like other functions, and external functions
+    // have no body to compare, so each of those gets an id of its
+    // own. Other functions share the id of the set of functions with
+    // the same key.
+    std::unordered_map<Function *, unsigned> position;
+    for (unsigned i = 0; i < node->functions.size(); i++) {
+        Function *f = node->functions[i];
+        if (f != node->main && !f->external && f->body != NULL) position[f] = i;
+    }
+
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(node);
+    StructuralHash::CalleeIds ids;
+    std::map<StructuralKey, uint64_t> sets;
+    // The first function of each set in module order.
+    std::vector<Function *> first;
+    // Components only call components with lower numbers, so each
+    // function's callees have ids by the time it is hashed, except
+    // for those in its own component.
+    for (unsigned c = 0; c < cg.num_components(); c++) {
+        CallGraph::FunctionList members = cg.component_functions(c);
+        std::vector<StructuralKey> keys(members.size());
+        for (unsigned i = 0; i < members.size(); i++) {
+            if (position.count(members[i])) keys[i] = lowered_key(members[i], &ids);
+        }
+        for (unsigned i = 0; i < members.size(); i++) {
+            Function *f = members[i];
+            if (!position.count(f)) {
+                ids[f] = first.size();
+                first.push_back(f);
+                continue;
+            }
+            std::pair<std::map<StructuralKey, uint64_t>::iterator, bool> r =
+                sets.insert(std::make_pair(keys[i], first.size()));
+            if (r.second) first.push_back(f);
+            uint64_t id = r.first->second;
+            if (position[f] < position[first[id]]) first[id] = f;
+            ids[f] = id;
+        }
+    }
+
+    for (std::vector<Function *>::iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (!position.count(f)) continue;
+        Function *target = first[ids[f]];
+        if (target == f) continue;
+        // Redirecting a call removes it from f->call_sites.
+        std::vector<FunctionCall *> calls(f->call_sites);
+        for (std::vector<FunctionCall *>::iterator C = calls.begin(), CE = calls.end(); C != CE; ++C) {
+            (*C)->set_function(target);
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __BISH_MERGE_FUNCTIONS_PASS_H__
+#define __BISH_MERGE_FUNCTIONS_PASS_H__
+
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass finds functions which would compile to the same code,
+ * using their structural keys (see StructuralHash), and redirects the
+ * calls to each such function to the first one in module order. The
+ * copies left uncalled are removed by the tree-shake pass.
+ *
+ * Identical functions come from specialization, which copies a
+ * function for each argument type signature even where the copies
+ * only differ in types the generated code doesn't distinguish, and
+ * from modules defining the same helper. Functions calling identical
+ * functions are identical in turn, so the keys are computed once per
+ * function, callees first over the components of the call graph, with
+ * each call encoded by the set of identical functions it calls rather
+ * than by the callee's name. Calls between mutually recursive
+ * functions are still encoded by name, so such functions aren't
+ * merged. */
+class MergeFunctionsPass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+};
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Config.h"
+#include "Errors.h"
+#include "ModuleCache.h"
+#include "Parser.h"
+#include "TimeReport.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+// Version of the files kept in a cache directory. Increase this
+// whenever the FlatModule layout changes.
+const unsigned ArtifactVersion = 2;
+
+// 64-bit FNV-1a.
+uint64_t hash_string(const std::string &s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned i = 0; i < s.size(); i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Set 'hash' to the hash of the file at the given path. Returns
+// false if it can't be read.
+bool hash_file(const std::string &path, uint64_t &hash) {
+    std::ifstream t(path.c_str());
+    if (!is_file(path) || !t.is_open()) return false;
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+    hash = hash_string(buffer.str());
+    return true;
+}
+
+// Return the part of a module's cache key covering its imports: the
+// path each import resolved to and the hash of the source there, a
+// line per import after a line with their number.
+std::string imports_key(const FlatModule &flat) {
+    std::ostringstream key;
+    key << flat.imports.size() << "\n";
+    for (std::vector<FlatImportStatement>::const_iterator I = flat.imports.begin(),
+             E = flat.imports.end(); I != E; ++I) {
+        const std::string &path = flat.strings[I->path];
+        uint64_t hash = 0;
+        hash_file(path, hash);
+        key << hex_string(hash) << " " << path << "\n";
+    }
+    return key.str();
+}
+
+// Read the imports part of a cache key written by imports_key(), and
+// return true if every import still resolves to the same source.
+bool imports_unchanged(std::istream &in) {
+    std::string line;
+    if (!std::getline(in, line)) return false;
+    unsigned n = 0;
+    if (!parse_number(line, n)) return false;
+    for (unsigned i = 0; i < n; i++) {
+        if (!std::getline(in, line) || line.size() < 18 || line[16] != ' ') return false;
+        uint64_t hash;
+        if (!hash_file(line.substr(17), hash) || hex_string(hash) != line.substr(0, 16)) return false;
+    }
+    return true;
+}
+
+std::string read_source(const std::string &path) {
+    std::ifstream t(path.c_str());
+    if (!is_file(path) || !t.is_open()) {
+        bish_abort() << "Failed to open file at " << path;
+    }
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+    return buffer.str();
+}
+
+}
+
+ModuleCache::ModuleCache(const std::string &d) : dir(d) {
+    if (!dir.empty()) mkdir(dir.c_str(), 0777);
+}
+
+Module *ModuleCache::parse(const std::string &path) {
+    Entry *e;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::unique_ptr<Entry> &slot = entries[path];
+        if (!slot) slot.reset(new Entry());
+        e = slot.get();
+    }
+    // Load outside of the lock so that other modules can be looked up
+    // meanwhile; threads wanting the same module wait for the first
+    // one to finish.
+    std::call_once(e->loaded, &ModuleCache::load, this, path, std::ref(e->flat));
+    std::unique_ptr<Module> m(e->flat->to_module());
+    Parser p(this);
+    p.post_parse_passes(m.get());
+    return m.release();
+}
+
+unsigned ModuleCache::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+}
+
+void ModuleCache::invalidate(const std::string &path) {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.erase(path);
+}
+
+// Parse the module at the given path, or read it from the cache
+// directory if it was parsed from the same source before.
+void ModuleCache::load(const std::string &path, std::unique_ptr<FlatModule> &flat) {
+    std::string source = read_source(path);
+    std::ostringstream header;
+    header << "bish module " << BISH_VERSION << " " << ArtifactVersion << "\n"
+           << path << "\n" << hex_string(hash_string(source)) << "\n";
+
+    if (!dir.empty()) {
+        TimeReport::Scope scope("cached module " + path);
+        flat.reset(read_artifact(path, header.str()));
+        if (flat) return;
+    }
+
+    TimeReport::Scope scope("module " + path);
+    Parser p(this);
+    std::unique_ptr<Module> m(p.parse_unlinked(source, path));
+    scope.set_ir_nodes(m->num_nodes());
+    flat.reset(new FlatModule(m.get()));
+    if (!dir.empty()) write_artifact(path, header.str(), *flat);
+}
+
+std::string ModuleCache::artifact_path(const std::string &path) const {
+    std::string abs = abspath(path);
+    const std::string &key = abs.empty() ? path : abs;
+    return dir + "/" + remove_suffix(basename(path), ".") + "-" + hex_string(hash_string(key)) + ".bishmod";
+}
+
+// Return the cached module, or NULL if there is none for this source
+// and the current sources of its imports, or it can't be read.
+FlatModule *ModuleCache::read_artifact(const std::string &path, const std::string &header) {
+    std::ifstream in(artifact_path(path).c_str(), std::ios::binary);
+    if (!in.is_open()) return NULL;
+    std::string stored(header.size(), '\0');
+    in.read(&stored[0], stored.size());
+    if (!in || stored != header || !imports_unchanged(in)) return NULL;
+    return FlatModule::read(in);
+}
+
+// Write the module to the cache directory. Failing to is not an
+// error, the module is just parsed again next time.
+void ModuleCache::write_artifact(const std::string &path, const std::string &header,
+                                 const FlatModule &flat) {
+    // Write to a private file and rename it into place, so that
+    // concurrent compiles never read a partly written file.
+    std::string final_path = artifact_path(path);
+    std::ostringstream tmp;
+    tmp << final_path << ".tmp." << getpid() << "."
+        << std::hash<std::thread::id>()(std::this_thread::get_id());
+    {
+        std::ofstream out(tmp.str().c_str(), std::ios::binary);
+        out << header << imports_key(flat);
+        flat.write(out);
+        out.close();
+        if (!out) {
+            std::remove(tmp.str().c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp.str().c_str(), final_path.c_str()) != 0) {
+        std::remove(tmp.str().c_str());
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __BISH_MODULE_CACHE_H__
+#define __BISH_MODULE_CACHE_H__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "FlatIR.h"
+#include "IR.h"
+
+namespace Bish {
+
+/* A cache of parsed modules which can be shared between compiles
+ * running on different threads. Each module is parsed once, before
+ * linking its imports, and kept in its flat encoding. Every lookup
+ * decodes a new copy, which belongs to the caller, and links its
+ * imports (through the cache too), so compiles sharing the cache never
+ * share IR nodes.
+ *
+ * Given a directory, the cache also keeps each parsed module there,
+ * keyed by a hash of the module's source, and by the paths its
+ * imports resolved to along with hashes of their sources. A later
+ * compile only re-parses the modules whose source, or whose imports'
+ * sources, changed since. A kept module which can't be read back
+ * intact is parsed again too.
+ *
+ * Example:
+ *     ModuleCache cache(".bish-cache");
+ *     Module *m = cache.parse(path);
+ *     compile(m, cg, passes, &cache);
+ */
+class ModuleCache {
+public:
+    // Keep modules in the given directory as well as in memory, unless
+    // it is empty. The directory is created if needed.
+    ModuleCache(const std::string &dir="");
+
+    // Return a new, linked copy of the module at the given path,
+    // parsing it first if it isn't in the cache yet.
+    Module *parse(const std::string &path);
+    // Return the number of modules looked up so far.
+    unsigned size();
+    // Forget the module at the given path, so that the next lookup
+    // reads its source again. Must not be called while compiles using
+    // the cache are running.
+    void invalidate(const std::string &path);
+private:
+    struct Entry {
+        std::once_flag loaded;
+        std::unique_ptr<FlatModule> flat;
+    };
+    std::string dir;
+    std::mutex lock;
+    std::map<std::string, std::unique_ptr<Entry> > entries;
+
+    void load(const std::string &path, std::unique_ptr<FlatModule> &flat);
+    std::string artifact_path(const std::string &path) const;
+    FlatModule *read_artifact(const std::string &path, const std::string &header);
+    void write_artifact(const std::string &path, const std::string &header, const FlatModule &flat);
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <charconv>
+#include "OutputBuffer.h"
+
+using namespace Bish;
+
+namespace {
+
+// Chunks start small, since many buffers only ever hold a function or
+// two, and double in size up to MaxChunkSize (unless a single append
+// needs more).
+const size_t MinChunkSize = 256;
+const size_t MaxChunkSize = 16 * 1024;
+
+const char Spaces[] = "                                                                ";
+const size_t NumSpaces = sizeof(Spaces) - 1;
+
+}
+
+OutputBuffer &OutputBuffer::operator<<(int v) {
+    char buf[16];
+    append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr - buf);
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(unsigned v) {
+    char buf[16];
+    append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr - buf);
+    return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(double v) {
+    // The same as std::ostream's default (6 significant digits).
+    char buf[32];
+    append(buf, snprintf(buf, sizeof(buf), "%g", v));
+    return *this;
+}
+
+void OutputBuffer::indent(unsigned levels) {
+    size_t n = levels * 4;
+    while (n > 0) {
+        size_t k = std::min(n, NumSpaces);
+        append(Spaces, k);
+        n -= k;
+    }
+}
+
+// Finish the last chunk, so that a new one can follow it.
+void OutputBuffer::seal() {
+    if (chunks.empty()) return;
+    Chunk &last = chunks.back();
+    last.size = pos - last.data.get();
+    sealed_size += last.size;
+    pos = end = NULL;
+}
+
+void OutputBuffer::append_slow(const char *s, size_t n) {
+    size_t room = end - pos;
+    if (room > 0) {
+        std::memcpy(pos, s, room);
+        pos += room;
+        s += room;
+        n -= room;
+    }
+    size_t capacity = chunks.empty() ? MinChunkSize : std::min(chunks.back().capacity * 2, MaxChunkSize);
+    capacity = std::max(n, capacity);
+    seal();
+    Chunk c;
+    c.data.reset(new char[capacity]);
+    c.size = 0;
+    c.capacity = capacity;
+    pos = c.data.get();
+    end = pos + capacity;
+    chunks.push_back(std::move(c));
+    std::memcpy(pos, s, n);
+    pos += n;
+}
+
+void OutputBuffer::splice(OutputBuffer &b) {
+    if (b.chunks.empty()) return;
+    // If both buffers are counted to the end, so is the result.
+    bool counted = fully_scanned() && b.fully_scanned();
+    seal();
+    b.chunks.back().size = b.pos - b.chunks.back().data.get();
+    for (unsigned i = 0; i < b.chunks.size(); i++) {
+        // Keep writing into b's last chunk.
+        if (i + 1 < b.chunks.size()) sealed_size += b.chunks[i].size;
+        chunks.push_back(std::move(b.chunks[i]));
+    }
+    pos = b.pos;
+    end = b.end;
+    if (counted) {
+        scanned_chunk = chunks.size() - 1;
+        scanned_offset = pos - chunks.back().data.get();
+        newlines += b.newlines;
+    }
+    b.clear();
+}
+
+void OutputBuffer::clear() {
+    chunks.clear();
+    pos = end = NULL;
+    sealed_size = 0;
+    scanned_chunk = scanned_offset = newlines = 0;
+}
+
+size_t OutputBuffer::lines() {
+    for (; scanned_chunk < chunks.size(); scanned_chunk++, scanned_offset = 0) {
+        const char *data = chunks[scanned_chunk].data.get();
+        bool last = scanned_chunk + 1 == chunks.size();
+        size_t n = last ? pos - data : chunks[scanned_chunk].size;
+        newlines += std::count(data + scanned_offset, data + n, '\n');
+        if (last) {
+            scanned_offset = n;
+            break;
+        }
+    }
+    return newlines;
+}
+
+std::string OutputBuffer::str() const {
+    std::string result;
+    result.reserve(size());
+    for (unsigned i = 0; i < chunks.size(); i++) {
+        const char *data = chunks[i].data.get();
+        result.append(data, i + 1 < chunks.size() ? chunks[i].size : pos - data);
+    }
+    return result;
+}
+
+bool OutputBuffer::write_to(int fd) const {
+    std::vector<struct iovec> iov;
+    for (unsigned i = 0; i < chunks.size(); i++) {
+        char *data = chunks[i].data.get();
+        size_t n = i + 1 < chunks.size() ? chunks[i].size : pos - data;
+        if (n == 0) continue;
+        struct iovec v;
+        v.iov_base = data;
+        v.iov_len = n;
+        iov.push_back(v);
+    }
+    // writev() may write less than asked, and takes at most IOV_MAX
+    // buffers at a time.
+    size_t next = 0;
+    while (next < iov.size()) {
+        ssize_t written = writev(fd, &iov[next], std::min(iov.size() - next, (size_t)IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (next < iov.size() && (size_t)written >= iov[next].iov_len) {
+            written -= iov[next].iov_len;
+            next++;
+        }
+        if (written > 0) {
+            iov[next].iov_base = (char *)iov[next].iov_base + written;
+            iov[next].iov_len -= written;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef __BISH_OUTPUT_BUFFER_H__
+#define __BISH_OUTPUT_BUFFER_H__
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Bish {
+
+/* The buffer code generators write to. Text is appended to a list of
+ * chunks which are never moved or resized, so appending never copies
+ * what was written before, and a small append is just a bounds check
+ * and a memcpy. Buffers can be joined without copying (splice), and
+ * the whole buffer is written out with a single writev() call.
+ *
+ * Example:
+ *     OutputBuffer out;
+ *     out.indent(2);
+ *     out << "echo " << 42 << "\n";
+ *     out.write_to(STDOUT_FILENO);
+ */
+class OutputBuffer {
+public:
+    OutputBuffer() : pos(NULL), end(NULL), sealed_size(0), scanned_chunk(0), scanned_offset(0), newlines(0) {}
+
+    void append(const char *s, size_t n) {
+        if (n <= (size_t)(end - pos)) {
+            std::memcpy(pos, s, n);
+            pos += n;
+        } else {
+            append_slow(s, n);
+        }
+    }
+
+    OutputBuffer &operator<<(const char *s) {
+        append(s, std::strlen(s));
+        return *this;
+    }
+    OutputBuffer &operator<<(const std::string &s) {
+        append(s.data(), s.size());
+        return *this;
+    }
+    OutputBuffer &operator<<(char c) {
+        append(&c, 1);
+        return *this;
+    }
+    // Numbers are formatted as a default std::ostream would.
+    OutputBuffer &operator<<(int v);
+    OutputBuffer &operator<<(unsigned v);
+    OutputBuffer &operator<<(double v);
+    OutputBuffer &operator<<(bool v) { return *this << (v ? '1' : '0'); }
+
+    // Append the given number of levels of indentation, four spaces
+    // each.
+    void indent(unsigned levels);
+    // Move the contents of b to the end of this buffer, without
+    // copying them. Leaves b empty.
+    void splice(OutputBuffer &b);
+    void clear();
+
+    size_t size() const { return sealed_size + (chunks.empty() ? 0 : pos - chunks.back().data.get()); }
+    bool empty() const { return size() == 0; }
+    // Return the number of newlines in the buffer. Only the text
+    // appended since the last call is scanned, and spliced buffers
+    // bring their count along, so counting the lines after every
+    // statement takes time linear in the size of the output.
+    size_t lines();
+    std::string str() const;
+    // Write the contents to a file descriptor. Returns false on error.
+    bool write_to(int fd) const;
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        // Only kept up to date once the chunk is full; the last
+        // chunk's size is pos - data.
+        size_t size;
+        size_t capacity;
+    };
+    std::vector<Chunk> chunks;
+    // Free space in the last chunk.
+    char *pos, *end;
+    // Total size of every chunk but the last.
+    size_t sealed_size;
+    // How far lines() has scanned, and the newlines it found.
+    size_t scanned_chunk, scanned_offset, newlines;
+
+    void append_slow(const char *s, size_t n);
+    void seal();
+    bool fully_scanned() const {
+        return chunks.empty() || (scanned_chunk + 1 == chunks.size() &&
+                                  scanned_offset == (size_t)(pos - chunks.back().data.get()));
+    }
+};
+
+}
+
+#endif
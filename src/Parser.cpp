@@ -1,6 +1,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iostream>
 
@@ -11,6 +12,7 @@
 #include "TypeChecker.h"
 #include "LinkImportsPass.h"
 #include "IRAncestorsPass.h"
+#include "TimeReport.h"
 
 namespace Bish {
 
@@ -49,15 +51,13 @@ Name ParseScope::get_unique_name() {
 }
 
 // Return the variable from the symbol table corresponding to the
-// given variable. The given variable is then deleted. If there is no
-// symbol table entry, abort.
+// given variable. If there is no symbol table entry, abort.
 Variable *ParseScope::get_defined_variable(Variable *v) {
     Variable *sym = lookup_variable(v->name);
     if (!sym) {
         bish_abort() << "Undefined variable \"" << v->name.name << "\"";
     }
     bish_assert(sym != v);
-    delete v;
     return sym;
 }
 
@@ -102,7 +102,7 @@ Function *ParseScope::lookup_function(const Name &name) {
 Variable *ParseScope::lookup_or_new_var(const Name &name) {
     Variable *result = lookup_variable(name);
     if (result == NULL) {
-        result = new Variable(name);
+        result = current_module->own(new Variable(name));
         add_symbol(name, result);
     }
     bish_assert(result);
@@ -114,8 +114,11 @@ Variable *ParseScope::lookup_or_new_var(const Name &name) {
 Function *ParseScope::lookup_or_new_function(const Name &name) {
     Function *f = lookup_function(name);
     if (f == NULL) {
-        f = new Function(name);
+        f = current_module->own(new Function(name));
         function_symbol_table->insert(name, f);
+        // Until a definition is parsed, this is a placeholder for a
+        // function defined elsewhere.
+        current_module->add_unresolved(f);
     }
     bish_assert(f);
     return f;
@@ -146,44 +149,73 @@ std::string Parser::read_file(const std::string &path) {
 
 // Parse the given file into Bish IR.
 Module *Parser::parse(const std::string &path) {
-    std::string contents = read_file(path);
+    TimeReport::Scope scope("module " + path);
+    std::string contents;
+    {
+        TimeReport::Scope read("read");
+        contents = read_file(path);
+    }
     Module *m = parse_string(contents, path);
     bish_assert(m->path.size() > 0) << "Unable to resolve module path";
+    scope.set_ir_nodes(m->num_nodes());
     return m;
 }
 
 // Parse the given input stream into Bish IR.
 Module *Parser::parse(std::istream &is) {
-    std::string contents = read_stream(is);
+    TimeReport::Scope scope("module <stdin>");
+    std::string contents;
+    {
+        TimeReport::Scope read("read");
+        contents = read_stream(is);
+    }
     Module *m = parse_string(contents);
+    scope.set_ir_nodes(m->num_nodes());
     return m;
 }
 
 // Parse the given string into Bish IR. If a path is given, set the
 // resulting Module's path to that value.
 Module *Parser::parse_string(const std::string &text, const std::string &path) {
+    std::unique_ptr<Module> m(parse_unlinked(text, path));
+    post_parse_passes(m.get());
+    return m.release();
+}
+
+// Parse the given string into Bish IR without linking the modules it
+// imports. The result depends on nothing but the text and path.
+Module *Parser::parse_unlinked(const std::string &text, const std::string &path) {
     if (tokenizer) delete tokenizer;
 
     // Insert a dummy block for root scope.
     std::string preprocessed = "{\n" + text + "\n}";
     tokenizer = new Tokenizer(path, preprocessed);
 
-    Module *m = module(path);
-    expect(tokenizer->peek(), Token::EOSType, "Expected end of string");
-
-    post_parse_passes(m);
-    return m;
+    std::unique_ptr<Module> m;
+    {
+        TimeReport::Scope scope("parse");
+        m.reset(module(path));
+        expect(tokenizer->peek(), Token::EOSType, "Expected end of string");
+        tokenizer->time().add_phase("tokenize");
+    }
+    return m.release();
 }
 
 // Run an ordered list of postprocessing passes over the IR.
 void Parser::post_parse_passes(Module *m) {
     // Link modules from import statements.
-    LinkImportsPass link;
-    m->accept(&link);
+    {
+        TimeReport::Scope scope("link imports");
+        LinkImportsPass link(cache);
+        m->accept(&link);
+    }
 
     // Construct IRNode hierarchy
-    IRAncestorsPass ancestors;
-    m->accept(&ancestors);
+    {
+        TimeReport::Scope scope("ancestors");
+        IRAncestorsPass ancestors;
+        m->accept(&ancestors);
+    }
 }
 
 // Push a block on to the stack of blocks.
@@ -257,11 +289,14 @@ std::string Parser::scan_until_stmt_end() {
 // Terminate the parsing process with the given error message, and the
 // position of the tokenizer.
 void Parser::abort_with_position(const std::string &msg) {
-    bish_abort() << msg << " near " << tokenizer->position() << "\n";
+    bish_abort().at(tokenizer->file(), tokenizer->line()) << msg << " near " << tokenizer->position();
 }
 
 Module *Parser::module(const std::string &path) {
-    Module *m = new Module();
+    // Owned here until parsing succeeds, so that a parse error doesn't
+    // leak it.
+    std::unique_ptr<Module> owner(new Module());
+    Module *m = owner.get();
     m->set_path(path);
     scope.set_module(m);
     scope.push_symbol_table();
@@ -269,21 +304,21 @@ Module *Parser::module(const std::string &path) {
     // Install built-in symbols (e.g. 'args' for command line args).
     setup_builtin_symbols();
 
-    Function *main = new Function(Name("main"), block());
+    Function *main = own(new Function(Name("main"), block()));
     m->set_main(main);
     setup_global_variables(m);
     scope.pop_module();
     scope.pop_symbol_table();
-    return m;
+    return owner.release();
 }
 
 // Built-in symbols (e.g. 'args' for command line args).
 void Parser::setup_builtin_symbols() {
-    const std::vector<Name> &names = builtins.names();
+    const std::vector<Name> &names = builtins().names();
     for (std::vector<Name>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
         Name n = *I;
-        Variable *v = new Variable(n);
-        v->set_type(builtins.type(n));
+        Variable *v = own(new Variable(n));
+        v->set_type(builtins().type(n));
         scope.add_symbol(n, v);
     }
 }
@@ -321,7 +356,7 @@ void Parser::setup_global_variables(Module *m) {
 
 // Parse a Bish block.
 Block *Parser::block() {
-    Block *result = new Block();
+    Block *result = own(new Block());
     scope.push_symbol_table();
     push_block(result);
     expect(tokenizer->peek(), Token::LBraceType, "Expected block to begin with '{'");
@@ -415,8 +450,8 @@ Assignment *Parser::assignment(const Name &name) {
         values.push_back(expr());
     }
 
-    Location *loc = new Location(v, offset);
-    return new Assignment(loc, values, debug_info.get());
+    Location *loc = own(new Location(v, offset));
+    return own(new Assignment(loc, values, debug_info.get()));
 }
 
 FunctionCall *Parser::funcall(const Name &name) {
@@ -438,14 +473,14 @@ FunctionCall *Parser::funcall(const Name &name) {
     for (std::vector<IRNode *>::iterator I = args.begin(), E = args.end(); I != E; ++I) {
         Name vname = scope.get_unique_name();
         Variable *v = scope.lookup_or_new_var(vname);
-        Location *loc = new Location(v, NULL);
+        Location *loc = own(new Location(v, NULL));
         std::vector<IRNode *> value(1, *I);
-        Assignment *a = new Assignment(loc, value, IRDebugInfo());
+        Assignment *a = own(new Assignment(loc, value, IRDebugInfo()));
         assignment_args.push_back(a);
         block_stack.top()->nodes.push_back(a);
     }
 
-    return new FunctionCall(f, assignment_args, debug_info.get());
+    return own(new FunctionCall(f, assignment_args, debug_info.get()));
 }
 
 ExternCall *Parser::externcall() {
@@ -454,7 +489,7 @@ ExternCall *Parser::externcall() {
     expect(tokenizer->peek(), Token::LParenType, "Expected opening '('");
     InterpolatedString *body = interpolated_string(Token::RParen(), false);
     expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
-    return new ExternCall(body, debug_info.get());
+    return own(new ExternCall(body, debug_info.get()));
 }
 
 ImportStatement *Parser::importstmt() {
@@ -464,7 +499,7 @@ ImportStatement *Parser::importstmt() {
     end_stmt();
     if (namespaces.find(module_name) == namespaces.end()) {
         namespaces.insert(module_name);
-        return new ImportStatement(scope.module(), module_name, debug_info.get());
+        return own(new ImportStatement(scope.module(), module_name, debug_info.get()));
     } else {
         // Ignore duplicate imports.
         return NULL;
@@ -476,28 +511,30 @@ ReturnStatement *Parser::returnstmt() {
     expect(tokenizer->peek(), Token::ReturnType, "Expected return statement");
     IRNode *ret = expr();
     end_stmt();
-    return new ReturnStatement(ret, debug_info.get());
+    return own(new ReturnStatement(ret, debug_info.get()));
 }
 
 LoopControlStatement *Parser::breakstmt() {
     Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::BreakType, "Expected break statement");
     end_stmt();
-    return new LoopControlStatement(LoopControlStatement::Break, debug_info.get());
+    return own(new LoopControlStatement(LoopControlStatement::Break, debug_info.get()));
 }
 
 LoopControlStatement *Parser::continuestmt() {
     Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::ContinueType, "Expected continue statement");
     end_stmt();
-    return new LoopControlStatement(LoopControlStatement::Continue, debug_info.get());
+    return own(new LoopControlStatement(LoopControlStatement::Continue, debug_info.get()));
 }
 
 IfStatement *Parser::ifstmt() {
+    Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::IfType, "Expected if statement");
     expect(tokenizer->peek(), Token::LParenType, "Expected opening '('");
     IRNode *cond = expr();
     expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
+    IRDebugInfo info = debug_info.get();
     IRNode *body = block();
     std::vector<PredicatedBlock *> elses;
     IRNode *elseblock = NULL;
@@ -514,7 +551,7 @@ IfStatement *Parser::ifstmt() {
             elseblock = block();
         }
     }
-    return new IfStatement(cond, body, elses, elseblock);
+    return own(new IfStatement(cond, body, elses, elseblock, info));
 }
 
 ForLoop *Parser::forloop() {
@@ -537,7 +574,7 @@ ForLoop *Parser::forloop() {
     expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
     IRDebugInfo info = debug_info.get();
     IRNode *body = block();
-    return new ForLoop(v, lower, upper, body, info);
+    return own(new ForLoop(v, lower, upper, body, info));
 }
 
 Function *Parser::functiondef() {
@@ -579,7 +616,7 @@ IRNode *Parser::expr() {
     Token t = tokenizer->peek();
     if (t.isa(Token::PipeType)) {
         tokenizer->next();
-        a = new IORedirection(get_redirection_operator(t), a, logical(), debug_info.get());
+        a = own(new IORedirection(get_redirection_operator(t), a, logical(), debug_info.get()));
     }
     return a;
 }
@@ -600,7 +637,7 @@ IRNode *Parser::logical() {
     Token t = tokenizer->peek();
     while (t.isa(Token::AndType) || t.isa(Token::OrType)) {
         tokenizer->next();
-        a = new BinOp(get_binop_operator(t), a, equality(), debug_info.get());
+        a = own(new BinOp(get_binop_operator(t), a, equality(), debug_info.get()));
         debug_info = Tokenizer::Info(tokenizer);
         t = tokenizer->peek();
     }
@@ -613,7 +650,7 @@ IRNode *Parser::equality() {
     Token t = tokenizer->peek();
     if (t.isa(Token::DoubleEqualsType) || t.isa(Token::NotEqualsType)) {
         tokenizer->next();
-        a = new BinOp(get_binop_operator(t), a, relative(), debug_info.get());
+        a = own(new BinOp(get_binop_operator(t), a, relative(), debug_info.get()));
         t = tokenizer->peek();
     }
     return a;
@@ -626,7 +663,7 @@ IRNode *Parser::relative() {
     if (t.isa(Token::LAngleType) || t.isa(Token::LAngleEqualsType) ||
         t.isa(Token::RAngleType) || t.isa(Token::RAngleEqualsType)) {
         tokenizer->next();
-        a = new BinOp(get_binop_operator(t), a, arith(), debug_info.get());
+        a = own(new BinOp(get_binop_operator(t), a, arith(), debug_info.get()));
         t = tokenizer->peek();
     }
     return a;
@@ -638,7 +675,7 @@ IRNode *Parser::arith() {
     Token t = tokenizer->peek();
     while (t.isa(Token::PlusType) || t.isa(Token::MinusType)) {
         tokenizer->next();
-        a = new BinOp(get_binop_operator(t), a, term(), debug_info.get());
+        a = own(new BinOp(get_binop_operator(t), a, term(), debug_info.get()));
         debug_info = Tokenizer::Info(tokenizer);
         t = tokenizer->peek();
     }
@@ -651,7 +688,7 @@ IRNode *Parser::term() {
     Token t = tokenizer->peek();
     while (t.isa(Token::StarType) || t.isa(Token::SlashType) || t.isa(Token::PercentType)) {
         tokenizer->next();
-        a = new BinOp(get_binop_operator(t), a, unary(), debug_info.get());
+        a = own(new BinOp(get_binop_operator(t), a, unary(), debug_info.get()));
         debug_info = Tokenizer::Info(tokenizer);
         t = tokenizer->peek();
     }
@@ -663,7 +700,7 @@ IRNode *Parser::unary() {
     Token t = tokenizer->peek();
     if (is_unop_token(t)) {
         tokenizer->next();
-        return new UnaryOp(get_unaryop_operator(t), factor(), debug_info.get());
+        return own(new UnaryOp(get_unaryop_operator(t), factor(), debug_info.get()));
     } else {
         return factor();
     }
@@ -708,9 +745,9 @@ IRNode *Parser::atom() {
             if (namespaces.find(t.value()) == namespaces.end()) {
                 abort_with_position("Unknown namespace");
             }
-            v = new Variable(Name(t1.value(), t.value()));
+            v = own(new Variable(Name(t1.value(), t.value())));
         } else {
-            v = new Variable(Name(t.value()));
+            v = own(new Variable(Name(t.value())));
         }
         if (tokenizer->peek().isa(Token::LBracketType)) {
             tokenizer->next();
@@ -718,20 +755,26 @@ IRNode *Parser::atom() {
             expect(tokenizer->peek(), Token::RBracketType, "Expected matching ']'");
         }
         assert(v);
-        return new Location(v, offset);
+        return own(new Location(v, offset));
     }
     case Token::TrueType:
-        return new Boolean(true);
+        return constants().boolean(true);
     case Token::FalseType:
-        return new Boolean(false);
-    case Token::IntType:
-        return new Integer(t.value());
-    case Token::FractionalType:
-        return new Fractional(t.value());
+        return constants().boolean(false);
+    case Token::IntType: {
+        int v;
+        if (!parse_number(t.value(), v)) abort_with_position("Invalid integer literal " + t.value());
+        return constants().integer(v);
+    }
+    case Token::FractionalType: {
+        double v;
+        if (!parse_number(t.value(), v)) abort_with_position("Invalid fractional literal " + t.value());
+        return constants().fractional(v);
+    }
     case Token::QuoteType: {
         InterpolatedString *str = interpolated_string(Token::Quote(), true);
         expect(tokenizer->peek(), Token::QuoteType, "Unmatched '\"'");
-        return new String(str);
+        return constants().string(str);
     }
     default:
         abort_with_position("Invalid token type for atom");
@@ -749,7 +792,7 @@ Variable *Parser::arg() {
     // Similar to var() but this always creates a new symbol.
     std::string name = tokenizer->peek().value();
     expect(tokenizer->peek(), Token::SymbolType, "Expected argument to be a symbol");
-    Variable *arg = new Variable(name);
+    Variable *arg = own(new Variable(name));
     scope.add_symbol(name, arg);
     return arg;
 }
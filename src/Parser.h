@@ -60,6 +60,8 @@ public:
     }
 
     ~ParseScope() {
+        // Scopes are left open if parsing stopped with an error.
+        while (!symbol_table_stack.empty()) pop_symbol_table();
         delete function_symbol_table;
     }
 
@@ -78,8 +80,7 @@ public:
     // Return a name that is guaranteed to be unique.
     Name get_unique_name();
     // Return the variable from the symbol table corresponding to the
-    // given variable. The given variable is then deleted. If there is no
-    // symbol table entry, abort.
+    // given variable. If there is no symbol table entry, abort.
     Variable *get_defined_variable(Variable *v);
     // Return the symbol table entry corresponding to the given variable
     // name, or NULL if none exists.
@@ -104,14 +105,21 @@ private:
     unsigned unique_id;
 };
 
+class ModuleCache;
+
 class Parser {
 public:
-    Parser() : tokenizer(NULL) {}
+    // Imported modules are looked up in the given cache, if any.
+    Parser(ModuleCache *cache=NULL) : cache(cache), tokenizer(NULL) {}
     ~Parser();
     Module *parse(const std::string &path);
     Module *parse(std::istream &is);
     Module *parse_string(const std::string &text, const std::string &path="");
+    Module *parse_unlinked(const std::string &text, const std::string &path);
+    // Link the imports of a module from parse_unlinked().
+    void post_parse_passes(Module *m);
 private:
+    ModuleCache *cache;
     ParseScope scope;
     Tokenizer *tokenizer;
     std::set<std::string> namespaces;
@@ -128,9 +136,12 @@ private:
     std::string scan_until_stmt_end();
     void setup_builtin_symbols();
     void setup_global_variables(Module *m);
-    void post_parse_passes(Module *m);
     void push_block(Block *b);
     void pop_block();
+    // Hand ownership of the given node to the module being parsed.
+    template <typename T> T *own(T *n) { return scope.module()->own(n); }
+    // Literal constants of the module being parsed.
+    ConstantPool &constants() { return scope.module()->constants; }
     
     Module *module(const std::string &path);
     Block *block();
@@ -0,0 +1,143 @@
+#include <cassert>
+#include <memory>
+#include "ByReferencePass.h"
+#include "Errors.h"
+#include "MergeFunctionsPass.h"
+#include "PassManager.h"
+#include "ReturnValuesPass.h"
+#include "SpecializationPass.h"
+#include "TimeReport.h"
+#include "TreeShakingPass.h"
+#include "TypeChecker.h"
+
+using namespace Bish;
+
+namespace {
+
+template<typename T>
+IRVisitor *create_instance() {
+    return new T();
+}
+
+PassManager::PassInfo pass(PassManager::PassConstructor create, const std::string &description,
+                           const std::string &provides, const std::string &needs,
+                           const std::string &invalidates) {
+    PassManager::PassInfo info;
+    info.create = create;
+    info.description = description;
+    info.provides = provides;
+    if (!needs.empty()) info.needs.push_back(needs);
+    if (!invalidates.empty()) info.invalidates.push_back(invalidates);
+    return info;
+}
+
+PassManager::PassMap builtin_passes() {
+    PassManager::PassMap passes;
+    passes["specialize"] = pass(&create_instance<SpecializationPass>,
+                                "Copy functions called with different argument types.",
+                                "", "", "types");
+    passes["typecheck"] = pass(&create_instance<TypeChecker>,
+                               "Infer the type of every node.",
+                               "types", "", "");
+    passes["merge-functions"] = pass(&create_instance<MergeFunctionsPass>,
+                                     "Call one of each set of functions that compile to the same code.",
+                                     "", "types", "");
+    passes["tree-shake"] = pass(&create_instance<TreeShakingPass>,
+                                "Remove functions unreachable from main and the global initializers.",
+                                "", "", "");
+    passes["by-reference"] = pass(&create_instance<ByReferencePass>,
+                                  "Pass arrays to functions by reference.",
+                                  "", "types", "");
+    passes["return-values"] = pass(&create_instance<ReturnValuesPass>,
+                                   "Return function values through global variables.",
+                                   "", "types", "");
+    return passes;
+}
+
+std::vector<std::string> split(const std::string &s, char sep) {
+    std::vector<std::string> result;
+    std::string::size_type start = 0;
+    while (start <= s.size()) {
+        std::string::size_type end = s.find(sep, start);
+        if (end == std::string::npos) end = s.size();
+        if (end > start) result.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return result;
+}
+
+}
+
+const PassManager::PassMap &PassManager::all() {
+    static const PassMap passes = builtin_passes();
+    return passes;
+}
+
+const PassManager::PassInfo *PassManager::get(const std::string &name) {
+    const PassMap &passes = all();
+    PassMap::const_iterator I = passes.find(name);
+    return I == passes.end() ? NULL : &I->second;
+}
+
+std::string PassManager::pipeline(unsigned level) {
+    // The lowering passes are needed for correct output, so always
+    // run. -O0 skips specialization, so functions called with
+    // different argument types are rejected as before. Dead
+    // functions are removed after type checking, so that errors in
+    // them are still reported, but before lowering, and at -O2 after
+    // merging identical functions, which leaves the copies dead.
+    if (level == 0) return "typecheck,by-reference,return-values";
+    if (level == 1) return "specialize,typecheck,tree-shake,by-reference,return-values";
+    return "specialize,typecheck,merge-functions,tree-shake,by-reference,return-values";
+}
+
+bool PassManager::add(const std::string &name) {
+    if (get(name) == NULL) return false;
+    pipeline_passes.push_back(name);
+    return true;
+}
+
+bool PassManager::add_pipeline(const std::string &names) {
+    std::vector<std::string> list = split(names, ',');
+    for (std::vector<std::string>::iterator I = list.begin(), E = list.end(); I != E; ++I) {
+        if (get(*I) == NULL) return false;
+    }
+    pipeline_passes.insert(pipeline_passes.end(), list.begin(), list.end());
+    return true;
+}
+
+void PassManager::run(Module *m) {
+    valid.clear();
+    for (std::vector<std::string>::iterator I = pipeline_passes.begin(),
+             E = pipeline_passes.end(); I != E; ++I) {
+        run_pass(m, *I);
+    }
+}
+
+void PassManager::require(Module *m, const std::string &analysis) {
+    if (valid.count(analysis)) return;
+    for (PassMap::const_iterator I = all().begin(), E = all().end(); I != E; ++I) {
+        if (I->second.provides == analysis) {
+            run_pass(m, I->first);
+            return;
+        }
+    }
+    bish_abort() << "No pass provides analysis " << analysis;
+}
+
+void PassManager::run_pass(Module *m, const std::string &name) {
+    const PassInfo *info = get(name);
+    assert(info);
+    for (std::vector<std::string>::const_iterator I = info->needs.begin(),
+             E = info->needs.end(); I != E; ++I) {
+        require(m, *I);
+    }
+    TimeReport::Scope scope(name);
+    std::unique_ptr<IRVisitor> p(info->create());
+    m->accept(p.get());
+    for (std::vector<std::string>::const_iterator I = info->invalidates.begin(),
+             E = info->invalidates.end(); I != E; ++I) {
+        valid.erase(*I);
+    }
+    if (!info->provides.empty()) valid.insert(info->provides);
+}
@@ -0,0 +1,67 @@
+#ifndef __BISH_PASS_MANAGER_H__
+#define __BISH_PASS_MANAGER_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/* Runs a pipeline of link-time passes over a module. Passes are
+ * registered by name, along with the analyses they need and the
+ * analyses they invalidate. An analysis is computed by the pass that
+ * provides it, which the manager runs on demand whenever a pass
+ * needs the analysis and it isn't valid.
+ *
+ * Example:
+ *     PassManager pm;
+ *     pm.add_pipeline(PassManager::pipeline(2));
+ *     pm.run(m);
+ */
+class PassManager {
+public:
+    typedef IRVisitor *(*PassConstructor)();
+    struct PassInfo {
+        PassConstructor create;
+        std::string description;
+        // The analysis this pass computes, if any.
+        std::string provides;
+        // Analyses that must be valid before this pass runs.
+        std::vector<std::string> needs;
+        // Analyses this pass makes stale.
+        std::vector<std::string> invalidates;
+    };
+    typedef std::map<std::string, PassInfo> PassMap;
+
+    static const unsigned MaxOptLevel = 2;
+
+    static const PassMap &all();
+    // Return the named pass, or NULL if there is no such pass.
+    static const PassInfo *get(const std::string &name);
+    // Return the comma-separated pipeline for an optimization level.
+    static std::string pipeline(unsigned level);
+
+    // Append the named pass. Returns false if there is no such pass.
+    bool add(const std::string &name);
+    // Append a comma-separated list of passes. Returns false, adding
+    // nothing, if any of them doesn't exist.
+    bool add_pipeline(const std::string &names);
+    const std::vector<std::string> &passes() const { return pipeline_passes; }
+
+    // Run the pipeline over m.
+    void run(Module *m);
+    // Make sure the given analysis of m is valid, running the pass
+    // that provides it if needed.
+    void require(Module *m, const std::string &analysis);
+private:
+    std::vector<std::string> pipeline_passes;
+    std::set<std::string> valid;
+    void run_pass(Module *m, const std::string &name);
+};
+
+}
+
+#endif
@@ -18,6 +18,9 @@ IRNode *ReplaceIRNodes::replacement(IRNode *node) {
     if (I == replace_map.end()) {
         return NULL;
     } else {
+        // The replacement takes the place of the original in the
+        // IRNode hierarchy.
+        I->second->set_parent(node->parent());
         return I->second;
     }
 }
@@ -30,7 +33,7 @@ void ReplaceIRNodes::visit(Module *node) {
 void ReplaceIRNodes::visit(Block *node) {
     for (unsigned i = 0; i < node->nodes.size(); i++) {
         if (IRNode *n = replacement(node->nodes[i])) {
-            node->nodes[i] = n;
+            node->replace(node->begin() + i, n);
         }
     }
     IRVisitor::visit(node);
@@ -57,6 +60,9 @@ void ReplaceIRNodes::visit(IORedirection *node) {
 }
 
 void ReplaceIRNodes::visit(IfStatement *node) {
+    if (IRNode *n = replacement(node->pblock->condition)) {
+        node->pblock->condition = n;
+    }
     for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
              E = node->elses.end(); I != E; ++I) {
         if (IRNode *n = replacement((*I)->condition)) {
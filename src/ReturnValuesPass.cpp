@@ -1,53 +1,130 @@
 #include "ReplaceIRNodes.h"
 #include "ReturnValuesPass.h"
+#include "ThreadPool.h"
 
 using namespace Bish;
 
 namespace {
 
-// Constructs an ordered list of all Block nodes in a function.
-class GetAllBlocks : public IRVisitor {
+// Collects the FunctionCall nodes of a statement IRNode, in order,
+// along with the Blocks directly nested in it. The Blocks are not
+// recursively visited.
+class GetStatementParts : public IRVisitor {
 public:
-    GetAllBlocks(Function *f) {
-        f->accept(this);
+    GetStatementParts(IRNode *stmt) {
+        stmt->accept(this);
     }
 
-    std::vector<Block *> blocks() { return block_vec; }
+    std::vector<FunctionCall *> calls;
+    std::vector<Block *> blocks;
 
     virtual void visit(Block *b) {
-        block_vec.push_back(b);
-        IRVisitor::visit(b);
+        blocks.push_back(b);
     }
-private:
-    std::vector<Block *> block_vec;
-};
 
-// Constructs an ordered list of all FunctionCall nodes in a statement
-// IRNode. Any Blocks encountered are not recursively visited.
-class GetAllCalls : public IRVisitor {
-public:
-    GetAllCalls(IRNode *stmt) {
-        stmt->accept(this);
+    virtual void visit(FunctionCall *call) {
+        calls.push_back(call);
+        IRVisitor::visit(call);
     }
+};
 
-    std::vector<FunctionCall *> calls() { return call_vec; }
+// Replaces the calls of a single statement, leaving nested Blocks
+// alone.
+class ReplaceStatementCalls : public ReplaceIRNodes {
+public:
+    ReplaceStatementCalls(const std::map<FunctionCall *, Variable *> &replace) :
+        ReplaceIRNodes(replace) {}
 
     virtual void visit(Block *b) {
         // Do nothing.
     }
+};
+
+} // end anonymous namespace
+
+// Records which functions are called, which are called from an
+// IORedirection, and which return a value.
+class ReturnValuesPass::Summarize : public IRVisitor {
+public:
+    Summarize(ReturnValuesPass &pass) : pass(pass), function(NULL), redirections(0) {}
+
+    virtual void visit(Function *f) {
+        function = f;
+        IRVisitor::visit(f);
+        function = NULL;
+    }
+
+    virtual void visit(ReturnStatement *ret) {
+        if (ret->value && function) pass.summaries[function].returns_value = true;
+        IRVisitor::visit(ret);
+    }
+
+    virtual void visit(IORedirection *ior) {
+        redirections++;
+        IRVisitor::visit(ior);
+        redirections--;
+    }
 
     virtual void visit(FunctionCall *call) {
-        call_vec.push_back(call);
+        assert(call->function);
+        Summary &s = pass.summaries[call->function];
+        s.called = true;
+        if (redirections) {
+            // A library function always returns through its global,
+            // which a call in a subshell can't set.
+            const IRDebugInfo &info = call->debug_info();
+            bish_assert(!call->function->exported && !call->function->external).at(info.file, info.lineno)
+                << "Cannot redirect the output of library function " << call->function->name.str();
+            s.blacklisted = true;
+        }
         IRVisitor::visit(call);
     }
 private:
-    std::vector<FunctionCall *> call_vec;
+    ReturnValuesPass &pass;
+    Function *function;
+    unsigned redirections;
 };
 
-} // end anonymous namespace
+// Rewrites the statements of one function, or of the global
+// variables. The nodes it creates are kept aside, and handed to the
+// module once every function has been rewritten.
+class ReturnValuesPass::Lowering {
+public:
+    Lowering(const ReturnValuesPass *pass, Function *f) : pass(pass), function(f), unique_id(0) {}
+
+    std::vector<IRNode *> created;
+
+    void lower_block(Block *b);
+private:
+    const ReturnValuesPass *pass;
+    Function *function;
+    unsigned unique_id;
+
+    template <typename T>
+    T *own(T *n) {
+        created.push_back(n);
+        return n;
+    }
+    Name get_unique_name();
+    void lower_statement(Block *b, Block::iterator &SI);
+};
+
+// Lowers the body of one function, for ThreadPool::for_each.
+class ReturnValuesPass::LowerFunction {
+public:
+    LowerFunction(std::vector<Lowering> *lowerings, const std::vector<Function *> *functions) :
+        lowerings(lowerings), functions(functions) {}
+
+    void operator()(unsigned i) const {
+        Block *body = (*functions)[i]->body;
+        if (body) (*lowerings)[i].lower_block(body);
+    }
+private:
+    std::vector<Lowering> *lowerings;
+    const std::vector<Function *> *functions;
+};
 
 void ReturnValuesPass::initialize_unique_naming(Module *m) {
-    unique_id = 0;
     for (Block::iterator I = m->global_variables->begin(),
              E = m->global_variables->end(); I != E; ++I) {
         if (const Assignment *A = dynamic_cast<const Assignment *>(*I)) {
@@ -56,8 +133,7 @@ void ReturnValuesPass::initialize_unique_naming(Module *m) {
     }
 }
 
-Name ReturnValuesPass::get_unique_name(const std::string &prefix) {
-    std::string base = prefix + as_string(unique_id++);
+Name ReturnValuesPass::get_unique_name(const std::string &base) {
     Name name(base);
     unsigned i = 0;
     while (used_names.count(name)) {
@@ -66,135 +142,107 @@ Name ReturnValuesPass::get_unique_name(const std::string &prefix) {
     return name;
 }
 
-void ReturnValuesPass::initialize_blacklist(Module *m) {
-    class GetAllIORedirections : public IRVisitor {
-    public:
-        std::vector<IORedirection *> iors;
-        virtual void visit(IORedirection *ior) {
-            iors.push_back(ior);
-            IRVisitor::visit(ior);
-        }
-    };
-    GetAllIORedirections get;
-    m->accept(&get);
-    for (std::vector<IORedirection *>::iterator I = get.iors.begin(), E = get.iors.end(); I != E; ++I) {
-        GetAllCalls get_calls(*I);
-        std::vector<FunctionCall *> calls = get_calls.calls();
-        for (std::vector<FunctionCall *>::iterator FI = calls.begin(), FE = calls.end(); FI != FE; ++FI) {
-            Function *call = (*FI)->function;
-            blacklist.insert(call);
-        }
+Name ReturnValuesPass::Lowering::get_unique_name() {
+    std::string base = "_rv_" + as_string(unique_id++);
+    Name name(base);
+    unsigned i = 0;
+    while (pass->used_names.count(name)) {
+        name = Name(base + "_" + as_string(i++));
     }
+    return name;
 }
 
 void ReturnValuesPass::visit(Module *node) {
+    module = node;
     initialize_unique_naming(node);
-    initialize_blacklist(node);
-
-    std::vector<Block *> gv_block(1, node->global_variables);
-    lower_blocks(gv_block);
 
+    Summarize summarize(*this);
+    node->accept(&summarize);
+    // Only functions that are called, and whose calls can be lowered,
+    // get a global return value, as do library functions whether
+    // called or not. The global is named after the function, so a
+    // library and the scripts using it agree on it.
+    for (std::vector<Function *>::iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        Summary &s = summaries[*I];
+        bool library = (*I)->exported || (*I)->external;
+        if ((!s.called && !library) || s.blacklisted || !s.returns_value) continue;
+        s.retval = module->own(new Variable(get_unique_name("_global_retval_" + (*I)->qualified_name())));
+        s.retval->global = true;
+        (*I)->return_value = s.retval;
+    }
+
+    Lowering globals(this, NULL);
+    globals.lower_block(node->global_variables);
+    std::vector<Lowering> lowerings;
+    lowerings.reserve(node->functions.size());
     for (std::vector<Function *>::iterator I = node->functions.begin(), E = node->functions.end(); I != E; ++I) {
-        Function *f = *I;
-        lower_function(f);
+        lowerings.push_back(Lowering(this, *I));
     }
-}
+    ThreadPool::for_each(lowerings.size(), LowerFunction(&lowerings, &node->functions));
 
-template <class T>
-void ReturnValuesPass::process_statements(std::vector<T *> &stmts) {
-    typename std::vector<T*>::iterator SI;
-    for (SI = stmts.begin(); SI != stmts.end(); ++SI) {
-        IRNode *stmt = dynamic_cast<IRNode*>(*SI);
-        assert(stmt);
-        GetAllCalls get_calls(stmt);
-        std::vector<FunctionCall *> calls = get_calls.calls();
-        std::map<FunctionCall *, Variable *> replace;
-        // goal here: for each call in stmt S, move the call to
-        // before S. then add a local variable after the call that
-        // saves the global retval of the function. then replace
-        // the functioncall in S with that local var.
-        for (std::vector<FunctionCall *>::iterator I = calls.begin(), E = calls.end(); I != E; ++I) {
-            Function *call = (*I)->function;
-            assert(call);
-            if (blacklist.count(call)) continue;
-            Variable *retval = get_return_value(call);
-            if (retval == NULL) continue;
-            Variable *v = new Variable(get_unique_name());
-            Location *loc = new Location(v);
-            Assignment *a = new Assignment(loc, retval, IRDebugInfo());
-            SI = stmts.insert(SI, a);
-            SI = stmts.insert(SI, *I);
-            SI++; SI++;
-            replace[*I] = v; // replace the function call with the saved retval.
+    // Hand the new nodes to the module in function order, so the
+    // module is the same however the work was split.
+    lowerings.insert(lowerings.begin(), globals);
+    for (std::vector<Lowering>::iterator I = lowerings.begin(), E = lowerings.end(); I != E; ++I) {
+        for (std::vector<IRNode *>::iterator NI = I->created.begin(), NE = I->created.end(); NI != NE; ++NI) {
+            module->own(*NI);
         }
-        ReplaceIRNodes replace_calls(replace);
-        stmt->accept(&replace_calls);
     }
 }
 
-void ReturnValuesPass::lower_function(Function *f) {
-    GetAllBlocks get_blocks(f);
-    std::vector<Block *> blocks = get_blocks.blocks();
-    lower_blocks(blocks);
+Variable *ReturnValuesPass::get_return_value(Function *f) const {
+    std::unordered_map<Function *, Summary>::const_iterator I = summaries.find(f);
+    return I == summaries.end() ? NULL : I->second.retval;
 }
 
-void ReturnValuesPass::lower_blocks(std::vector<Block *> &blocks) {
-    std::set<Block *> block_set;
-    std::set<FunctionCall *> call_set;
-    for (std::vector<Block *>::iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
-        Block *b = *BI;
-        for (std::vector<IRNode *>::iterator I = b->nodes.begin(), E = b->nodes.end(); I != E; ++I) {
-            GetAllCalls get_calls(*I);
-            std::vector<FunctionCall *> calls = get_calls.calls();
-            call_set.insert(calls.begin(), calls.end());
+void ReturnValuesPass::Lowering::lower_block(Block *b) {
+    for (Block::iterator SI = b->begin(); SI != b->end(); ++SI) {
+        ReturnStatement *ret = dynamic_cast<ReturnStatement*>(*SI);
+        Variable *gv = function ? pass->get_return_value(function) : NULL;
+        if (ret && ret->value && gv) {
+            // Replace return statement with assignment to global
+            // variable, and lower that instead.
+            Assignment *a = own(new Assignment(own(new Location(gv)), ret->value, IRDebugInfo()));
+            SI = b->insert_before(SI, a);
+            lower_statement(b, SI);
+            SI++;
+            // Remove return value.
+            ret->value = NULL;
         }
-    }
-
-    // Create return values.
-    for (std::set<FunctionCall *>::iterator I = call_set.begin(), E = call_set.end(); I != E; ++I) {
-        Function *call = (*I)->function;
-        assert(call);
-        if (blacklist.count((*I)->function)) continue;
-        get_return_value(call);
-        Block *parent = dynamic_cast<Block*>((*I)->parent());
-        assert(parent);
-        block_set.insert(parent);
-    }
-
-    // Now convert function calls to use the return value.
-    for (std::set<Block *>::iterator BI = block_set.begin(), BE = block_set.end(); BI != BE; ++BI) {
-        Block *b = *BI;
-        process_statements(b->nodes);
+        lower_statement(b, SI);
     }
 }
 
-Variable *ReturnValuesPass::get_return_value(Function *f) {
-    if (return_values.find(f) != return_values.end()) {
-        return return_values[f];
-    }
-    bool ret_void = true;
-    Variable *gv = new Variable(get_unique_name("_global_retval_"));
-    gv->global = true;
-    GetAllBlocks get_blocks(f);
-    std::vector<Block *> blocks = get_blocks.blocks();
-    for (std::vector<Block *>::iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
-        Block *b = *BI;
-        for (std::vector<IRNode *>::iterator SI = b->nodes.begin(); SI != b->nodes.end(); ++SI) {
-            if (ReturnStatement *ret = dynamic_cast<ReturnStatement*>(*SI)) {
-                ret_void = false;
-                // Replace return statement with assignment to global variable
-                Assignment *a = new Assignment(new Location(gv), ret->value, IRDebugInfo());
-                SI = b->nodes.insert(SI, a);
-                SI++;
-                // Remove return value.
-                ret->value = NULL;
-            }
-        }
+// Lowers the calls of the statement at SI, leaving SI pointing at the
+// statement, then lowers the Blocks nested in it.
+void ReturnValuesPass::Lowering::lower_statement(Block *b, Block::iterator &SI) {
+    IRNode *stmt = *SI;
+    GetStatementParts parts(stmt);
+    std::map<FunctionCall *, Variable *> replace;
+    // goal here: for each call in stmt S, move the call to
+    // before S. then add a local variable after the call that
+    // saves the global retval of the function. then replace
+    // the functioncall in S with that local var.
+    for (std::vector<FunctionCall *>::iterator I = parts.calls.begin(), E = parts.calls.end(); I != E; ++I) {
+        // A call on its own discards its value, so stays where it is.
+        if (*I == stmt) continue;
+        Variable *retval = pass->get_return_value((*I)->function);
+        if (retval == NULL) continue;
+        Variable *v = own(new Variable(get_unique_name()));
+        Location *loc = own(new Location(v));
+        Assignment *a = own(new Assignment(loc, retval, IRDebugInfo()));
+        SI = b->insert_before(SI, a);
+        SI = b->insert_before(SI, *I);
+        SI++; SI++;
+        replace[*I] = v; // replace the function call with the saved retval.
+    }
+    if (!replace.empty()) {
+        ReplaceStatementCalls replace_calls(replace);
+        stmt->accept(&replace_calls);
     }
-    if (ret_void) {
-        delete gv;
-        gv = NULL;
+
+    for (std::vector<Block *>::iterator I = parts.blocks.begin(), E = parts.blocks.end(); I != E; ++I) {
+        lower_block(*I);
     }
-    return_values[f] = gv;
-    return gv;
 }
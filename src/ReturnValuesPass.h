@@ -3,26 +3,45 @@
 
 #include "IR.h"
 #include "IRVisitor.h"
-#include <map>
+#include <set>
+#include <unordered_map>
 
 namespace Bish {
 
+// Lowers function return values to global variables: each 'return v'
+// assigns v to the callee's global return value, and each call whose
+// value is used is moved in front of its statement, followed by a
+// copy of the return value into a fresh local.
+//
+// The module is walked once to summarize each function, and once more
+// to rewrite it, so the pass is linear in the size of the IR. The
+// rewrite only touches the function being rewritten, so functions are
+// rewritten in parallel on the active thread pool. The locals are
+// numbered per function, so the names don't depend on the order the
+// functions are rewritten in.
 class ReturnValuesPass : public IRVisitor {
 public:
     virtual void visit(Module *);
 private:
-    unsigned unique_id;
-    std::set<Function *> blacklist;
+    // What is known about a function after the first walk.
+    struct Summary {
+        Summary() : called(false), blacklisted(false), returns_value(false), retval(NULL) {}
+        bool called;
+        // Called from an IORedirection, so left alone.
+        bool blacklisted;
+        bool returns_value;
+        Variable *retval;
+    };
+    class Summarize;
+    class Lowering;
+    class LowerFunction;
+
+    Module *module;
     std::set<Name> used_names;
-    std::map<Function *, std::map<unsigned, Variable *> > reference_vars;
-    std::map<Function *, Variable *> return_values;
-    Name get_unique_name(const std::string &prefix="_rv_");
+    std::unordered_map<Function *, Summary> summaries;
+    Name get_unique_name(const std::string &base);
     void initialize_unique_naming(Module *m);
-    void initialize_blacklist(Module *m);
-    void lower_function(Function *f);
-    void lower_blocks(std::vector<Block *> &blocks);
-    Variable *get_return_value(Function *f);
-    template <class T> void process_statements(std::vector<T *> &stmts);
+    Variable *get_return_value(Function *f) const;
 };
 
 }
@@ -0,0 +1,106 @@
+#include "IRCloner.h"
+#include "SpecializationPass.h"
+#include "TypeChecker.h"
+
+using namespace Bish;
+
+namespace {
+
+// Encode a type as a short string usable in a function name.
+std::string mangle(const Type &t) {
+    if (t.integer()) return "i";
+    if (t.fractional()) return "f";
+    if (t.string()) return "s";
+    if (t.boolean()) return "b";
+    if (t.array()) return "a" + mangle(t.element());
+    return "u";
+}
+
+std::string mangle(const std::vector<Type> &types) {
+    std::string result;
+    for (std::vector<Type>::const_iterator I = types.begin(), E = types.end(); I != E; ++I) {
+        result += mangle(*I);
+    }
+    return result;
+}
+
+}
+
+void SpecializationPass::visit(Module *node) {
+    module = node;
+    // Redirecting a call can change the types flowing out of it, so
+    // in principle calls could keep moving between copies; give up
+    // after a fixed number of rounds.
+    const unsigned max_rounds = 16;
+    for (unsigned i = 0; i < max_rounds && specialize_mismatched_calls(); i++) {}
+}
+
+// Type check the module, and redirect each call whose arguments don't
+// match its callee to a specialization for its argument types. Return
+// true if any call was redirected.
+bool SpecializationPass::specialize_mismatched_calls() {
+    TypeChecker probe(true);
+    module->accept(&probe);
+    const std::vector<TypeChecker::CallMismatch> &mismatches = probe.call_mismatches();
+    bool changed = false;
+    for (std::vector<TypeChecker::CallMismatch>::const_iterator I = mismatches.begin(),
+             E = mismatches.end(); I != E; ++I) {
+        FunctionCall *call = I->call;
+        Function *f = call->function;
+        if (origin.count(f)) f = origin[f];
+        // The original keeps the types it was first given, so that
+        // later rounds don't hand them to a different caller.
+        std::vector<Type> params = probe.parameter_types(f);
+        for (unsigned i = 0; i < params.size(); i++) {
+            f->args[i]->set_type(params[i]);
+        }
+        Function *target;
+        if (mangle(I->args) == mangle(params)) {
+            target = f;
+        } else {
+            target = specialization(f, I->args);
+        }
+        if (target == NULL || target == call->function) continue;
+        call->set_function(target);
+        changed = true;
+    }
+    return changed;
+}
+
+// Return the copy of f for the given argument types, making it if
+// needed. Returns NULL if f can't be specialized for those types.
+Function *SpecializationPass::specialization(Function *f, const std::vector<Type> &args) {
+    Signature sig(f, mangle(args));
+    std::map<Signature, Function *>::iterator I = specializations.find(sig);
+    if (I != specializations.end()) return I->second;
+
+    // An external function is defined by its library, which only has
+    // the one version the library was compiled with, so isn't copied.
+    Function *result = NULL;
+    TypeChecker check(true);
+    if (!f->external && num_specializations[f] < max_specializations && check.check_function(f, args)) {
+        IRCloner cloner(module);
+        result = cloner.clone_function(f, get_unique_name(f, sig.second));
+        // Fix the types of the copy's parameters, so the type checker
+        // types its body for them whatever order it is visited in.
+        for (unsigned i = 0; i < args.size(); i++) {
+            result->args[i]->set_type(args[i]);
+        }
+        module->add_function(result);
+        origin[result] = f;
+        num_specializations[f]++;
+    }
+    specializations[sig] = result;
+    return result;
+}
+
+Name SpecializationPass::get_unique_name(Function *f, const std::string &suffix) {
+    Name name(f->name);
+    std::string base = f->name.name + "__" + suffix;
+    name.name = base;
+    unsigned i = 0;
+    while (module->get_function(name)) {
+        name.name = base + "_" + as_string(i++);
+    }
+    return name;
+}
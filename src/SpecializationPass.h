@@ -0,0 +1,45 @@
+#ifndef __BISH_SPECIALIZATION_PASS_H__
+#define __BISH_SPECIALIZATION_PASS_H__
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass clones functions that are called with more than one
+ * combination of argument types, so that each copy can be typed (and
+ * so lowered) for the arguments it is actually called with. Calls are
+ * redirected to the copy matching their argument types.
+ *
+ * The module is type checked in probe mode to find calls whose
+ * arguments don't match their callee. A copy is only made if its body
+ * type checks with the new argument types, and at most
+ * max_specializations copies are made of any one function. This
+ * repeats until no more calls can be redirected, since a new copy can
+ * in turn call other functions with new argument types. Any mismatch
+ * left over is reported by the type checker as usual. */
+class SpecializationPass : public IRVisitor {
+public:
+    SpecializationPass(unsigned max_specializations=4) :
+        max_specializations(max_specializations) {}
+    virtual void visit(Module *);
+private:
+    typedef std::pair<Function *, std::string> Signature;
+    unsigned max_specializations;
+    Module *module;
+    // The function each copy was made from.
+    std::map<Function *, Function *> origin;
+    std::map<Signature, Function *> specializations;
+    std::map<Function *, unsigned> num_specializations;
+    bool specialize_mismatched_calls();
+    Function *specialization(Function *f, const std::vector<Type> &args);
+    Name get_unique_name(Function *f, const std::string &suffix);
+};
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cstring>
+#include "StructuralHash.h"
+
+using namespace Bish;
+
+namespace {
+
+// Tokens identifying each node kind in the canonical encoding.
+typedef enum { ModuleTag = 1, BlockTag, GlobalVariableTag, LocalVariableTag,
+               ReferenceTag, LocationTag, FunctionTag, FunctionCallTag,
+               ExternCallTag, IORedirectionTag, IfStatementTag,
+               ImportStatementTag, ReturnStatementTag,
+               LoopControlStatementTag, ForLoopTag, AssignmentTag, BinOpTag,
+               UnaryOpTag, IntegerTag, FractionalTag, StringTag, BooleanTag,
+               NullTag, InterpStrTag, InterpVarTag, RecursiveCallTag,
+               ArrayTag, ScalarTag, StringComparisonTag, CalleeIdTag } Tag;
+
+// 64-bit FNV-1a over the tokens, a byte at a time.
+uint64_t fnv1a(const std::vector<uint64_t> &tokens) {
+    uint64_t h = 14695981039346656037ULL;
+    for (std::vector<uint64_t>::const_iterator I = tokens.begin(),
+             E = tokens.end(); I != E; ++I) {
+        uint64_t t = *I;
+        for (unsigned i = 0; i < 8; i++) {
+            h ^= (t >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+}
+
+StructuralKey StructuralHash::key(IRNode *n) {
+    tokens.clear();
+    push_child(n);
+    StructuralKey k;
+    k.tokens.swap(tokens);
+    k.hash = fnv1a(k.tokens);
+    return k;
+}
+
+void StructuralHash::push(const std::string &s) {
+    // Pack the characters eight to a token, preceded by the length.
+    push(s.size());
+    for (unsigned i = 0; i < s.size(); i += 8) {
+        uint64_t t = 0;
+        std::memcpy(&t, s.data() + i, std::min<size_t>(8, s.size() - i));
+        push(t);
+    }
+}
+
+void StructuralHash::push(const Name &n) {
+    push(n.namespace_id.size());
+    for (std::vector<std::string>::const_iterator I = n.namespace_id.begin(),
+             E = n.namespace_id.end(); I != E; ++I) {
+        push(*I);
+    }
+    push(n.name);
+}
+
+void StructuralHash::push(InterpolatedString *s) {
+    for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+        if (I->is_str()) {
+            push(InterpStrTag);
+            push(I->str());
+        } else {
+            push(InterpVarTag);
+            I->var()->accept(this);
+        }
+    }
+    push(NullTag);
+}
+
+void StructuralHash::push_lowered_type(IRNode *n) {
+    if (lowered_types) push(n->type().array() ? ArrayTag : ScalarTag);
+}
+
+void StructuralHash::push_callee(Function *f) {
+    if (callee_ids) {
+        CalleeIds::const_iterator I = callee_ids->find(f);
+        if (I != callee_ids->end()) {
+            push(CalleeIdTag);
+            push(I->second);
+            return;
+        }
+    }
+    push(f->name);
+}
+
+void StructuralHash::push_child(IRNode *n) {
+    if (n) {
+        push_lowered_type(n);
+        n->accept(this);
+    } else {
+        push(NullTag);
+    }
+}
+
+void StructuralHash::visit(Module *node) {
+    push(ModuleTag);
+    push_child(node->global_variables);
+    push(node->functions.size());
+    for (std::vector<Function *>::const_iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        push((*I)->name);
+        push_child(*I);
+    }
+}
+
+void StructuralHash::visit(Block *node) {
+    push(BlockTag);
+    push(node->nodes.size());
+    for (std::vector<IRNode *>::const_iterator I = node->nodes.begin(),
+             E = node->nodes.end(); I != E; ++I) {
+        push_child(*I);
+    }
+}
+
+void StructuralHash::visit(Variable *node) {
+    push_lowered_type(node);
+    if (node->global) {
+        push(GlobalVariableTag);
+        push(node->name);
+    } else {
+        std::map<Variable *, uint64_t>::iterator I = variables.find(node);
+        if (I == variables.end()) {
+            I = variables.insert(std::make_pair(node, next_variable++)).first;
+        }
+        push(LocalVariableTag);
+        push(I->second);
+    }
+    if (node->is_reference()) {
+        push(ReferenceTag);
+        node->reference->accept(this);
+    }
+}
+
+void StructuralHash::visit(Location *node) {
+    push(LocationTag);
+    node->variable->accept(this);
+    push_child(node->offset);
+}
+
+void StructuralHash::visit(Function *node) {
+    Function *enclosing = function;
+    function = node;
+    push(FunctionTag);
+    push(node->args.size());
+    for (std::vector<Variable *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+    push_child(node->body);
+    function = enclosing;
+}
+
+void StructuralHash::visit(FunctionCall *node) {
+    push(FunctionCallTag);
+    if (node->function == function) {
+        push(RecursiveCallTag);
+    } else {
+        push_callee(node->function);
+    }
+    push(node->args.size());
+    for (std::vector<Assignment *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+}
+
+void StructuralHash::visit(ExternCall *node) {
+    push(ExternCallTag);
+    push(node->body);
+}
+
+void StructuralHash::visit(IORedirection *node) {
+    push(IORedirectionTag);
+    push(node->op);
+    push_child(node->a);
+    push_child(node->b);
+}
+
+void StructuralHash::visit(IfStatement *node) {
+    push(IfStatementTag);
+    push(node->elses.size());
+    push_child(node->pblock->condition);
+    push_child(node->pblock->body);
+    for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
+             E = node->elses.end(); I != E; ++I) {
+        push_child((*I)->condition);
+        push_child((*I)->body);
+    }
+    push_child(node->elseblock);
+}
+
+void StructuralHash::visit(ImportStatement *node) {
+    push(ImportStatementTag);
+    push(node->module_name);
+    push(node->path);
+}
+
+void StructuralHash::visit(ReturnStatement *node) {
+    push(ReturnStatementTag);
+    push_child(node->value);
+}
+
+void StructuralHash::visit(LoopControlStatement *node) {
+    push(LoopControlStatementTag);
+    push(node->op);
+}
+
+void StructuralHash::visit(ForLoop *node) {
+    push(ForLoopTag);
+    node->variable->accept(this);
+    push_child(node->lower);
+    push_child(node->upper);
+    push_child(node->body);
+}
+
+void StructuralHash::visit(Assignment *node) {
+    push(AssignmentTag);
+    node->location->accept(this);
+    push(node->values.size());
+    for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
+             E = node->values.end(); I != E; ++I) {
+        push_child(*I);
+    }
+}
+
+void StructuralHash::visit(BinOp *node) {
+    push(BinOpTag);
+    push(node->op);
+    if (lowered_types && (node->a->type().string() || node->b->type().string())) {
+        push(StringComparisonTag);
+    }
+    push_child(node->a);
+    push_child(node->b);
+}
+
+void StructuralHash::visit(UnaryOp *node) {
+    push(UnaryOpTag);
+    push(node->op);
+    push_child(node->a);
+}
+
+void StructuralHash::visit(Integer *node) {
+    push(IntegerTag);
+    push((uint64_t)(int64_t)node->value);
+}
+
+void StructuralHash::visit(Fractional *node) {
+    uint64_t bits;
+    std::memcpy(&bits, &node->value, sizeof(bits));
+    push(FractionalTag);
+    push(bits);
+}
+
+void StructuralHash::visit(String *node) {
+    push(StringTag);
+    push(node->value);
+}
+
+void StructuralHash::visit(Boolean *node) {
+    push(BooleanTag);
+    push(node->value);
+}
+
+StructuralKey Bish::structural_key(IRNode *n) {
+    StructuralHash h;
+    return h.key(n);
+}
+
+uint64_t Bish::structural_hash(IRNode *n) {
+    return structural_key(n).hash;
+}
+
+StructuralKey Bish::lowered_key(Function *f, const StructuralHash::CalleeIds *callee_ids) {
+    StructuralHash h(true, callee_ids);
+    return h.key(f);
+}
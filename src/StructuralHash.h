@@ -0,0 +1,123 @@
+#ifndef __BISH_STRUCTURAL_HASH_H__
+#define __BISH_STRUCTURAL_HASH_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+// The canonical encoding of an IR subtree along with its hash. Two
+// subtrees are structurally identical exactly when their keys compare
+// equal, so keys can be used directly in maps to group identical
+// subtrees:
+//     std::map<StructuralKey, std::vector<Function *> > groups;
+//     for (...) groups[structural_key(f)].push_back(f);
+class StructuralKey {
+public:
+    std::vector<uint64_t> tokens;
+    uint64_t hash;
+    StructuralKey() : hash(0) {}
+
+    bool operator<(const StructuralKey &b) const {
+        return hash < b.hash || (hash == b.hash && tokens < b.tokens);
+    }
+    bool operator==(const StructuralKey &b) const {
+        return hash == b.hash && tokens == b.tokens;
+    }
+    bool operator!=(const StructuralKey &b) const {
+        return !(*this == b);
+    }
+};
+
+/* Computes a structural fingerprint of IR subtrees in time linear in
+ * their size. The fingerprint covers node kinds, operators, literal
+ * values, callee names and variable identities, but not types, debug
+ * information or the name of a hashed function (recursive calls
+ * within a hashed function are encoded without the callee name).
+ *
+ * Global variables are identified by name. Other variables are
+ * numbered in order of first appearance, so two functions which only
+ * differ in the names of their arguments and locals hash the same. The
+ * numbering persists across calls on one instance: use a single
+ * instance to compare expressions within a function (where 'a + 1'
+ * and 'b + 1' must differ), and a fresh instance per function to
+ * compare functions.
+ *
+ * With lowered_types set, the fingerprint also covers the parts of
+ * node types that lowering to bash depends on: whether each value is
+ * an array, and whether each comparison is between strings. Subtrees
+ * with equal keys then compile to the same code up to the names of
+ * their local variables.
+ *
+ * Calls are encoded by the callee's name, unless the callee has an id
+ * in callee_ids. Giving interchangeable functions the same id makes
+ * calls to any of them hash the same. */
+class StructuralHash : public IRVisitor {
+public:
+    typedef std::unordered_map<Function *, uint64_t> CalleeIds;
+
+    StructuralHash(bool lowered_types=false, const CalleeIds *callee_ids=NULL) :
+        lowered_types(lowered_types), callee_ids(callee_ids), next_variable(0), function(NULL) {}
+    // Return the structural key of the given subtree.
+    StructuralKey key(IRNode *n);
+    // Return the structural hash of the given subtree.
+    uint64_t hash(IRNode *n) { return key(n).hash; }
+
+    virtual void visit(Module *);
+    virtual void visit(Block *);
+    virtual void visit(Variable *);
+    virtual void visit(Location *);
+    virtual void visit(Function *);
+    virtual void visit(FunctionCall *);
+    virtual void visit(ExternCall *);
+    virtual void visit(IORedirection *);
+    virtual void visit(IfStatement *);
+    virtual void visit(ImportStatement *);
+    virtual void visit(ReturnStatement *);
+    virtual void visit(LoopControlStatement *);
+    virtual void visit(ForLoop *);
+    virtual void visit(Assignment *);
+    virtual void visit(BinOp *);
+    virtual void visit(UnaryOp *);
+    virtual void visit(Integer *);
+    virtual void visit(Fractional *);
+    virtual void visit(String *);
+    virtual void visit(Boolean *);
+private:
+    bool lowered_types;
+    const CalleeIds *callee_ids;
+    std::vector<uint64_t> tokens;
+    std::map<Variable *, uint64_t> variables;
+    uint64_t next_variable;
+    // Function being hashed, if any.
+    Function *function;
+
+    void push(uint64_t t) { tokens.push_back(t); }
+    void push(const std::string &s);
+    void push(const Name &n);
+    void push(InterpolatedString *s);
+    void push_callee(Function *f);
+    void push_child(IRNode *n);
+    void push_lowered_type(IRNode *n);
+};
+
+// Return the structural key of the given subtree, using a fresh
+// variable numbering.
+StructuralKey structural_key(IRNode *n);
+// Return the structural hash of the given subtree, using a fresh
+// variable numbering.
+uint64_t structural_hash(IRNode *n);
+// Return the structural key of the given function, including the
+// parts of its types that lowering depends on, and encoding calls to
+// the functions in callee_ids by their ids. Functions with equal keys
+// can be used in place of each other.
+StructuralKey lowered_key(Function *f, const StructuralHash::CalleeIds *callee_ids=NULL);
+
+}
+
+#endif
@@ -5,15 +5,16 @@
 using namespace Bish;
 
 void SymbolTable::insert(const Name &v, IRNode *n) {
-    table[v] = new SymbolTableEntry(n);
+    table.erase(v);
+    table.insert(std::make_pair(v, SymbolTableEntry(n)));
 }
 
 void SymbolTable::remove(const Name &v) {
     table.erase(v);
 }
 
-SymbolTableEntry *SymbolTable::lookup(const Name &v) const {
-    std::map<Name, SymbolTableEntry *>::const_iterator I = table.find(v);
+SymbolTableEntry *SymbolTable::lookup(const Name &v) {
+    std::map<Name, SymbolTableEntry>::iterator I = table.find(v);
     if (I == table.end()) {
         if (parent) {
             return parent->lookup(v);
@@ -21,7 +22,7 @@ SymbolTableEntry *SymbolTable::lookup(const Name &v) const {
             return NULL;
         }
     }
-    return I->second;
+    return &I->second;
 }
 
 bool SymbolTable::contains(const Name &v) const {
@@ -18,10 +18,10 @@ public:
     SymbolTable(SymbolTable *p) : parent(p) {}
     void insert(const Name &name, IRNode *n);
     void remove(const Name &name);
-    SymbolTableEntry *lookup(const Name &name) const;
+    SymbolTableEntry *lookup(const Name &name);
     bool contains(const Name &v) const;
 private:
-    std::map<Name, SymbolTableEntry *> table;
+    std::map<Name, SymbolTableEntry> table;
     SymbolTable *parent;
 };
 
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <algorithm>
+#include <cassert>
+#include "ThreadPool.h"
+
+using namespace Bish;
+
+namespace {
+
+thread_local ThreadPool *active_pool = NULL;
+
+// Calls to a loop body which are still running, and the first
+// exception any of them threw.
+class LoopState {
+public:
+    LoopState(unsigned chunks) : remaining(chunks) {}
+
+    void finish(std::exception_ptr e) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (e && !error) error = e;
+        if (--remaining == 0) done.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (remaining > 0) done.wait(guard);
+        if (error) std::rethrow_exception(error);
+    }
+private:
+    std::mutex lock;
+    std::condition_variable done;
+    unsigned remaining;
+    std::exception_ptr error;
+};
+
+// Runs the loop body over one contiguous range of indices.
+class LoopChunk {
+public:
+    LoopChunk(const ThreadPool::LoopBody *body, unsigned begin, unsigned end, LoopState *state) :
+        body(body), begin(begin), end(end), state(state) {}
+
+    void operator()() const {
+        std::exception_ptr error;
+        try {
+            for (unsigned i = begin; i < end; i++) (*body)(i);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        state->finish(error);
+    }
+private:
+    const ThreadPool::LoopBody *body;
+    unsigned begin, end;
+    LoopState *state;
+};
+
+}
+
+ThreadPool::Scope::Scope(ThreadPool *pool) : previous(active_pool) {
+    active_pool = pool;
+}
+
+ThreadPool::Scope::~Scope() {
+    active_pool = previous;
+}
+
+ThreadPool::ThreadPool(unsigned workers) : queued(0), pending(0), next(0), stopping(false) {
+    assert(workers > 0);
+    for (unsigned i = 0; i < workers; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned i = 0; i < workers; i++) {
+        threads.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (unsigned i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+unsigned ThreadPool::default_size() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+ThreadPool *ThreadPool::active() {
+    return active_pool;
+}
+
+void ThreadPool::for_each(unsigned n, const LoopBody &body) {
+    ThreadPool *pool = active_pool;
+    if (pool == NULL || pool->size() == 1 || n < 2) {
+        for (unsigned i = 0; i < n; i++) body(i);
+        return;
+    }
+    // A few chunks per worker balances uneven bodies without paying
+    // for a task per index.
+    unsigned chunks = std::min(n, pool->size() * 4);
+    LoopState state(chunks);
+    for (unsigned c = 0; c < chunks; c++) {
+        pool->submit(LoopChunk(&body, (uint64_t)n * c / chunks, (uint64_t)n * (c + 1) / chunks, &state));
+    }
+    state.wait();
+}
+
+void ThreadPool::submit(const Task &t) {
+    unsigned q;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        q = next;
+        next = (next + 1) % queues.size();
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[q]->lock);
+        queues[q]->tasks.push_back(t);
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued++;
+    }
+    work_available.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (pending > 0) all_done.wait(guard);
+}
+
+// Take a task from the back of the worker's own queue, or failing
+// that from the front of another worker's queue.
+bool ThreadPool::take(unsigned id, Task &t) {
+    for (unsigned i = 0; i < queues.size(); i++) {
+        Queue &q = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty()) continue;
+        if (i == 0) {
+            t = q.tasks.back();
+            q.tasks.pop_back();
+        } else {
+            t = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(unsigned id) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (queued == 0 && !stopping) work_available.wait(guard);
+            if (queued == 0) return;
+            // Claim one of the queued tasks; it is in some queue, and
+            // only claimed tasks are ever taken out of the queues.
+            queued--;
+        }
+        Task t;
+        while (!take(id, t)) std::this_thread::yield();
+        t();
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0) all_done.notify_all();
+    }
+}
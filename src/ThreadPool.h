@@ -0,0 +1,87 @@
+#ifndef __BISH_THREAD_POOL_H__
+#define __BISH_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Bish {
+
+/* A fixed set of worker threads running independent tasks. Every
+ * worker has its own queue, and tasks are handed out to the queues in
+ * turn. A worker takes tasks from the back of its own queue, and once
+ * that runs dry steals from the front of the others', so a few long
+ * tasks on one worker don't leave the rest idle.
+ *
+ * A pool can also be made the active pool of a thread, which lets code
+ * deep inside a compile (e.g. a pass) spread a loop over its workers
+ * with for_each() without the pool being passed down to it.
+ *
+ * Example:
+ *     ThreadPool pool(ThreadPool::default_size());
+ *     for (...) pool.submit(task);
+ *     pool.wait();
+ *
+ *     ThreadPool::Scope scope(&pool);
+ *     ThreadPool::for_each(n, body);
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+    typedef std::function<void(unsigned)> LoopBody;
+
+    // Makes a pool the active pool of the calling thread for the
+    // lifetime of the scope. The pool may be NULL.
+    class Scope {
+    public:
+        Scope(ThreadPool *pool);
+        ~Scope();
+    private:
+        ThreadPool *previous;
+    };
+
+    ThreadPool(unsigned workers);
+    // Waits for the submitted tasks before stopping the workers.
+    ~ThreadPool();
+    // Queue a task to run on one of the workers.
+    void submit(const Task &t);
+    // Block until every submitted task has finished.
+    void wait();
+    unsigned size() const { return threads.size(); }
+    // Return the number of hardware threads, or 1 if unknown.
+    static unsigned default_size();
+    // Return the active pool of the calling thread, or NULL.
+    static ThreadPool *active();
+    // Call body(i) for every i below n, on the workers of the calling
+    // thread's active pool, or in order on the calling thread if it
+    // has none. Returns once every call has finished, rethrowing the
+    // first exception thrown by any of them.
+    static void for_each(unsigned n, const LoopBody &body);
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> threads;
+    // Guards the counters below.
+    std::mutex lock;
+    std::condition_variable work_available, all_done;
+    // Tasks waiting in the queues, and tasks not yet finished.
+    unsigned queued, pending;
+    // The queue the next task goes to.
+    unsigned next;
+    bool stopping;
+
+    void run(unsigned id);
+    bool take(unsigned id, Task &t);
+};
+
+}
+
+#endif
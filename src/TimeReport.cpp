@@ -0,0 +1,167 @@
+#include <cassert>
+#include <cstdio>
+#include <iomanip>
+#include <sys/resource.h>
+#include "TimeReport.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+thread_local TimeReport *active_report = NULL;
+TimeReport::AllocationCounter allocation_counter = NULL;
+
+void count_allocations(uint64_t &count, uint64_t &bytes) {
+    count = bytes = 0;
+    if (allocation_counter) allocation_counter(count, bytes);
+}
+
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+double milliseconds(TimeReport::Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+}
+
+TimeReport::Scope::Scope(const std::string &name) : report(active()), phase(0) {
+    if (report) phase = report->begin(name);
+}
+
+TimeReport::Scope::~Scope() {
+    if (report) report->end(phase);
+}
+
+void TimeReport::Scope::set_ir_nodes(unsigned n) {
+    if (report) report->phases[phase].ir_nodes = n;
+}
+
+void TimeReport::Accumulator::add_phase(const std::string &name) const {
+    if (report == NULL) return;
+    assert(!report->open.empty());
+    Phase &p = report->phases[report->add(name, report->open.back())];
+    p.wall = total;
+    p.peak_rss_kb = peak_rss_kb();
+}
+
+TimeReport::TimeReport(const std::string &name) {
+    add(name, 0);
+}
+
+void TimeReport::start() {
+    assert(open.empty());
+    active_report = this;
+    Phase &root = phases[0];
+    root.start = Clock::now();
+    count_allocations(root.start_allocs, root.start_alloc_bytes);
+    open.push_back(0);
+}
+
+void TimeReport::stop() {
+    assert(open.size() == 1 && "Phases still open.");
+    end(0);
+    if (active_report == this) active_report = NULL;
+}
+
+TimeReport *TimeReport::active() {
+    return active_report;
+}
+
+void TimeReport::set_allocation_counter(AllocationCounter f) {
+    allocation_counter = f;
+}
+
+// Add a phase under the given parent. The first phase is the root.
+unsigned TimeReport::add(const std::string &name, unsigned parent) {
+    Phase p;
+    p.name = name;
+    p.parent = parent;
+    p.wall = Clock::duration::zero();
+    p.allocs = p.alloc_bytes = 0;
+    p.peak_rss_kb = 0;
+    p.ir_nodes = -1;
+    unsigned id = phases.size();
+    phases.push_back(p);
+    if (id != 0) phases[parent].children.push_back(id);
+    return id;
+}
+
+unsigned TimeReport::begin(const std::string &name) {
+    assert(!open.empty());
+    unsigned id = add(name, open.back());
+    open.push_back(id);
+    Phase &q = phases[id];
+    count_allocations(q.start_allocs, q.start_alloc_bytes);
+    q.start = Clock::now();
+    return id;
+}
+
+void TimeReport::end(unsigned phase) {
+    assert(!open.empty() && open.back() == phase && "Phases must end in reverse order.");
+    Phase &p = phases[phase];
+    p.wall = Clock::now() - p.start;
+    uint64_t allocs, bytes;
+    count_allocations(allocs, bytes);
+    p.allocs = allocs - p.start_allocs;
+    p.alloc_bytes = bytes - p.start_alloc_bytes;
+    p.peak_rss_kb = peak_rss_kb();
+    open.pop_back();
+}
+
+void TimeReport::print_table(std::ostream &os) const {
+    os << std::left << std::setw(48) << "Phase" << std::right
+       << std::setw(12) << "Wall (ms)"
+       << std::setw(12) << "Allocs"
+       << std::setw(14) << "Alloc KB"
+       << std::setw(14) << "Peak RSS KB"
+       << std::setw(10) << "IR nodes" << "\n";
+    print_table(os, 0, 0);
+}
+
+void TimeReport::print_table(std::ostream &os, unsigned phase, unsigned depth) const {
+    const Phase &p = phases[phase];
+    std::string name = std::string(2 * depth, ' ') + p.name;
+    os << std::left << std::setw(48) << name << std::right
+       << std::setw(12) << std::fixed << std::setprecision(3) << milliseconds(p.wall)
+       << std::setw(12) << p.allocs
+       << std::setw(14) << p.alloc_bytes / 1024
+       << std::setw(14) << p.peak_rss_kb
+       << std::setw(10);
+    if (p.ir_nodes >= 0) {
+        os << p.ir_nodes;
+    } else {
+        os << "-";
+    }
+    os << "\n";
+    for (std::vector<unsigned>::const_iterator I = p.children.begin(), E = p.children.end(); I != E; ++I) {
+        print_table(os, *I, depth + 1);
+    }
+}
+
+void TimeReport::print_json(std::ostream &os) const {
+    print_json(os, 0, 0);
+    os << "\n";
+}
+
+void TimeReport::print_json(std::ostream &os, unsigned phase, unsigned depth) const {
+    const Phase &p = phases[phase];
+    std::string indent(2 * depth, ' ');
+    os << indent << "{\"name\": " << json_string(p.name)
+       << ", \"wall_ms\": " << std::fixed << std::setprecision(3) << milliseconds(p.wall)
+       << ", \"allocs\": " << p.allocs
+       << ", \"alloc_bytes\": " << p.alloc_bytes
+       << ", \"peak_rss_kb\": " << p.peak_rss_kb;
+    if (p.ir_nodes >= 0) os << ", \"ir_nodes\": " << p.ir_nodes;
+    os << ", \"children\": [";
+    for (unsigned i = 0; i < p.children.size(); i++) {
+        os << (i ? ",\n" : "\n");
+        print_json(os, p.children[i], depth + 1);
+    }
+    if (!p.children.empty()) os << "\n" << indent;
+    os << "]}";
+}
@@ -0,0 +1,102 @@
+#ifndef __BISH_TIME_REPORT_H__
+#define __BISH_TIME_REPORT_H__
+
+#include <stdint.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Bish {
+
+/* A hierarchical report of where compile time goes. While a report is
+ * active on a thread, each Scope created on that thread records a
+ * phase nested inside the innermost open phase: its wall time, the
+ * allocations made during it, the peak RSS of the process when it
+ * ended and, where it makes sense, an IR node count. Work done in many
+ * short pieces (e.g. tokenizing) is summed by an Accumulator, and added
+ * as a single phase once it is done. With no active report, scopes and
+ * accumulators do nothing.
+ *
+ * Example:
+ *     TimeReport report;
+ *     report.start();
+ *     {
+ *         TimeReport::Scope scope("parse");
+ *         ...
+ *     }
+ *     report.stop();
+ *     report.print_table(std::cerr);
+ */
+class TimeReport {
+public:
+    typedef std::chrono::steady_clock Clock;
+    // Writes the number of allocations and allocated bytes so far.
+    typedef void (*AllocationCounter)(uint64_t &count, uint64_t &bytes);
+
+    class Scope {
+    public:
+        Scope(const std::string &name);
+        ~Scope();
+        void set_ir_nodes(unsigned n);
+    private:
+        TimeReport *report;
+        unsigned phase;
+    };
+
+    // Sums the wall time of many short pieces of work. Timing a piece
+    // only reads the clock, so the phase has no allocation count, and
+    // its peak RSS is read once, when it is added.
+    class Accumulator {
+    public:
+        Accumulator() : report(active()), total(Clock::duration::zero()) {}
+        void start() { if (report) started = Clock::now(); }
+        void stop() { if (report) total += Clock::now() - started; }
+        // Add the time so far as a phase inside the innermost open
+        // phase of the report active when this was created.
+        void add_phase(const std::string &name) const;
+    private:
+        TimeReport *report;
+        Clock::time_point started;
+        Clock::duration total;
+    };
+
+    TimeReport(const std::string &name="bish");
+    // Make this the active report of the calling thread.
+    void start();
+    // Finish the report, and stop it being active.
+    void stop();
+    void print_table(std::ostream &os) const;
+    void print_json(std::ostream &os) const;
+
+    // Return the active report of the calling thread, or NULL.
+    static TimeReport *active();
+    // Allocations are only counted once a counter is set, since
+    // counting them means replacing the global operator new.
+    static void set_allocation_counter(AllocationCounter f);
+private:
+    struct Phase {
+        std::string name;
+        unsigned parent;
+        std::vector<unsigned> children;
+        Clock::duration wall;
+        uint64_t allocs, alloc_bytes;
+        long peak_rss_kb;
+        long ir_nodes;
+        // Start of the current interval.
+        Clock::time_point start;
+        uint64_t start_allocs, start_alloc_bytes;
+    };
+    std::vector<Phase> phases;
+    std::vector<unsigned> open;
+
+    unsigned add(const std::string &name, unsigned parent);
+    unsigned begin(const std::string &name);
+    void end(unsigned phase);
+    void print_table(std::ostream &os, unsigned phase, unsigned depth) const;
+    void print_json(std::ostream &os, unsigned phase, unsigned depth) const;
+};
+
+}
+
+#endif
@@ -31,13 +31,17 @@ inline bool is_symbol_char(char c) {
 
 // Return the token at the head of the stream, but do not skip it.
 Token Tokenizer::peek() {
+    timer.start();
     ResultState st = get_token();
+    timer.stop();
     return st.first;
 }
 
 // Skip the token currently at the head of the stream.
 void Tokenizer::next() {
+    timer.start();
     ResultState st = get_token();
+    timer.stop();
     idx = st.second;
 }
 
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include "IR.h"
+#include "TimeReport.h"
 
 namespace Bish {
 
@@ -268,6 +269,9 @@ private:
 class Tokenizer {
 public:
     Tokenizer(const std::string &p, const std::string &t) : path(p), text(t), idx(0), lineno(0), got_newline(false) {}
+    // Return the time spent forming tokens so far, while a time
+    // report is active.
+    const TimeReport::Accumulator &time() const { return timer; }
 
     // Return the token at the head of the stream, but do not skip it.
     Token peek();
@@ -295,6 +299,9 @@ public:
     // Return a human-readable representation of the current position
     // in the string.
     std::string position() const;
+    // Return the path and current line of the text being tokenized.
+    const std::string &file() const { return path; }
+    unsigned line() const { return lineno; }
 
     // Helper class used to manage fetching debug info.
     class Info {
@@ -320,6 +327,7 @@ private:
     unsigned idx;
     unsigned lineno;
     bool got_newline;
+    TimeReport::Accumulator timer;
 
     // Start a debug record.
     void start_debug_info();
@@ -0,0 +1,97 @@
+#include <set>
+#include "Builtins.h"
+#include "CallGraph.h"
+#include "TreeShakingPass.h"
+
+using namespace Bish;
+
+namespace {
+
+// Collects the functions called from a subtree.
+class FindCallees : public IRVisitor {
+public:
+    std::vector<Function *> callees;
+    virtual void visit(FunctionCall *call) {
+        IRVisitor::visit(call);
+        callees.push_back(call->function);
+    }
+};
+
+// Collects the names of the built-in symbols referred to from a
+// subtree, including from within strings and external commands.
+class FindBuiltinUses : public IRVisitor {
+public:
+    std::set<std::string> used;
+    virtual void visit(Variable *v) {
+        if (v->name.namespace_id.empty() && is_builtin(v->name)) used.insert(v->name.name);
+    }
+    virtual void visit(ExternCall *n) {
+        visit(n->body);
+    }
+    virtual void visit(String *n) {
+        visit(n->value);
+    }
+private:
+    bool is_builtin(const Name &n) const {
+        const std::vector<Name> &names = builtins().names();
+        for (std::vector<Name>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
+            if (*I == n) return true;
+        }
+        return false;
+    }
+    void visit(InterpolatedString *n) {
+        for (InterpolatedString::const_iterator I = n->begin(), E = n->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+};
+
+}
+
+void TreeShakingPass::visit(Module *node) {
+    // The roots are main, the functions called from global variable
+    // initializers, which the call graph leaves out, and the functions
+    // a library exports.
+    FindCallees find;
+    node->global_variables->accept(&find);
+    std::vector<Function *> worklist(1, node->main);
+    worklist.insert(worklist.end(), find.callees.begin(), find.callees.end());
+    for (std::vector<Function *>::iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        if ((*I)->exported) worklist.push_back(*I);
+    }
+
+    // The calls made by external functions are made from within their
+    // library, so aren't followed.
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(node);
+    std::set<Function *> live;
+    while (!worklist.empty()) {
+        Function *f = worklist.back();
+        worklist.pop_back();
+        if (!live.insert(f).second || f->external || !cg.contains(f)) continue;
+        CallGraph::FunctionList callees = cg.calls(f);
+        for (CallGraph::FunctionList::const_iterator I = callees.begin(), E = callees.end(); I != E; ++I) {
+            worklist.push_back(*I);
+        }
+    }
+
+    std::set<Function *> dead;
+    for (std::vector<Function *>::iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        if (!live.count(*I)) dead.insert(*I);
+    }
+    if (!dead.empty()) node->remove_functions(dead);
+
+    FindBuiltinUses uses;
+    node->global_variables->accept(&uses);
+    for (std::vector<Function *>::iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        (*I)->accept(&uses);
+    }
+    const std::vector<Name> &names = builtins().names();
+    node->unused_builtins.clear();
+    for (std::vector<Name>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
+        if (!uses.used.count(I->name)) node->unused_builtins.insert(I->name);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef __BISH_TREE_SHAKING_PASS_H__
+#define __BISH_TREE_SHAKING_PASS_H__
+
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass removes the functions that can never be called: those not
+ * reachable in the call graph from main, from the global variable
+ * initializers or from the functions a library exports. Linking an
+ * import brings in every function called from the importing module,
+ * even from functions which are never called themselves, so this can
+ * remove a lot of a linked program.
+ *
+ * Built-in symbols which none of the remaining code refers to are
+ * recorded in Module::unused_builtins, so that their definitions can
+ * be left out too. */
+class TreeShakingPass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+};
+
+}
+
+#endif
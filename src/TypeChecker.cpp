@@ -1,158 +1,206 @@
-#include <iostream>
 #include <cassert>
+#include "CallGraph.h"
 #include "Errors.h"
 #include "IR.h"
 #include "TypeChecker.h"
 
 using namespace Bish;
 
+// Return the type variable of n, creating it on first use. Types
+// already set on the node (e.g. builtin variables) constrain it.
+TypeChecker::Var TypeChecker::var(IRNode *n) {
+    std::unordered_map<IRNode *, Var>::iterator I = vars.find(n);
+    if (I != vars.end()) return I->second;
+    Var v = unifier.constant(n->type());
+    vars[n] = v;
+    typed.push_back(n);
+    return v;
+}
+
+// Report a type error unless ok. In probe mode the error is only
+// counted.
+ErrorReport TypeChecker::check(bool ok) {
+    if (!ok) errors++;
+    return ErrorReport(__FILE__, __LINE__, !ok && !probe);
+}
+
+bool TypeChecker::check_function(Function *f, const std::vector<Type> &args) {
+    assert(probe);
+    assert(args.size() == f->args.size());
+    // The given types replace any the parameters already have.
+    for (unsigned i = 0; i < args.size(); i++) {
+        vars[f->args[i]] = unifier.constant(args[i]);
+        typed.push_back(f->args[i]);
+    }
+    f->accept(this);
+    solve_for_each_loops();
+    return !failed();
+}
+
+std::vector<Type> TypeChecker::parameter_types(Function *f) {
+    std::vector<Type> types;
+    for (std::vector<Variable *>::iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+        types.push_back(unifier.resolve(var(*I)));
+    }
+    return types;
+}
+
 void TypeChecker::visit(Module *node) {
-    if (visited(node)) return;
-    visited_set.insert(node);
     module = node;
     node->global_variables->accept(this);
-    // Functions are not visited here: only via function calls.
-    if (node->main) node->main->accept(this);
+    // Visit callees before their callers, so that the return type of
+    // a call is usually known where it is used, and a mismatch is
+    // reported at the call rather than inside the callee.
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(node);
+    for (unsigned c = 0; c < cg.num_components(); c++) {
+        CallGraph::FunctionList fs = cg.component_functions(c);
+        for (CallGraph::FunctionList::const_iterator I = fs.begin(), E = fs.end(); I != E; ++I) {
+            (*I)->accept(this);
+        }
+    }
+    solve_for_each_loops();
+    if (probe) return;
+    for (std::vector<IRNode *>::iterator I = typed.begin(), E = typed.end(); I != E; ++I) {
+        (*I)->set_type(unifier.resolve(vars[*I]));
+    }
+}
+
+void TypeChecker::visit(Function *node) {
+    function = node;
+    var(node);
+    IRVisitor::visit(node);
+    function = NULL;
 }
 
 void TypeChecker::visit(Location *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    IRVisitor::visit(node);
     if (node->is_array_ref()) {
-        bish_assert(node->variable->type().array()) <<
+        check(unifier.unify(var(node->variable), unifier.array_of(var(node)))) <<
             "Invalid use of array reference on non-array variable";
-        node->set_type(node->variable->type().element());
     } else {
-        node->set_type(node->variable->type());
+        check(unifier.unify(var(node), var(node->variable))) <<
+            "Invalid type for variable " << node->variable->name.str();
     }
 }
 
 void TypeChecker::visit(ReturnStatement *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    IRVisitor::visit(node);
     if (node->value == NULL) return;
-    node->value->accept(this);
-    node->set_type(node->value->type());
+    unifier.unify(var(node), var(node->value));
     // Propagate type of this return statement to the parent function.
-    Function *f = dynamic_cast<Function*>(node->parent()->parent());
-    assert(f);
-    if (f->type().defined()) {
-        bish_assert(f->type() == node->value->type()) <<
-            "Invalid return type for function " << node->debug_info();
-    } else {
-        f->set_type(node->value->type());
-    }
+    assert(function);
+    check(unifier.unify(var(function), var(node->value))) <<
+        "Invalid return type for function " << node->debug_info();
 }
 
 void TypeChecker::visit(ForLoop *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-
-    node->variable->accept(this);
-    node->lower->accept(this);
-    if (node->upper) node->upper->accept(this);
-
+    IRVisitor::visit(node);
     if (node->upper) {
-        bish_assert(node->lower->type() == node->upper->type()) <<
+        check(unifier.unify(var(node->lower), var(node->upper))) <<
             "Type mismatch for lower and upper loop bounds " << node->debug_info();
+        check(unifier.unify(var(node->variable), var(node->lower))) <<
+            "Invalid type for loop variable " << node->debug_info();
+    } else {
+        for_each_loops.push_back(node);
     }
+}
 
-    Type ty = node->lower->type().array() ? node->lower->type().element() : node->lower->type();
-    node->variable->set_type(ty);
-
-    node->body->accept(this);
+// Loop over each element of an array, or over a single value. Solving
+// one loop can tell us the type of another loop's bound, so keep going
+// until nothing changes.
+void TypeChecker::solve_for_each_loops() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        unsigned remaining = 0;
+        for (unsigned i = 0; i < for_each_loops.size(); i++) {
+            ForLoop *node = for_each_loops[i];
+            Var lower = var(node->lower);
+            if (!unifier.known(lower)) {
+                for_each_loops[remaining++] = node;
+                continue;
+            }
+            Var ty = lower;
+            if (unifier.array(lower)) {
+                ty = unifier.fresh();
+                unifier.unify(lower, unifier.array_of(ty));
+            }
+            check(unifier.unify(var(node->variable), ty)) <<
+                "Invalid type for loop variable " << node->debug_info();
+            changed = true;
+        }
+        for_each_loops.resize(remaining);
+    }
 }
 
 void TypeChecker::visit(FunctionCall *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-    unsigned i = 0;
-    bish_assert(node->function->name != module->main->name) <<
+    check(module == NULL || module->main == NULL || node->function->name != module->main->name) <<
         "Cannot call default 'main' function directly " << node->debug_info();
-    bish_assert(node->function->body != NULL) <<
+    check(node->function->body != NULL) <<
         "Calling an undefined function " << node->debug_info();
-    for (std::vector<Assignment *>::const_iterator I = node->args.begin(),
-             E = node->args.end(); I != E; ++I, ++i) {
-        (*I)->accept(this);
-        if (node->function->args[i]->type().defined()) {
-            bish_assert((*I)->type() == node->function->args[i]->type()) <<
-                "Invalid argument type for function call " << node->debug_info();
-        } else {
-            node->function->args[i]->set_type((*I)->type());
+    bool arity = node->args.size() == node->function->args.size();
+    check(arity) << "Wrong number of arguments for function call " << node->debug_info();
+    IRVisitor::visit(node);
+    if (!arity) return;
+    bool matched = true;
+    for (unsigned i = 0; i < node->args.size(); i++) {
+        if (unifier.unify(var(node->args[i]), var(node->function->args[i]))) continue;
+        // A probe records the call instead, since it may be fixed by
+        // calling a different function.
+        if (!probe) check(false) << "Invalid argument type for function call " << node->debug_info();
+        matched = false;
+    }
+    if (!matched) {
+        CallMismatch m;
+        m.call = node;
+        for (unsigned i = 0; i < node->args.size(); i++) {
+            m.args.push_back(unifier.resolve(var(node->args[i])));
         }
+        mismatches.push_back(m);
+        // Leave the value of the call unknown rather than letting the
+        // mismatch spread.
+        return;
     }
-    node->function->accept(this);
-    node->set_type(node->function->type());
+    unifier.unify(var(node), var(node->function));
 }
 
 void TypeChecker::visit(ExternCall *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-    node->set_type(Type::Undef());
+    IRVisitor::visit(node);
+    var(node);
 }
 
 void TypeChecker::visit(IORedirection *node) {
-    if (node->type().defined()) return;
-    node->a->accept(this);
-    node->b->accept(this);
-    node->set_type(Type::Undef());
+    IRVisitor::visit(node);
+    var(node);
 }
 
 void TypeChecker::visit(Assignment *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-    node->location->accept(this);
-    Type ty = Type::Undef();
+    IRVisitor::visit(node);
+    Var ty = unifier.fresh();
     for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
              E = node->values.end(); I != E; ++I) {
-        (*I)->accept(this);
-        if (ty.defined()) {
-            bish_assert((*I)->type() == ty) <<
-                "Mixed types in array assignment " << node->debug_info();
-        } else {
-            ty = (*I)->type();
-        }
+        check(unifier.unify(ty, var(*I))) <<
+            "Mixed types in array assignment " << node->debug_info();
     }
-    Location *loc = node->location;
-    bool array_initialization = node->values.size() > 1;
-    Type dest_ty = loc->is_array_ref() && loc->variable->type().defined() ? loc->variable->type().element() : loc->variable->type();
-    Type array_ty = Type::Array(ty);
-    if (dest_ty.defined() && ty.defined()) {
-        if (array_initialization) {
-            bish_assert(dest_ty == array_ty) <<
-                "Invalid type in array assignment " << node->debug_info();
-        } else {
-            bish_assert(dest_ty == ty) <<
-                "Invalid type in assignment " << node->debug_info();
-        }
+    Var dest = var(node->location);
+    if (node->values.size() > 1) {
+        check(unifier.unify(dest, unifier.array_of(ty))) <<
+            "Invalid type in array assignment " << node->debug_info();
     } else {
-        if (loc->variable->type().undef()) {
-            loc->variable->set_type(array_initialization ? array_ty : ty);
-        } else {
-            dest_ty = loc->is_array_ref() ? loc->variable->type().element() : loc->variable->type();
-            if (array_initialization) {
-                bish_assert(dest_ty == array_ty) <<
-                    "Invalid type in reassignment " << node->debug_info();
-            } else {
-                bish_assert(dest_ty == ty) <<
-                    "Invalid type in reassignment " << node->debug_info() <<
-                    "\nexpected " << dest_ty.str() << " got " << ty.str();
-            }
+        // A failed unification leaves both types as they were, so
+        // they are only formatted for the error.
+        if (!unifier.unify(dest, ty)) {
+            check(false) << "Invalid type in assignment " << node->debug_info() <<
+                "\nexpected " << unifier.str(dest) << " got " << unifier.str(ty);
         }
     }
-    if (loc->type().undef()) {
-        loc->set_type(loc->is_array_ref() ? loc->variable->type().element() : loc->variable->type());
-    }
-    node->set_type(loc->type());
+    unifier.unify(var(node), dest);
 }
 
 void TypeChecker::visit(BinOp *node) {
-    if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-    node->a->accept(this);
-    node->b->accept(this);
-    propagate_if_undef(node->a, node->b);
-    bish_assert(node->a->type() == node->b->type()) <<
+    IRVisitor::visit(node);
+    check(unifier.unify(var(node->a), var(node->b))) <<
         "Invalid operand types for binary operator " << node->debug_info();
     switch (node->op) {
     case BinOp::Eq:
@@ -163,45 +211,35 @@ void TypeChecker::visit(BinOp *node) {
     case BinOp::GTE:
     case BinOp::And:
     case BinOp::Or:
-        node->set_type(Type::Boolean());
+        unifier.unify(var(node), unifier.constant(Type::Boolean()));
         break;
     case BinOp::Add:
     case BinOp::Sub:
     case BinOp::Mul:
     case BinOp::Div:
     case BinOp::Mod:
-        node->set_type(node->a->type());
+        unifier.unify(var(node), var(node->a));
         break;
     }
 }
 
 void TypeChecker::visit(UnaryOp *node) {
-    if (visited(node)) return;
-    visited_set.insert(node);
-    node->a->accept(this);
-    node->set_type(node->a->type());
+    IRVisitor::visit(node);
+    unifier.unify(var(node), var(node->a));
 }
 
 void TypeChecker::visit(Integer *node) {
-    node->set_type(Type::Integer());
+    unifier.unify(var(node), unifier.constant(Type::Integer()));
 }
 
 void TypeChecker::visit(Fractional *node) {
-    node->set_type(Type::Fractional());
+    unifier.unify(var(node), unifier.constant(Type::Fractional()));
 }
 
 void TypeChecker::visit(String *node) {
-    node->set_type(Type::String());
+    unifier.unify(var(node), unifier.constant(Type::String()));
 }
 
 void TypeChecker::visit(Boolean *node) {
-    node->set_type(Type::Boolean());
-}
-
-void TypeChecker::propagate_if_undef(IRNode *a, IRNode *b) {
-    if (a->type().undef()) {
-        a->set_type(b->type());
-    } else if (b->type().undef()) {
-        b->set_type(a->type());
-    }
+    unifier.unify(var(node), unifier.constant(Type::Boolean()));
 }
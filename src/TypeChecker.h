@@ -1,14 +1,53 @@
 #ifndef __BISH_TYPE_CHECKER_H__
 #define __BISH_TYPE_CHECKER_H__
 
-#include <set>
+#include <unordered_map>
+#include <vector>
+#include "Errors.h"
 #include "IRVisitor.h"
+#include "TypeUnifier.h"
 
 namespace Bish {
 
+/* Infers the types of every node in a module. Each node gets a type
+ * variable, and one walk over the module (visiting callees before
+ * their callers) generates constraints between them, which are solved
+ * by unification as they are generated. Calls unify arguments with
+ * the parameters of the callee and the call with its return value, so
+ * types flow both ways between callers and callees regardless of the
+ * order functions appear in, including through recursion. Constraints
+ * that depend on the shape of a type (for loops over a value that may
+ * or may not be an array) are kept on a worklist and retried until no
+ * more can be solved.
+ *
+ * All types are written back to the nodes once the module has been
+ * solved; anything left unconstrained (e.g. the output of external
+ * commands) stays Undef.
+ *
+ * A checker created in probe mode reports nothing and changes no
+ * types: it only records which calls had arguments that didn't match
+ * their callee, and whether checking failed in any other way.
+ */
 class TypeChecker : public IRVisitor {
 public:
+    // A call whose arguments didn't match the callee's parameters,
+    // with the argument types at that point.
+    struct CallMismatch {
+        FunctionCall *call;
+        std::vector<Type> args;
+    };
+
+    TypeChecker(bool probe=false) : probe(probe), errors(0), module(NULL), function(NULL) {}
+    // In probe mode, check f on its own, as if its parameters had the
+    // given types.
+    bool check_function(Function *f, const std::vector<Type> &args);
+    // The types currently inferred for f's parameters.
+    std::vector<Type> parameter_types(Function *f);
+    const std::vector<CallMismatch> &call_mismatches() const { return mismatches; }
+    bool failed() const { return errors != 0; }
+
     virtual void visit(Module *);
+    virtual void visit(Function *);
     virtual void visit(Location *);
     virtual void visit(ReturnStatement *);
     virtual void visit(ForLoop *);
@@ -23,10 +62,22 @@ public:
     virtual void visit(String *);
     virtual void visit(Boolean *);
 private:
+    typedef TypeUnifier::Var Var;
+    bool probe;
+    unsigned errors;
+    std::vector<CallMismatch> mismatches;
     Module *module;
-    std::set<IRNode *> visited_set;
-    void propagate_if_undef(IRNode *a, IRNode *b);
-    bool visited(IRNode *n) { return visited_set.find(n) != visited_set.end(); }
+    Function *function;
+    TypeUnifier unifier;
+    // Type variable of each node, in order of creation.
+    std::unordered_map<IRNode *, Var> vars;
+    std::vector<IRNode *> typed;
+    // For loops without an upper bound, whose variable type depends
+    // on whether the lower bound is an array.
+    std::vector<ForLoop *> for_each_loops;
+    Var var(IRNode *n);
+    ErrorReport check(bool ok);
+    void solve_for_each_loops();
 };
 
 }
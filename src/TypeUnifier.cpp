@@ -0,0 +1,133 @@
+#include <cassert>
+#include <utility>
+#include "TypeUnifier.h"
+
+using namespace Bish;
+
+TypeUnifier::Var TypeUnifier::make(Kind kind, Var element) {
+    Node n;
+    n.parent = nodes.size();
+    n.rank = 0;
+    n.kind = kind;
+    n.element = element;
+    nodes.push_back(n);
+    return n.parent;
+}
+
+TypeUnifier::Var TypeUnifier::fresh() {
+    return make(Unknown);
+}
+
+TypeUnifier::Var TypeUnifier::constant(const Type &t) {
+    if (t.integer()) return make(IntegerTy);
+    if (t.fractional()) return make(FractionalTy);
+    if (t.string()) return make(StringTy);
+    if (t.boolean()) return make(BooleanTy);
+    if (t.array()) return array_of(constant(t.element()));
+    return fresh();
+}
+
+TypeUnifier::Var TypeUnifier::array_of(Var element) {
+    return make(ArrayTy, element);
+}
+
+TypeUnifier::Var TypeUnifier::find(Var v) {
+    Var root = v;
+    while (nodes[root].parent != root) root = nodes[root].parent;
+    while (nodes[v].parent != root) {
+        Var next = nodes[v].parent;
+        nodes[v].parent = root;
+        v = next;
+    }
+    return root;
+}
+
+// Return true if the root v appears in the type of the root in.
+bool TypeUnifier::occurs(Var v, Var in) {
+    while (true) {
+        if (v == in) return true;
+        if (nodes[in].kind != ArrayTy) return false;
+        in = find(nodes[in].element);
+    }
+}
+
+void TypeUnifier::link(Var from, Var to) {
+    nodes[from].parent = to;
+    if (nodes[from].rank == nodes[to].rank) nodes[to].rank++;
+}
+
+bool TypeUnifier::unify(Var a, Var b) {
+    // Unifying two arrays unifies their elements, so this walks down
+    // a single chain of element pairs. The classes of bound types are
+    // only merged once the whole chain has unified, so that a failed
+    // unification leaves both variables as they were.
+    bound_links.clear();
+    bool ok = true;
+    while (true) {
+        Var x = find(a), y = find(b);
+        if (x == y) break;
+        Kind kx = nodes[x].kind, ky = nodes[y].kind;
+        // The root keeps the more specific binding; otherwise union
+        // by rank.
+        if (kx == Unknown) {
+            ok = !occurs(x, y);
+            if (ok) link(x, y);
+            break;
+        } else if (ky == Unknown) {
+            ok = !occurs(y, x);
+            if (ok) link(y, x);
+            break;
+        } else if (kx != ky) {
+            ok = false;
+            break;
+        }
+        bound_links.push_back(std::make_pair(x, y));
+        if (kx != ArrayTy) break;
+        a = nodes[x].element;
+        b = nodes[y].element;
+    }
+    if (!ok) return false;
+    for (std::vector<std::pair<Var, Var> >::iterator I = bound_links.begin(),
+             E = bound_links.end(); I != E; ++I) {
+        Var x = find(I->first), y = find(I->second);
+        if (x == y) continue;
+        if (nodes[x].rank < nodes[y].rank) {
+            link(x, y);
+        } else {
+            link(y, x);
+        }
+    }
+    return true;
+}
+
+bool TypeUnifier::known(Var v) {
+    return nodes[find(v)].kind != Unknown;
+}
+
+bool TypeUnifier::array(Var v) {
+    return nodes[find(v)].kind == ArrayTy;
+}
+
+Type TypeUnifier::resolve(Var v) {
+    Node &n = nodes[find(v)];
+    switch (n.kind) {
+    case Unknown:
+        return Type::Undef();
+    case IntegerTy:
+        return Type::Integer();
+    case FractionalTy:
+        return Type::Fractional();
+    case StringTy:
+        return Type::String();
+    case BooleanTy:
+        return Type::Boolean();
+    case ArrayTy:
+        return Type::Array(resolve(n.element));
+    }
+    assert(false && "Unknown type kind.");
+    return Type::Undef();
+}
+
+std::string TypeUnifier::str(Var v) {
+    return resolve(v).str();
+}
@@ -0,0 +1,65 @@
+#ifndef __BISH_TYPE_UNIFIER_H__
+#define __BISH_TYPE_UNIFIER_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "Type.h"
+
+namespace Bish {
+
+/* Type variables and their unification, using union-find with path
+ * compression. Each variable is either unknown, a primitive type, or
+ * an array of another variable. Unifying two variables merges their
+ * classes, so a sequence of unifications costs nearly linear time.
+ *
+ * Example:
+ *     TypeUnifier u;
+ *     TypeUnifier::Var a = u.fresh(), b = u.fresh();
+ *     u.unify(a, u.constant(Type::Integer()));
+ *     u.unify(u.array_of(a), b);
+ *     u.resolve(b); // array of int
+ */
+class TypeUnifier {
+public:
+    typedef unsigned Var;
+
+    // Return a new, unknown type variable.
+    Var fresh();
+    // Return a type variable bound to the given type. Undefined parts
+    // of the type become fresh variables.
+    Var constant(const Type &t);
+    // Return a type variable bound to an array of the given element.
+    Var array_of(Var element);
+    // Make a and b the same type. Returns false, leaving both
+    // unchanged, if they have incompatible types.
+    bool unify(Var a, Var b);
+    // Return true if v is bound to a type (which may be an array of
+    // an unknown type).
+    bool known(Var v);
+    bool array(Var v);
+    // Return the type currently bound to v, with unknown parts Undef.
+    Type resolve(Var v);
+    std::string str(Var v);
+private:
+    typedef enum {
+        Unknown, IntegerTy, FractionalTy, StringTy, BooleanTy, ArrayTy
+    } Kind;
+    struct Node {
+        Var parent;
+        unsigned rank;
+        Kind kind;
+        Var element;
+    };
+    std::vector<Node> nodes;
+    // Pairs of bound classes to merge at the end of unify().
+    std::vector<std::pair<Var, Var> > bound_links;
+    Var make(Kind kind, Var element=0);
+    Var find(Var v);
+    bool occurs(Var v, Var in);
+    void link(Var from, Var to);
+};
+
+}
+
+#endif
@@ -1,11 +1,18 @@
 #include <fstream>
 #include <sys/stat.h>
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
 #include "Errors.h"
 #include "Config.h"
 #include "Util.h"
 
+std::string hex_string(uint64_t v) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+}
+
 bool is_file(const std::string &path) {
     struct stat info;
     int rc = stat(path.c_str(), &info);
@@ -79,14 +86,29 @@ std::string module_name_from_path(const std::string &path) {
     return remove_suffix(basename(path), ".bish");
 }
 
-// Return the given line number from the given file.
-std::string read_line_from_file(const std::string &path, unsigned lineno) {
+// Read the given line number from the given file into 'line'. Returns
+// false if the file has no such line or can't be read.
+bool read_line_from_file(const std::string &path, unsigned lineno, std::string &line) {
     std::ifstream t(path.c_str());
-    if (!is_file(path) || !t.is_open()) {
-        bish_abort() << "Failed to open file at " << path;
-    }
-    std::string line;
+    if (lineno == 0 || !is_file(path) || !t.is_open()) return false;
     while (std::getline(t, line) && --lineno > 0) ;
-    bish_assert(lineno == 0) << "Failed to read line " << lineno << " from file " << path;
-    return line;
+    return lineno == 0;
+}
+
+std::string json_string(const std::string &s) {
+    std::string result = "\"";
+    for (std::string::const_iterator I = s.begin(), E = s.end(); I != E; ++I) {
+        char c = *I;
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
 }
@@ -1,28 +1,37 @@
 #ifndef __BISH_UTIL_H__
 #define __BISH_UTIL_H__
 
+#include <charconv>
 #include <limits.h>
+#include <stdint.h>
 #include <string>
 #include <sstream>
 #include <vector>
 
-// Convert the given string to the template type.
+// Parse a number of the template type from the given string into
+// 't'. Returns false if the string isn't a number in the type's
+// range, or has anything after the number.
 template <typename T>
-inline T convert_string(const std::string &s) {
-    T t;
-    std::istringstream(s) >> t;
-    return t;
+inline bool parse_number(const std::string &s, T &t) {
+    const char *end = s.data() + s.size();
+    std::from_chars_result r = std::from_chars(s.data(), end, t);
+    return r.ec == std::errc() && r.ptr == end;
 }
 
 // Convert int to string
 inline std::string as_string(int i) {
-  return dynamic_cast<std::ostringstream &>((std::ostringstream() << i )).str();
+  std::ostringstream s;
+  s << i;
+  return s.str();
 }
 
 inline std::string as_string(const std::string &s) {
   return s;
 }
 
+// Return the given value as 16 hex digits.
+std::string hex_string(uint64_t v);
+
 // Return true if the given path is a valid file.
 bool is_file(const std::string &path);
 // Return the absolute path to the standard library.
@@ -41,6 +50,9 @@ std::string strip(const std::string &s);
 // Return the name of a module from a pathname.
 // E.g. module_name_from_path("/a/b/test.bish") returns "test"
 std::string module_name_from_path(const std::string &path);
-// Return the given line number from the given file.
-std::string read_line_from_file(const std::string &path, unsigned lineno);
+// Read the given line number from the given file into 'line'. Returns
+// false if the file has no such line or can't be read.
+bool read_line_from_file(const std::string &path, unsigned lineno, std::string &line);
+// Return the string as a quoted JSON string.
+std::string json_string(const std::string &s);
 #endif
@@ -1,29 +1,68 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
 #include <sstream>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <set>
 #include <string>
 #include <iostream>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <map>
+#include <memory>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "Compile.h"
-#include "Parser.h"
+#include "CompilerInstance.h"
+#include "FileWatcher.h"
+#include "ModuleCache.h"
 #include "CodeGen.h"
+#include "PassManager.h"
+#include "ThreadPool.h"
+#include "TimeReport.h"
+#include "Util.h"
 
-int run_on(const std::string &sh, std::istream &is, const std::string &args) {
+// Count allocations for --time-report. Counting is only switched on
+// with the report, before any compiler threads start, so a normal
+// compile pays one untaken branch per allocation.
+static bool counting_allocations = false;
+static std::atomic<uint64_t> allocation_count(0), allocation_bytes(0);
+
+void *operator new(std::size_t n) {
+    if (counting_allocations) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    void *p = malloc(n ? n : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    free(p);
+}
+
+static void count_allocations(uint64_t &count, uint64_t &bytes) {
+    count = allocation_count.load(std::memory_order_relaxed);
+    bytes = allocation_bytes.load(std::memory_order_relaxed);
+}
+
+int run_on(const std::string &sh, const Bish::OutputBuffer &script, const std::string &args) {
     // Must pass the -s parameter to bash to set the positional
     // parameters to 'args'.  The '--' disables any of the arguments
     // from being treated as arguments to the shell.
     std::string cmd = sh + " -s -- " + args;
     FILE *shell = popen(cmd.c_str(), "w");
-    char buf[4096];
-
-    do {
-        is.read(buf, sizeof(buf));
-        fwrite(buf, 1, is.gcount(), shell);
-    } while (is.gcount() > 0);
-
-    fflush(shell);
+    script.write_to(fileno(shell));
 
     // pclose returns the exit status of the process,
     // but shifted to the left by 8 bits.
@@ -31,16 +70,288 @@ int run_on(const std::string &sh, std::istream &is, const std::string &args) {
     return e;
 }
 
+// Settings shared by every script compiled in one run.
+struct CompileSettings {
+    std::string pipeline;
+    std::string code_generator_name;
+    Bish::ModuleCache *cache;
+    // Write a make-style dependency file next to each output.
+    bool deps;
+    // Threads to spread the functions of each script over.
+    unsigned jobs;
+    Bish::CodeGenOptions cg_options;
+};
+
+// Escape a path for use in a makefile rule.
+std::string make_escape(const std::string &path) {
+    std::string result;
+    for (unsigned i = 0; i < path.size(); i++) {
+        if (path[i] == ' ' || path[i] == '#') result += '\\';
+        if (path[i] == '$') result += '$';
+        result += path[i];
+    }
+    return result;
+}
+
+// Write a make rule saying that output depends on the given script and
+// every module it linked in, to <OUTPUT>.d (replacing the output's
+// extension, if any). Like gcc's -MP, every module also gets an empty
+// rule so that make doesn't fail once one is deleted.
+bool write_dep_file(const std::string &output, const std::string &input,
+                    const std::set<std::string> &deps) {
+    std::string name = basename(output);
+    std::string path = output;
+    if (name.find('.') != std::string::npos) path = remove_suffix(output, ".");
+    path += ".d";
+    std::ofstream out(path.c_str());
+    out << make_escape(output) << ": " << make_escape(input);
+    for (std::set<std::string>::const_iterator I = deps.begin(), E = deps.end(); I != E; ++I) {
+        out << " \\\n  " << make_escape(*I);
+    }
+    out << "\n";
+    for (std::set<std::string>::const_iterator I = deps.begin(), E = deps.end(); I != E; ++I) {
+        out << "\n" << make_escape(*I) << ":\n";
+    }
+    out.close();
+    if (!out) std::cerr << "Unable to write " << path << std::endl;
+    return (bool)out;
+}
+
+// Compile the script at the given path, or standard input for "-",
+// printing any errors. Returns false if it can't be compiled.
+bool compile_script(Bish::CompilerInstance &ci, const std::string &input,
+                    const CompileSettings &settings) {
+    ci.set_passes(settings.pipeline);
+    ci.set_code_generator(settings.code_generator_name);
+    ci.set_module_cache(settings.cache);
+    ci.set_jobs(settings.jobs);
+    ci.set_code_gen_options(settings.cg_options);
+    bool ok;
+    if (input == "-") {
+        std::stringstream buffer;
+        buffer << std::cin.rdbuf();
+        ok = ci.compile_string(buffer.str(), "stdin.bish");
+    } else {
+        ok = ci.compile_file(input);
+    }
+    const std::vector<Bish::Diagnostic> &diags = ci.diagnostics();
+    for (unsigned i = 0; i < diags.size(); i++) {
+        std::cerr << "Bish error: " << diags[i].message << std::endl;
+    }
+    return ok;
+}
+
+bool write_file(const std::string &path, const Bish::OutputBuffer &contents) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = fd >= 0 && contents.write_to(fd);
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (!ok) std::cerr << "Unable to write " << path << std::endl;
+    return ok;
+}
+
+// Write the files generated along with the script, creating their
+// directories. Those directories only hold generated files, so files
+// left in them by an earlier compile are removed.
+bool write_extra_output(const std::vector<Bish::OutputFile> &files, const std::string &output) {
+    std::map<std::string, std::set<std::string> > dirs;
+    for (unsigned i = 0; i < files.size(); i++) {
+        const std::string &path = files[i].path;
+        if (path.find('/') == std::string::npos) continue;
+        dirs[dirname(path)].insert(basename(path));
+    }
+    const std::string base = dirname(output) + "/";
+    for (std::map<std::string, std::set<std::string> >::iterator I = dirs.begin(),
+             E = dirs.end(); I != E; ++I) {
+        std::string dir = base + I->first;
+        if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cerr << "Unable to create " << dir << std::endl;
+            return false;
+        }
+        if (DIR *d = opendir(dir.c_str())) {
+            while (struct dirent *entry = readdir(d)) {
+                std::string name = entry->d_name;
+                if (name == "." || name == ".." || I->second.count(name)) continue;
+                unlink((dir + "/" + name).c_str());
+            }
+            closedir(d);
+        }
+    }
+    for (unsigned i = 0; i < files.size(); i++) {
+        if (!write_file(base + files[i].path, files[i].contents)) return false;
+    }
+    return true;
+}
+
+// Write the compiled script to the given file, along with the files
+// generated with it and its dependency file if asked to.
+bool write_output(const Bish::CompilerInstance &ci, const std::string &input,
+                  const std::string &output, const CompileSettings &settings) {
+    // The script refers to the other files, so write it last.
+    if (!write_extra_output(ci.extra_output(), output)) return false;
+    if (!write_file(output, ci.output_buffer())) return false;
+    return !settings.deps || write_dep_file(output, input, ci.dependencies());
+}
+
+// Compiles one script of a batch into its output file.
+class BatchJob {
+public:
+    BatchJob(const std::string &input, const std::string &output,
+             const CompileSettings *settings, std::atomic<unsigned> *failures) :
+        input(input), output(output), settings(settings), failures(failures) {}
+
+    void operator()() const {
+        Bish::CompilerInstance ci;
+        CompileSettings s = *settings;
+        if (!s.cg_options.source_map.empty()) s.cg_options.source_map = basename(output) + ".map";
+        if (!compile_script(ci, input, s) || !write_output(ci, input, output, s)) {
+            failures->fetch_add(1);
+        }
+    }
+private:
+    std::string input, output;
+    const CompileSettings *settings;
+    std::atomic<unsigned> *failures;
+};
+
+// Compile each input to <OUTDIR>/<NAME>.sh, in parallel. The scripts
+// share a cache of parsed modules (including the standard library),
+// but are otherwise compiled independently of each other, so the
+// output is the same as compiling them one at a time.
+int run_batch(const std::vector<std::string> &inputs, const std::string &outdir,
+              unsigned jobs, const CompileSettings &settings) {
+    std::vector<std::string> outputs;
+    std::set<std::string> seen;
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        std::string name = remove_suffix(basename(inputs[i]), ".");
+        if (!seen.insert(name).second) {
+            std::cerr << "More than one input named " << name << std::endl;
+            return 1;
+        }
+        outputs.push_back(outdir + "/" + name + ".sh");
+    }
+
+    std::atomic<unsigned> failures(0);
+    Bish::ThreadPool pool(jobs);
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        pool.submit(BatchJob(inputs[i], outputs[i], &settings, &failures));
+    }
+    pool.wait();
+    return failures.load() ? 1 : 0;
+}
+
+void print_time_report(const Bish::TimeReport &report, const std::string &format) {
+    if (format == "json") {
+        report.print_json(std::cerr);
+    } else {
+        report.print_table(std::cerr);
+    }
+}
+
+// How long to wait for more changes after a file changes, before
+// compiling again. Editors often write a file in several steps, and
+// saving all files in a project changes several at once.
+const unsigned WatchDebounceMs = 50;
+
+// Compile the script, then compile it again each time it or a module
+// it imports (including the standard library) changes, writing it to
+// output if given and running it if asked to. Only the changed
+// modules are parsed again; the rest come from the cache. Linking,
+// type inference and the other passes still run over the whole
+// script each time, so a rebuild only saves the parsing of the
+// unchanged modules.
+int run_watch(const std::string &input, const std::string &output, bool run,
+              const std::string &args, const CompileSettings &settings,
+              const std::string &time_report_format) {
+    Bish::FileWatcher watcher;
+    if (!watcher.supported()) {
+        std::cerr << "Watching files is not supported on this system.\n";
+        return 1;
+    }
+    std::set<std::string> watched;
+    watched.insert(input);
+    Bish::CompilerInstance ci;
+    for (;;) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Bish::TimeReport report;
+        if (!time_report_format.empty()) report.start();
+        bool ok = compile_script(ci, input, settings);
+        if (ok && !output.empty()) ok = write_output(ci, input, output, settings);
+        if (!time_report_format.empty()) {
+            report.stop();
+            print_time_report(report, time_report_format);
+        }
+        // A failed compile may not have reached every import, so keep
+        // watching the modules of the last good one.
+        if (ok) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << "Compiled " << input << " in " << (unsigned)elapsed.count() << " ms" << std::endl;
+            watched = ci.dependencies();
+            watched.insert(input);
+            if (run) run_on(settings.code_generator_name, ci.output_buffer(), args);
+        }
+        watcher.watch(watched);
+        std::set<std::string> changed = watcher.wait(WatchDebounceMs);
+        for (std::set<std::string>::iterator I = changed.begin(), E = changed.end(); I != E; ++I) {
+            settings.cache->invalidate(*I);
+        }
+    }
+}
+
+// The most threads -j may ask for.
+const unsigned MaxJobs = 256;
+
 void usage(char *argv0) {
-    std::cerr << "USAGE: " << argv0 << " [-r] <INPUT> [<args>]\n";
+    std::cerr << "USAGE: " << argv0 << " [-r] [-O<LEVEL>] [--passes=<LIST>] <INPUT> [<args>]\n";
+    std::cerr << "       " << argv0 << " --batch -o <OUTDIR> [-j <N>] <INPUT>...\n";
+    std::cerr << "       " << argv0 << " -w [-r] [-o <OUTPUT>] <INPUT> [<args>]\n";
     std::cerr << "  Compiles Bish file <INPUT> to bash. Specifying '-' for <INPUT>\n";
     std::cerr << "  reads from standard input.\n";
     std::cerr << "\nOPTIONS:\n";
     std::cerr << "  -h: Displays this help message.\n";
     std::cerr << "  -r: Compiles and runs the script.\n";
+    std::cerr << "  -o <OUTPUT>: write the compiled script to <OUTPUT>.\n";
     std::cerr << "  <ARGS>: With -r, passes <ARGS> as arguments to script.\n";
     std::cerr << "  -l: list all code generators.\n";
     std::cerr << "  -u <NAME>: use code generator <NAME>.\n";
+    std::cerr << "  -O<LEVEL>: optimization level, 0 to " << Bish::PassManager::MaxOptLevel
+              << " (default " << Bish::DefaultOptLevel << ").\n";
+    std::cerr << "  --passes=<LIST>: run the comma-separated list of passes instead.\n";
+    std::cerr << "  --list-passes: list all passes.\n";
+    std::cerr << "  --batch: compile each <INPUT> to <OUTDIR>/<NAME>.sh, in parallel.\n";
+    std::cerr << "  -o <OUTDIR>: with --batch, the directory to write to.\n";
+    std::cerr << "  -j <N>: the number of threads, 1 to " << MaxJobs << " (default: one per core).\n";
+    std::cerr << "    With --batch, scripts are compiled in parallel, otherwise the functions\n";
+    std::cerr << "    of the script.\n";
+    std::cerr << "  -w: watch <INPUT> and the modules it imports, and compile (and with\n";
+    std::cerr << "    -r, run) it again whenever one changes. Needs -o or -r.\n";
+    std::cerr << "  --cache-dir=<DIR>: keep parsed modules in <DIR>, and only parse\n";
+    std::cerr << "    modules again once their source changes.\n";
+    std::cerr << "  --deps: with -o or --batch, also write a make-style dependency\n";
+    std::cerr << "    file next to each output, named <NAME>.d.\n";
+    std::cerr << "  --autoload: with -o, write each function to its own file in the\n";
+    std::cerr << "    directory <OUTPUT>.chunks, loaded the first time it is called.\n";
+    std::cerr << "  --library: compile <INPUT> to a library of its functions, named\n";
+    std::cerr << "    <NAMESPACE>_<FUNCTION>, for scripts to source instead of running it.\n";
+    std::cerr << "  --link-external=<MODULE>: take the functions of the imported module\n";
+    std::cerr << "    <MODULE> from the library <MODULE>.sh (compiled with --library),\n";
+    std::cerr << "    sourced from $PATH or the current directory when the script runs.\n";
+    std::cerr << "  --source-map: with -o or --batch, also write <OUTPUT>.map, a JSON map\n";
+    std::cerr << "    from the lines of the compiled script to the Bish lines they came from.\n";
+    std::cerr << "  --minify: make the compiled script smaller and quicker for bash to\n";
+    std::cerr << "    parse, at the cost of readability.\n";
+    std::cerr << "  --time-report[=table|json]: print the time, allocations and memory\n";
+    std::cerr << "    used by each phase of compilation to stderr.\n";
+}
+
+void show_passes_list() {
+    const Bish::PassManager::PassMap &passes = Bish::PassManager::all();
+    for (Bish::PassManager::PassMap::const_iterator it = passes.begin();
+         it != passes.end(); ++it) {
+        std::cout << it->first << ": " << it->second.description << std::endl;
+    }
+    for (unsigned level = 0; level <= Bish::PassManager::MaxOptLevel; level++) {
+        std::cout << "-O" << level << ": " << Bish::PassManager::pipeline(level) << std::endl;
+    }
 }
 
 void show_generators_list() {
@@ -52,13 +363,44 @@ void show_generators_list() {
 }
 
 int main(int argc, char **argv) {
-    Bish::CodeGenerators::initialize();
+    enum { PassesOption = 256, ListPassesOption, TimeReportOption, BatchOption,
+           CacheDirOption, DepsOption, MinifyOption, AutoloadOption, LibraryOption,
+           LinkExternalOption, SourceMapOption };
+    static const struct option long_options[] = {
+        {"passes", required_argument, NULL, PassesOption},
+        {"list-passes", no_argument, NULL, ListPassesOption},
+        {"time-report", optional_argument, NULL, TimeReportOption},
+        {"batch", no_argument, NULL, BatchOption},
+        {"cache-dir", required_argument, NULL, CacheDirOption},
+        {"deps", no_argument, NULL, DepsOption},
+        {"minify", no_argument, NULL, MinifyOption},
+        {"autoload", no_argument, NULL, AutoloadOption},
+        {"library", no_argument, NULL, LibraryOption},
+        {"link-external", required_argument, NULL, LinkExternalOption},
+        {"source-map", no_argument, NULL, SourceMapOption},
+        {NULL, 0, NULL, 0}
+    };
 
     int c;
     bool run_after_compile = false;
     std::string code_generator_name = "bash";
+    unsigned opt_level = Bish::DefaultOptLevel;
+    std::string passes;
+    bool custom_passes = false;
+    std::string time_report_format;
+    bool batch = false;
+    std::string output;
+    std::string cache_dir;
+    bool deps = false;
+    bool minify = false;
+    bool autoload = false;
+    bool library = false;
+    std::set<std::string> external_libraries;
+    bool source_map = false;
+    bool watch = false;
+    unsigned jobs = Bish::ThreadPool::default_size();
 
-    while ((c = getopt(argc,argv, "hrlu:")) != -1) {
+    while ((c = getopt_long(argc, argv, "+hrwlu:O:o:j:", long_options, NULL)) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -66,12 +408,70 @@ int main(int argc, char **argv) {
         case 'r':
             run_after_compile = true;
             break;
+        case 'w':
+            watch = true;
+            break;
         case 'l':
             show_generators_list();
             return 1;
         case 'u':
             code_generator_name = std::string(optarg);
             break;
+        case 'O':
+            if (std::strlen(optarg) != 1 || optarg[0] < '0' ||
+                optarg[0] > '0' + (int)Bish::PassManager::MaxOptLevel) {
+                std::cerr << "Invalid optimization level " << optarg << std::endl;
+                return 1;
+            }
+            opt_level = optarg[0] - '0';
+            break;
+        case PassesOption:
+            passes = std::string(optarg);
+            custom_passes = true;
+            break;
+        case ListPassesOption:
+            show_passes_list();
+            return 0;
+        case 'o':
+            output = std::string(optarg);
+            break;
+        case 'j':
+            if (!parse_number(optarg, jobs) || jobs == 0 || jobs > MaxJobs) {
+                std::cerr << "Invalid number of threads " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case BatchOption:
+            batch = true;
+            break;
+        case CacheDirOption:
+            cache_dir = std::string(optarg);
+            break;
+        case DepsOption:
+            deps = true;
+            break;
+        case MinifyOption:
+            minify = true;
+            break;
+        case AutoloadOption:
+            autoload = true;
+            break;
+        case LibraryOption:
+            library = true;
+            break;
+        case LinkExternalOption:
+            external_libraries.insert(std::string(optarg));
+            break;
+        case SourceMapOption:
+            source_map = true;
+            break;
+        case TimeReportOption:
+            time_report_format = optarg ? std::string(optarg) : "table";
+            if (time_report_format != "table" && time_report_format != "json") {
+                std::cerr << "Unknown time report format " << time_report_format << std::endl;
+                return 1;
+            }
+            break;
         default:
             break;
         }
@@ -82,10 +482,74 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    std::string path(argv[optind]);
-    std::stringstream s;
-    Bish::Parser p;
-    Bish::Module *m = path.compare("-") == 0 ? p.parse(std::cin) : p.parse(path);
+    CompileSettings settings;
+    settings.pipeline = custom_passes ? passes : Bish::PassManager::pipeline(opt_level);
+    settings.code_generator_name = code_generator_name;
+    settings.deps = deps;
+    settings.jobs = jobs;
+    settings.cg_options.minify = minify;
+    settings.cg_options.library = library;
+    settings.cg_options.external_libraries = external_libraries;
+    Bish::PassManager pm;
+    if (!pm.add_pipeline(settings.pipeline)) {
+        std::cerr << "Unknown pass in " << passes << std::endl;
+        return 1;
+    }
+    if (Bish::CodeGenerators::get(code_generator_name) == NULL) {
+        std::cerr << "No code generator " << code_generator_name << std::endl;
+        return 1;
+    }
+    if (deps && output.empty()) {
+        std::cerr << "--deps needs an output file or directory (-o).\n";
+        return 1;
+    }
+    if (autoload) {
+        // The script finds the functions next to it, so it must be
+        // written to a file, and run from there.
+        if (output.empty() || batch || run_after_compile) {
+            std::cerr << "--autoload needs an output file (-o), and can't be used with -r or --batch.\n";
+            return 1;
+        }
+        settings.cg_options.autoload_dir = basename(output) + ".chunks";
+    }
+    if (library && (run_after_compile || autoload || !external_libraries.empty())) {
+        std::cerr << "--library can't be used with -r, --autoload or --link-external.\n";
+        return 1;
+    }
+    if (source_map) {
+        // Autoloaded functions aren't in the script, so have no lines
+        // in it to map.
+        if (output.empty() || autoload) {
+            std::cerr << "--source-map needs an output file (-o), and can't be used with --autoload.\n";
+            return 1;
+        }
+        settings.cg_options.source_map = basename(output) + ".map";
+    }
+    std::unique_ptr<Bish::ModuleCache> cache;
+    if (!cache_dir.empty() || batch || watch) cache.reset(new Bish::ModuleCache(cache_dir));
+    settings.cache = cache.get();
+
+    if (batch) {
+        if (output.empty() || run_after_compile || watch) {
+            usage(argv[0]);
+            return 1;
+        }
+        // Scripts are compiled on several threads at once, so there's
+        // no one tree of phases to report.
+        if (!time_report_format.empty()) {
+            std::cerr << "--time-report can't be used with --batch.\n";
+            return 1;
+        }
+        std::vector<std::string> inputs(argv + optind, argv + argc);
+        // The threads already have a script each.
+        settings.jobs = 1;
+        return run_batch(inputs, output, jobs, settings);
+    }
+
+    if (!time_report_format.empty()) {
+        counting_allocations = true;
+        Bish::TimeReport::set_allocation_counter(&count_allocations);
+    }
 
     std::string args;
     if (optind + 1 < argc) {
@@ -98,17 +562,31 @@ int main(int argc, char **argv) {
             args += " ";
         }
     }
-    
-    Bish::CodeGenerators::CodeGeneratorConstructor cg_constructor =
-        Bish::CodeGenerators::get(code_generator_name);
-    if (cg_constructor == NULL) {
-        std::cerr << "No code generator " << code_generator_name << std::endl;
-        return 1;
+
+    std::string path(argv[optind]);
+    if (watch) {
+        if (path == "-" || (output.empty() && !run_after_compile)) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_watch(path, output, run_after_compile, args, settings, time_report_format);
+    }
+
+    Bish::TimeReport report;
+    if (!time_report_format.empty()) report.start();
+    Bish::CompilerInstance ci;
+    if (!compile_script(ci, path, settings)) return 1;
+    if (!output.empty()) {
+        if (!write_output(ci, path, output, settings)) return 1;
+    } else if (!run_after_compile) {
+        ci.output_buffer().write_to(STDOUT_FILENO);
+    }
+    if (!time_report_format.empty()) {
+        report.stop();
+        print_time_report(report, time_report_format);
     }
-    Bish::CodeGenerator *cg = cg_constructor(run_after_compile ? s : std::cout);
-    Bish::compile(m, cg);
     if (run_after_compile) {
-        const int exit_status = run_on(code_generator_name, s, args);
+        const int exit_status = run_on(code_generator_name, ci.output_buffer(), args);
         exit(exit_status);
     }
 
@@ -0,0 +1,53 @@
+#include <cstdlib>
+#include <iostream>
+#include <sys/resource.h>
+#include "CodeGen.h"
+#include "Compile.h"
+#include "Parser.h"
+
+// Compiles the given scripts back to back in a single process and
+// fails if peak memory usage keeps growing once warmed up. Meant to be
+// run under a leak checker (see 'make test-memcheck').
+//
+// USAGE: CompileLoop <ITERATIONS> <INPUT>...
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "USAGE: " << argv[0] << " <ITERATIONS> <INPUT>...\n";
+        return 1;
+    }
+    const int iterations = std::atoi(argv[1]);
+    const int warmup = iterations / 10;
+    Bish::CodeGenerators::CodeGeneratorConstructor cg_constructor =
+        Bish::CodeGenerators::get("bash");
+
+    long warm_rss = 0;
+    for (int i = 0; i < iterations; i++) {
+        if (i == warmup) warm_rss = peak_rss_kb();
+        for (int j = 2; j < argc; j++) {
+            Bish::Parser p;
+            Bish::Module *m = p.parse(argv[j]);
+            Bish::OutputBuffer s;
+            Bish::CodeGenerator *cg = cg_constructor(s, Bish::CodeGenOptions());
+            Bish::compile(m, cg);
+            delete cg;
+            delete m;
+        }
+    }
+    long final_rss = peak_rss_kb();
+
+    std::cout << "Compiled " << iterations * (argc - 2) << " scripts, peak RSS "
+              << warm_rss << " KB after warm-up, " << final_rss << " KB at end.\n";
+    // Allow some slack for allocator noise.
+    if (final_rss > warm_rss + warm_rss / 10 + 1024) {
+        std::cerr << "Memory usage grew across compiles.\n";
+        return 1;
+    }
+    return 0;
+}
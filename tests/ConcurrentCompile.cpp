@@ -0,0 +1,104 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CompilerInstance.h"
+#include "ModuleCache.h"
+
+// Compiles the given scripts on many threads at once, each compile
+// with its own CompilerInstance, and fails if any output differs from
+// compiling the script alone. Half of the threads share a module
+// cache, and a third spread each compile over threads of its own too
+// (CompilerInstance::set_jobs). Scripts with errors are compiled too,
+// to check that errors come back as diagnostics on every thread. Meant
+// to be run under a race detector (see 'make test-concurrent').
+//
+// USAGE: ConcurrentCompile <THREADS> <ITERATIONS> <INPUT>...
+
+struct BadScript {
+    const char *text;
+    // Expected line of the diagnostic.
+    unsigned line;
+};
+
+static const BadScript bad_scripts[] = {
+    {"x = 1\ny = 2 + * 3\n", 2},
+    {"def f(a) {\n    return a\n}\nf(1, 2)\n", 4},
+    {"x = 1\nx = \"a\"\n", 2},
+    {"import no_such_module\n", 1},
+};
+static const unsigned num_bad_scripts = sizeof(bad_scripts) / sizeof(bad_scripts[0]);
+
+static std::atomic<unsigned> failures(0);
+
+static void fail(const std::string &msg) {
+    std::cerr << msg << std::endl;
+    failures.fetch_add(1);
+}
+
+static void compile_all(unsigned id, unsigned iterations, const std::vector<std::string> &inputs,
+                        const std::vector<std::string> &expected, Bish::ModuleCache *cache) {
+    const unsigned jobs = id % 3 == 2 ? 3 : 1;
+    for (unsigned i = 0; i < iterations; i++) {
+        for (unsigned j = 0; j < inputs.size(); j++) {
+            // Start each thread at a different script.
+            unsigned k = (j + id) % inputs.size();
+            Bish::CompilerInstance ci;
+            ci.set_module_cache(cache);
+            ci.set_jobs(jobs);
+            if (!ci.compile_file(inputs[k]) || ci.output() != expected[k]) {
+                fail("Concurrent compile of " + inputs[k] + " differs.");
+            }
+        }
+        for (unsigned j = 0; j < num_bad_scripts; j++) {
+            Bish::CompilerInstance ci;
+            ci.set_module_cache(cache);
+            ci.set_jobs(jobs);
+            if (ci.compile_string(bad_scripts[j].text, "bad.bish") ||
+                ci.diagnostics().size() != 1) {
+                fail(std::string("Expected one error compiling: ") + bad_scripts[j].text);
+            } else if (ci.diagnostics()[0].line != bad_scripts[j].line) {
+                fail("Wrong location for error: " + ci.diagnostics()[0].message +
+                     " at line " + std::to_string(ci.diagnostics()[0].line));
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::cerr << "USAGE: " << argv[0] << " <THREADS> <ITERATIONS> <INPUT>...\n";
+        return 1;
+    }
+    const unsigned num_threads = std::atoi(argv[1]);
+    const unsigned iterations = std::atoi(argv[2]);
+    std::vector<std::string> inputs(argv + 3, argv + argc);
+
+    std::vector<std::string> expected;
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        Bish::CompilerInstance ci;
+        if (!ci.compile_file(inputs[i])) {
+            std::cerr << "Failed to compile " << inputs[i] << ": "
+                      << ci.diagnostics()[0].message << std::endl;
+            return 1;
+        }
+        expected.push_back(ci.output());
+    }
+
+    Bish::ModuleCache cache;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread(compile_all, t, iterations, std::cref(inputs),
+                                      std::cref(expected), t % 2 ? &cache : NULL));
+    }
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads[t].join();
+    }
+
+    std::cout << "Compiled " << num_threads * iterations * (inputs.size() + num_bad_scripts)
+              << " scripts on " << num_threads << " threads, " << failures.load()
+              << " failures.\n";
+    return failures.load() ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "FlatIR.h"
+#include "IRCloner.h"
+#include "Parser.h"
+#include "StructuralHash.h"
+
+// Unit tests for the IR utilities that can't be observed from the
+// output of a compile: structural hashing, cloning, the Block mutation
+// methods, and reading back flat modules. Exits non-zero
+// if any check fails (see 'make test-ir').
+//
+// USAGE: IRTest
+
+using namespace Bish;
+
+static unsigned failures = 0;
+
+static void check(bool ok, const std::string &msg) {
+    if (ok) return;
+    std::cerr << "FAILED: " << msg << std::endl;
+    failures++;
+}
+
+// Modules parsed by the tests, deleted at exit.
+static std::vector<Module *> modules;
+
+static Module *parse(const std::string &text, const std::string &path) {
+    Parser p;
+    modules.push_back(p.parse_string(text, path));
+    return modules.back();
+}
+
+// Parse the given text as a module and return its function f.
+static Function *parse_f(const std::string &text, const std::string &path) {
+    return parse(text, path)->get_function(Name("f"));
+}
+
+static const char *base_f = "def f(a, b) {\n    c = a + 1\n    return c * b\n}\n";
+
+static void hash_tests() {
+    Function *f = parse_f(base_f, "one.bish");
+    // The same function in another module, with other variable names.
+    Function *same = parse_f("def f(x, y) {\n    z = x + 1\n    return z * y\n}\n", "two.bish");
+    check(structural_key(f) == structural_key(same), "identical functions in two modules hash equal");
+    check(structural_hash(f) == structural_hash(same), "identical functions have equal hashes");
+
+    Function *literal = parse_f("def f(a, b) {\n    c = a + 2\n    return c * b\n}\n", "three.bish");
+    check(structural_key(f) != structural_key(literal), "different literals hash differently");
+    Function *op = parse_f("def f(a, b) {\n    c = a - 1\n    return c * b\n}\n", "four.bish");
+    check(structural_key(f) != structural_key(op), "different operators hash differently");
+    Function *binding = parse_f("def f(a, b) {\n    c = b + 1\n    return c * a\n}\n", "five.bish");
+    check(structural_key(f) != structural_key(binding), "different variable bindings hash differently");
+
+    // Within one instance, expressions on different variables differ.
+    ReturnStatement *ret = dynamic_cast<ReturnStatement *>(f->body->nodes[1]);
+    Assignment *assign = dynamic_cast<Assignment *>(f->body->nodes[0]);
+    StructuralHash h;
+    check(h.key(assign->values[0]) != h.key(ret->value), "expressions in one function hash differently");
+}
+
+static void clone_tests() {
+    Module *m = parse(base_f, "clone.bish");
+    Function *f = m->get_function(Name("f"));
+    IRCloner cloner(m);
+    Function *g = cloner.clone_function(f, Name("g"));
+    check(g->body != f->body, "clone_function copies the body");
+    check(structural_key(g) == structural_key(f), "a cloned function hashes equal to its original");
+    IRNode *e = cloner.clone(f->body->nodes[0]);
+    check(structural_key(e) == structural_key(f->body->nodes[0]),
+          "a cloned statement hashes equal to its original");
+
+    // A recursive function's copy calls itself, so still hashes equal.
+    Module *r = parse("def f(n) {\n    if (n > 0) {\n        return f(n - 1)\n    }\n    return 0\n}\n",
+                      "recursive.bish");
+    Function *rf = r->get_function(Name("f"));
+    IRCloner rcloner(r);
+    check(structural_key(rcloner.clone_function(rf, Name("g"))) == structural_key(rf),
+          "a cloned recursive function hashes equal to its original");
+}
+
+static void mutation_tests() {
+    Module *m = parse("def g() {\n    return 1\n}\ndef f() {\n    g()\n    x = g()\n    y = 2\n}\n",
+                      "mutation.bish");
+    Function *f = m->get_function(Name("f")), *g = m->get_function(Name("g"));
+    Block *body = f->body;
+    check(g->call_sites.size() == 2, "calls are in their callee's call sites");
+
+    // Erasing a statement drops its calls, including nested ones.
+    body->erase(body->begin() + 1);
+    check(g->call_sites.size() == 1 && g->call_sites[0] == body->nodes[0],
+          "erase drops the erased statement's calls");
+
+    // Inserted statements get the block as their parent.
+    FunctionCall *call = m->own(new FunctionCall(g, IRDebugInfo()));
+    Block::iterator I = body->insert_before(body->begin() + 1, call);
+    check(*I == call && call->parent() == body, "insert_before sets the parent");
+    check(g->call_sites.size() == 2, "new calls are in their callee's call sites");
+    ReturnStatement *ret = m->own(new ReturnStatement(m->constants.integer(0), IRDebugInfo()));
+    body->push_back(ret);
+    check(body->nodes.back() == ret && ret->parent() == body, "push_back sets the parent");
+
+    // Replacing a statement drops its calls, but not calls moved into
+    // the replacement.
+    I = body->replace(body->begin() + 1, m->own(new ReturnStatement(NULL, IRDebugInfo())));
+    check((*I)->parent() == body, "replace sets the parent");
+    check(g->call_sites.size() == 1 && g->call_sites[0] != call,
+          "replace drops the replaced statement's calls");
+    FunctionCall *first = dynamic_cast<FunctionCall *>(body->nodes[0]);
+    Block *wrapper = m->own(new Block());
+    wrapper->push_back(first);
+    body->replace(body->begin(), wrapper);
+    check(wrapper->parent() == body && first->parent() == wrapper,
+          "replace sets the parents of moved statements");
+    check(g->call_sites.size() == 1 && g->call_sites[0] == first,
+          "replace keeps calls moved into the replacement");
+
+    // Redirected calls move between call-site lists.
+    first->set_function(f);
+    check(g->call_sites.empty() && f->call_sites.size() == 1, "set_function moves the call site");
+    body->erase(body->begin());
+    check(f->call_sites.empty(), "erase drops calls from nested blocks");
+
+    // A statement moved to another function takes its expressions and
+    // nested blocks along, while statements in those blocks keep
+    // their blocks as parents.
+    Module *n = parse("def f() {\n    y = 0\n}\ndef h(x) {\n    if (x > 0) {\n"
+                      "        if (x > 1) {\n            x = 2\n        }\n    }\n}\n",
+                      "move.bish");
+    Function *nf = n->get_function(Name("f")), *nh = n->get_function(Name("h"));
+    IfStatement *outer = dynamic_cast<IfStatement *>(nh->body->nodes[0]);
+    nh->body->erase(nh->body->begin());
+    nf->body->push_back(outer);
+    Block *then = dynamic_cast<Block *>(outer->pblock->body);
+    IfStatement *inner = dynamic_cast<IfStatement *>(then->nodes[0]);
+    check(outer->parent() == nf->body && outer->pblock->condition->parent() == nf->body,
+          "a moved statement's expressions get the new block as their parent");
+    check(then->parent() == nf && inner->pblock->body->parent() == nf,
+          "a moved statement's nested blocks get the new function as their parent");
+    check(inner->parent() == then, "statements in moved blocks keep their parents");
+}
+
+static std::string serialize(const FlatModule &flat) {
+    std::ostringstream os;
+    flat.write(os);
+    return os.str();
+}
+
+// Return true if the given flat module can be read back after writing
+// it.
+static bool reads_back(const FlatModule &flat) {
+    std::istringstream is(serialize(flat));
+    FlatModule *read = FlatModule::read(is);
+    delete read;
+    return read != NULL;
+}
+
+static void serialize_tests() {
+    Module *m = parse("def g(a) {\n    return a\n}\ndef f(x) {\n    if (x > 0) {\n        x = g(x)\n    }\n}\n",
+                      "serialize.bish");
+    FlatModule flat(m);
+    std::string bytes = serialize(flat);
+    check(serialize(FlatModule(m)) == bytes, "the same module is serialized the same way");
+    std::istringstream is(bytes);
+    FlatModule *read = FlatModule::read(is);
+    check(read && serialize(*read) == bytes, "a read module is serialized as it was written");
+    delete read;
+    check(reads_back(flat), "a flat module reads back");
+
+    // References, indices and ranges outside their tables are
+    // rejected.
+    FlatModule bad_range(m);
+    bad_range.blocks[0].nodes.begin = bad_range.children.size();
+    bad_range.blocks[0].nodes.size = 1;
+    check(!reads_back(bad_range), "a range past the end of the side table is rejected");
+    FlatModule bad_ref(m);
+    bad_ref.children[0] = FlatModule::make_ref(FlatModule::BinOpKind, bad_ref.binops.size());
+    check(!reads_back(bad_ref), "a reference past the end of its table is rejected");
+    FlatModule bad_kind(m);
+    bad_kind.global_variables = FlatModule::make_ref(FlatModule::IntegerKind, 0);
+    check(!reads_back(bad_kind), "a reference to a node of the wrong kind is rejected");
+    FlatModule bad_index(m);
+    bad_index.calls[0].function = bad_index.functions.size();
+    check(!reads_back(bad_index), "an index past the end of its table is rejected");
+}
+
+int main() {
+    hash_tests();
+    clone_tests();
+    mutation_tests();
+    serialize_tests();
+    for (unsigned i = 0; i < modules.size(); i++) {
+        delete modules[i];
+    }
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "IR tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Generate a bish module with N functions, large.bish, and a script
+# main.bish which imports it and calls every function, in the given
+# directory. Running main.bish prints the sum 0 + 1 + ... + (N - 1).
+#
+# USAGE: gen_large_module.sh <DIR> <N>
+
+dir=$1
+n=$2
+
+i=0
+while [ $i -lt $n ]; do
+    echo "def f$i(x) { return x + $i }"
+    i=$((i + 1))
+done > "$dir/large.bish"
+
+{
+    echo "import large"
+    echo "def run() {"
+    echo "    s = 0"
+    i=0
+    while [ $i -lt $n ]; do
+        echo "    s = large.f$i(s)"
+        i=$((i + 1))
+    done
+    echo "    println(s)"
+    echo "}"
+    echo "run()"
+} > "$dir/main.bish"
@@ -0,0 +1,323 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <sys/time.h>
+#include "FlatIR.h"
+#include "IR.h"
+#include "Parser.h"
+
+using namespace Bish;
+
+// Node and call-site totals from one walk over a module.
+struct WalkCounts {
+    unsigned nodes;
+    unsigned calls;
+    WalkCounts() : nodes(0), calls(0) {}
+};
+
+// Counts nodes and call sites with the pointer-based IR. Every visit
+// method is overridden without calling into IRVisitor, so the walk
+// keeps no visited set: like the flat walk below, it counts a node
+// shared between parents (e.g. a pooled constant) once per parent,
+// and doesn't count variables.
+class CountNodes : public IRVisitor {
+public:
+    WalkCounts counts;
+    void walk(IRNode *n) { if (n) n->accept(this); }
+    void visit(Block *n) {
+        counts.nodes++;
+        for (std::vector<IRNode *>::const_iterator I = n->nodes.begin(), E = n->nodes.end(); I != E; ++I) {
+            walk(*I);
+        }
+    }
+    void visit(Variable *n) {}
+    void visit(Location *n) { counts.nodes++; walk(n->offset); }
+    void visit(FunctionCall *n) {
+        counts.nodes++;
+        counts.calls++;
+        for (std::vector<Assignment *>::const_iterator I = n->args.begin(), E = n->args.end(); I != E; ++I) {
+            walk(*I);
+        }
+    }
+    void visit(ExternCall *n) { counts.nodes++; }
+    void visit(IORedirection *n) { counts.nodes++; walk(n->a); walk(n->b); }
+    void visit(IfStatement *n) {
+        counts.nodes++;
+        walk(n->pblock->condition);
+        walk(n->pblock->body);
+        for (std::vector<PredicatedBlock *>::const_iterator I = n->elses.begin(), E = n->elses.end(); I != E; ++I) {
+            walk((*I)->condition);
+            walk((*I)->body);
+        }
+        walk(n->elseblock);
+    }
+    void visit(ImportStatement *n) { counts.nodes++; }
+    void visit(ReturnStatement *n) { counts.nodes++; walk(n->value); }
+    void visit(LoopControlStatement *n) { counts.nodes++; }
+    void visit(ForLoop *n) { counts.nodes++; walk(n->lower); walk(n->upper); walk(n->body); }
+    void visit(Assignment *n) {
+        counts.nodes++;
+        walk(n->location);
+        for (std::vector<IRNode *>::const_iterator I = n->values.begin(), E = n->values.end(); I != E; ++I) {
+            walk(*I);
+        }
+    }
+    void visit(BinOp *n) { counts.nodes++; walk(n->a); walk(n->b); }
+    void visit(UnaryOp *n) { counts.nodes++; walk(n->a); }
+    void visit(Integer *n) { counts.nodes++; }
+    void visit(Fractional *n) { counts.nodes++; }
+    void visit(String *n) { counts.nodes++; }
+    void visit(Boolean *n) { counts.nodes++; }
+};
+
+static void count_pointer(Module *m, WalkCounts &c) {
+    CountNodes count;
+    count.walk(m->global_variables);
+    for (std::vector<Function *>::const_iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        count.walk((*I)->body);
+    }
+    c = count.counts;
+}
+
+// The same walk written against the flat representation, a recursive
+// walk over the node references.
+static void count_flat(const FlatModule &m, FlatRef r, WalkCounts &c) {
+    if (r == FlatNullRef) return;
+    FlatIndex i = FlatModule::index(r);
+    switch (FlatModule::kind(r)) {
+    case FlatModule::BlockKind: {
+        const FlatRange &nodes = m.blocks[i].nodes;
+        for (const FlatRef *I = m.range_begin(nodes), *E = m.range_end(nodes); I != E; ++I) {
+            count_flat(m, *I, c);
+        }
+        break;
+    }
+    case FlatModule::LocationKind:
+        count_flat(m, m.locations[i].offset, c);
+        break;
+    case FlatModule::AssignmentKind: {
+        count_flat(m, FlatModule::make_ref(FlatModule::LocationKind, m.assignments[i].location), c);
+        const FlatRange &values = m.assignments[i].values;
+        for (const FlatRef *I = m.range_begin(values), *E = m.range_end(values); I != E; ++I) {
+            count_flat(m, *I, c);
+        }
+        break;
+    }
+    case FlatModule::FunctionCallKind: {
+        c.calls++;
+        const FlatRange &args = m.calls[i].args;
+        for (const FlatRef *I = m.range_begin(args), *E = m.range_end(args); I != E; ++I) {
+            count_flat(m, *I, c);
+        }
+        break;
+    }
+    case FlatModule::IORedirectionKind:
+        count_flat(m, m.redirections[i].a, c);
+        count_flat(m, m.redirections[i].b, c);
+        break;
+    case FlatModule::BinOpKind:
+        count_flat(m, m.binops[i].a, c);
+        count_flat(m, m.binops[i].b, c);
+        break;
+    case FlatModule::UnaryOpKind:
+        count_flat(m, m.unaryops[i].a, c);
+        break;
+    case FlatModule::IfStatementKind: {
+        const FlatRange &clauses = m.ifs[i].clauses;
+        for (const FlatRef *I = m.range_begin(clauses), *E = m.range_end(clauses); I != E; ++I) {
+            count_flat(m, *I, c);
+        }
+        count_flat(m, m.ifs[i].elseblock, c);
+        break;
+    }
+    case FlatModule::ForLoopKind:
+        count_flat(m, m.loops[i].lower, c);
+        count_flat(m, m.loops[i].upper, c);
+        count_flat(m, m.loops[i].body, c);
+        break;
+    case FlatModule::ReturnStatementKind:
+        count_flat(m, m.returns[i].value, c);
+        break;
+    case FlatModule::VariableKind:
+        // Variables are shared symbols, not counted as tree nodes.
+        return;
+    default:
+        break;
+    }
+    c.nodes++;
+}
+
+static void count_flat(const FlatModule &m, WalkCounts &c) {
+    c = WalkCounts();
+    count_flat(m, m.global_variables, c);
+    for (std::vector<FlatFunction>::const_iterator I = m.functions.begin(), E = m.functions.end(); I != E; ++I) {
+        count_flat(m, I->body, c);
+    }
+}
+
+// Check that every function has as many call sites in the flat module
+// as in the pointer-based one.
+static bool same_callees(Module *m, const FlatModule &flat) {
+    std::vector<unsigned> counts = flat.call_site_counts();
+    std::map<Name, unsigned> flat_counts;
+    for (unsigned i = 0; i < flat.functions.size(); i++) {
+        flat_counts[flat.names[flat.functions[i].name]] = counts[i];
+    }
+    for (std::vector<Function *>::const_iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        if (flat_counts[(*I)->name] != (*I)->call_sites.size()) return false;
+    }
+    return true;
+}
+
+// Field-by-field comparison of the flat tables, for checking that a
+// round trip through the pointer-based IR loses nothing. These are
+// found by argument-dependent lookup, so they live in the Bish
+// namespace.
+namespace Bish {
+inline bool operator==(const FlatRange &a, const FlatRange &b) { return a.begin == b.begin && a.size == b.size; }
+inline bool operator==(const FlatNodeInfo &a, const FlatNodeInfo &b) { return a.type == b.type && a.debug == b.debug; }
+inline bool operator==(const FlatBlock &a, const FlatBlock &b) { return a.nodes == b.nodes; }
+inline bool operator==(const FlatVariable &a, const FlatVariable &b) {
+    return a.name == b.name && a.global == b.global && a.reference == b.reference;
+}
+inline bool operator==(const FlatLocation &a, const FlatLocation &b) {
+    return a.variable == b.variable && a.offset == b.offset;
+}
+inline bool operator==(const FlatFunction &a, const FlatFunction &b) {
+    return a.name == b.name && a.args == b.args && a.body == b.body;
+}
+inline bool operator==(const FlatFunctionCall &a, const FlatFunctionCall &b) {
+    return a.function == b.function && a.caller == b.caller && a.args == b.args;
+}
+inline bool operator==(const FlatExternCall &a, const FlatExternCall &b) { return a.body == b.body; }
+inline bool operator==(const FlatIORedirection &a, const FlatIORedirection &b) {
+    return a.op == b.op && a.a == b.a && a.b == b.b;
+}
+inline bool operator==(const FlatIfStatement &a, const FlatIfStatement &b) {
+    return a.clauses == b.clauses && a.elseblock == b.elseblock;
+}
+inline bool operator==(const FlatForLoop &a, const FlatForLoop &b) {
+    return a.variable == b.variable && a.lower == b.lower && a.upper == b.upper && a.body == b.body;
+}
+inline bool operator==(const FlatAssignment &a, const FlatAssignment &b) {
+    return a.location == b.location && a.values == b.values;
+}
+inline bool operator==(const FlatImportStatement &a, const FlatImportStatement &b) {
+    return a.module_name == b.module_name && a.path == b.path;
+}
+inline bool operator==(const FlatReturnStatement &a, const FlatReturnStatement &b) { return a.value == b.value; }
+inline bool operator==(const FlatLoopControlStatement &a, const FlatLoopControlStatement &b) { return a.op == b.op; }
+inline bool operator==(const FlatBinOp &a, const FlatBinOp &b) { return a.op == b.op && a.a == b.a && a.b == b.b; }
+inline bool operator==(const FlatUnaryOp &a, const FlatUnaryOp &b) { return a.op == b.op && a.a == b.a; }
+inline bool operator==(const FlatInteger &a, const FlatInteger &b) { return a.value == b.value; }
+inline bool operator==(const FlatFractional &a, const FlatFractional &b) { return a.value == b.value; }
+inline bool operator==(const FlatString &a, const FlatString &b) { return a.value == b.value; }
+inline bool operator==(const FlatBoolean &a, const FlatBoolean &b) { return a.value == b.value; }
+inline bool operator==(const FlatInterpItem &a, const FlatInterpItem &b) {
+    return a.is_var == b.is_var && a.value == b.value;
+}
+inline bool operator==(const IRDebugInfo &a, const IRDebugInfo &b) {
+    return a.file == b.file && a.start == b.start && a.end == b.end && a.lineno == b.lineno;
+}
+}
+
+static bool same_modules(const FlatModule &a, const FlatModule &b) {
+    for (unsigned k = 0; k < FlatModule::NumKinds; k++) {
+        if (a.info[k] != b.info[k]) return false;
+    }
+    return a.blocks == b.blocks && a.variables == b.variables && a.locations == b.locations &&
+        a.functions == b.functions && a.calls == b.calls && a.extern_calls == b.extern_calls &&
+        a.redirections == b.redirections && a.ifs == b.ifs && a.loops == b.loops &&
+        a.assignments == b.assignments && a.imports == b.imports && a.returns == b.returns &&
+        a.loop_controls == b.loop_controls && a.binops == b.binops && a.unaryops == b.unaryops &&
+        a.integers == b.integers && a.fractionals == b.fractionals &&
+        a.string_literals == b.string_literals && a.booleans == b.booleans &&
+        a.children == b.children && a.interps == b.interps && a.interp_items == b.interp_items &&
+        a.names == b.names && a.strings == b.strings && a.types == b.types &&
+        a.debug_infos == b.debug_infos && a.module_functions == b.module_functions &&
+        a.main == b.main && a.global_variables == b.global_variables;
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Return the text of a synthetic module with the given number of
+// functions, each calling its predecessor.
+static std::string synthetic_module(unsigned nfuncs) {
+    std::stringstream s;
+    for (unsigned i = 0; i < nfuncs; i++) {
+        s << "def f" << i << "(a, b) {\n";
+        s << "    x = a + b * 2 - 1\n";
+        s << "    y = 0\n";
+        s << "    if (x > 10) {\n";
+        if (i > 0) {
+            s << "        y = f" << i - 1 << "(x - 1, b)\n";
+        } else {
+            s << "        y = x\n";
+        }
+        s << "    } else {\n";
+        s << "        y = x * 3 + a % 7\n";
+        s << "    }\n";
+        s << "    for (j in 0 .. 4) {\n";
+        s << "        y = y + j * 2\n";
+        s << "    }\n";
+        s << "    return y\n";
+        s << "}\n";
+    }
+    s << "z = f" << nfuncs - 1 << "(1, 2)\n";
+    return s.str();
+}
+
+int main(int argc, char **argv) {
+    unsigned nfuncs = argc > 1 ? std::atoi(argv[1]) : 5000;
+    unsigned reps = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    Parser p;
+    Module *m = p.parse_string(synthetic_module(nfuncs), "synthetic.bish");
+
+    double t0 = now();
+    FlatModule flat(m);
+    double t_encode = now() - t0;
+
+    // Both walks must do the same work before their times mean
+    // anything.
+    WalkCounts ptr, flat_counts;
+    count_pointer(m, ptr);
+    count_flat(flat, flat_counts);
+    if (ptr.nodes != flat_counts.nodes || ptr.calls != flat_counts.calls || !same_callees(m, flat)) {
+        std::cerr << "walks disagree: pointer IR " << ptr.nodes << " nodes, " << ptr.calls
+                  << " calls; flat IR " << flat_counts.nodes << " nodes, " << flat_counts.calls << " calls\n";
+        return 1;
+    }
+
+    t0 = now();
+    for (unsigned r = 0; r < reps; r++) {
+        count_pointer(m, ptr);
+    }
+    double t_ptr = (now() - t0) / reps;
+
+    t0 = now();
+    for (unsigned r = 0; r < reps; r++) {
+        count_flat(flat, flat_counts);
+    }
+    double t_flat = (now() - t0) / reps;
+
+    // Round trip to make sure nothing is lost in the encoding.
+    Module *decoded = flat.to_module();
+    FlatModule reencoded(decoded);
+    bool ok = same_modules(flat, reencoded);
+
+    std::cout << "functions:          " << nfuncs << "\n";
+    std::cout << "flat nodes:         " << flat.size() << " (round trip " << (ok ? "identical" : "differs") << ")\n";
+    std::cout << "encode:             " << t_encode * 1e3 << " ms\n";
+    std::cout << "pointer IR pass:    " << t_ptr * 1e3 << " ms (" << ptr.nodes << " nodes, " << ptr.calls << " calls)\n";
+    std::cout << "flat IR pass:       " << t_flat * 1e3 << " ms (" << flat_counts.nodes << " nodes, " << flat_counts.calls << " calls)\n";
+    std::cout << "speedup:            " << t_ptr / t_flat << "x\n";
+
+    delete decoded;
+    delete m;
+    return ok ? 0 : 1;
+}
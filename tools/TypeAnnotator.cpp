@@ -1,5 +1,4 @@
 #include <set>
-#include <sstream>
 #include <iostream>
 #include <cassert>
 #include "CodeGen.h"
@@ -280,14 +279,13 @@ int main(int argc, char **argv) {
 
     Parser p;
     Module *m = p.parse(path);
-    std::stringstream s;
+    OutputBuffer s;
     // Don't actually care about the output, just need the compile
     // pipeline to run.
-    CodeGenerators::initialize();
     CodeGenerators::CodeGeneratorConstructor cg_constructor =
         CodeGenerators::get("bash");
     assert(cg_constructor);
-    compile(m, cg_constructor(s));
+    compile(m, cg_constructor(s, CodeGenOptions()));
 
     TypeAnnotator annotate(std::cout);
     m->accept(&annotate);
@@ -0,0 +1,105 @@
+#!/bin/sh
+# Benchmark --autoload on a tool script with N subcommands (400 by
+# default), each using its own helper functions, of which one run only
+# calls one. Compiles the tool normally and with --autoload, checks
+# that both print the same, then reports the mean time of R runs (20
+# by default) of one subcommand, the peak memory of bash during a run,
+# and the bytes of bash code it read.
+#
+# USAGE: autoload_bench.sh [<BISH>] [<N>] [<R>]
+
+bish=$(realpath "${1:-../bish}")
+n=${2:-400}
+runs=${3:-20}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+{
+    i=0
+    while [ $i -lt $n ]; do
+        echo "def scale$i(x) {"
+        echo "    if (x < 0) {"
+        echo "        return 0 - x * $((i + 1))"
+        echo "    } else if (x > 1000) {"
+        echo "        return 1000 * $((i + 1))"
+        echo "    }"
+        echo "    return x * $((i + 1))"
+        echo "}"
+        echo "def cmd$i(xs) {"
+        echo "    total = 0"
+        echo "    count = 0"
+        echo "    for (x in xs) {"
+        echo "        if (x > $((i % 3))) {"
+        echo "            total = total + scale$i(x)"
+        echo "            count = count + 1"
+        echo "        } else {"
+        echo "            total = total - 1"
+        echo "        }"
+        echo "    }"
+        echo "    if (count == 0) {"
+        echo "        return \"cmd$i: nothing\""
+        echo "    }"
+        echo "    return \"cmd$i: \$total from \$count\""
+        echo "}"
+        i=$((i + 1))
+    done
+    echo "def run(c) {"
+    echo "    xs = [1, 2, 3]"
+    echo "    if (c == \"cmd0\") {"
+    echo "        println(cmd0(xs))"
+    i=1
+    while [ $i -lt $n ]; do
+        echo "    } else if (c == \"cmd$i\") {"
+        echo "        println(cmd$i(xs))"
+        i=$((i + 1))
+    done
+    echo "    }"
+    echo "}"
+    echo "run(args[1])"
+} > "$dir/tool.bish"
+
+"$bish" -o "$dir/normal.sh" "$dir/tool.bish" || exit 1
+"$bish" --autoload -o "$dir/autoload.sh" "$dir/tool.bish" || exit 1
+cmd=cmd$((n / 2))
+[ "$(bash "$dir/normal.sh" $cmd)" = "$(bash "$dir/autoload.sh" $cmd)" ] || {
+    echo "Autoloaded script prints something else." >&2
+    exit 1
+}
+
+now() { date +%s.%N; }
+
+# Mean time in ms of R runs of the given script.
+time_runs() {
+    t0=$(now)
+    i=0
+    while [ $i -lt $runs ]; do
+        bash "$1" $cmd > /dev/null || exit 1
+        i=$((i + 1))
+    done
+    t1=$(now)
+    awk "BEGIN { printf \"%.1f\", ($t1 - $t0) * 1000 / $runs }"
+}
+
+# Peak resident memory of bash running the given script.
+peak_memory() {
+    bash -c '. "$0" "$1" > /dev/null; grep VmHWM /proc/$$/status' "$1" $cmd | awk '{ print $2 " " $3 }'
+}
+
+# Bytes of bash code read running the given script: the script, and
+# the chunks it sourced (found by tracing the run).
+code_read() {
+    size=$(wc -c < "$1")
+    for c in $(bash -x "$1" $cmd 2>&1 >/dev/null | grep -o 'chunks/[0-9]*\.sh' | sort -u); do
+        size=$((size + $(wc -c < "$1.$c")))
+    done
+    echo $size
+}
+
+echo "$n subcommands, running $cmd, mean of $runs runs:"
+printf "  %-10s %8s %8s %12s %10s\n" "" "files" "time ms" "peak memory" "bytes read"
+for f in normal autoload; do
+    files=1
+    [ -d "$dir/$f.sh.chunks" ] && files=$((files + $(ls "$dir/$f.sh.chunks" | wc -l)))
+    printf "  %-10s %8s %8s %12s %10s\n" "$f:" "$files" "$(time_runs "$dir/$f.sh")" \
+           "$(peak_memory "$dir/$f.sh")" "$(code_read "$dir/$f.sh")"
+done
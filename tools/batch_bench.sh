@@ -0,0 +1,73 @@
+#!/bin/sh
+# Benchmark 'bish --batch' against compiling one script per process.
+# Generates N scripts (500 by default) which each import a shared
+# module and call the standard library, compiles them serially, then
+# in one batch with 1 thread and with one thread per core, and checks
+# that all three give identical output.
+#
+# USAGE: batch_bench.sh [<BISH>] [<N>]
+
+bish=$(realpath "${1:-../bish}")
+n=${2:-500}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/src" "$dir/serial" "$dir/batch1" "$dir/batchN"
+{
+    echo "def clamp(x, lo, hi) {"
+    echo "    if (x < lo) {"
+    echo "        return lo"
+    echo "    }"
+    echo "    if (x > hi) {"
+    echo "        return hi"
+    echo "    }"
+    echo "    return x"
+    echo "}"
+    echo "def label(s, i) {"
+    echo "    return \"\$s-\$i\""
+    echo "}"
+} > "$dir/src/shared.bish"
+i=0
+while [ $i -lt $n ]; do
+    {
+        echo "import shared"
+        echo "def work$i(xs) {"
+        echo "    total = 0"
+        echo "    for (x in xs) {"
+        echo "        total = total + shared.clamp(x, 0, $i)"
+        echo "    }"
+        echo "    return total"
+        echo "}"
+        echo "def run() {"
+        echo "    xs = [$i, $((i + 1)), $((i * 2))]"
+        echo "    println(shared.label(\"script\", work$i(xs)))"
+        echo "    f = \"/tmp/bench$i\""
+        echo "    if (exists(f)) {"
+        echo "        println(len(xs))"
+        echo "    }"
+        echo "}"
+        echo "run()"
+    } > "$dir/src/s$i.bish"
+    i=$((i + 1))
+done
+
+now() { date +%s.%N; }
+elapsed() { awk "BEGIN { printf \"%.2f\", $2 - $1 }"; }
+
+cd "$dir/src"
+t0=$(now)
+for f in s*.bish; do "$bish" "$f" > "../serial/${f%.bish}.sh" || exit 1; done
+t1=$(now)
+"$bish" --batch -j 1 -o ../batch1 s*.bish || exit 1
+t2=$(now)
+"$bish" --batch -o ../batchN s*.bish || exit 1
+t3=$(now)
+
+diff -r ../serial ../batch1 > /dev/null && diff -r ../serial ../batchN > /dev/null || {
+    echo "Batch output differs from serial output." >&2
+    exit 1
+}
+echo "$n scripts:"
+printf "  %-28s %s s\n" "serial, one process each:" "$(elapsed $t0 $t1)"
+printf "  %-28s %s s\n" "--batch -j 1:" "$(elapsed $t1 $t2)"
+printf "  %-28s %s s\n" "--batch -j $(nproc):" "$(elapsed $t2 $t3)"
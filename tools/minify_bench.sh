@@ -0,0 +1,68 @@
+#!/bin/sh
+# Benchmark how long bash takes to parse a large compiled program, with
+# and without --minify. Generates a script with N functions (1000 by
+# default) calling each other, compiles it both ways, checks that both
+# print the same, then times R runs (20 by default) of 'bash -n' (parse
+# only) and of running each script.
+#
+# USAGE: minify_bench.sh [<BISH>] [<N>] [<R>]
+
+bish=$(realpath "${1:-../bish}")
+n=${2:-1000}
+runs=${3:-20}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+i=0
+while [ $i -lt $n ]; do
+    echo "def step$i(x, xs) {"
+    echo "    total = x"
+    echo "    for (y in xs) {"
+    echo "        if (y > $i) {"
+    echo "            total = total + y"
+    echo "        } else {"
+    echo "            total = total - 1"
+    echo "        }"
+    echo "    }"
+    if [ $i -gt 0 ]; then
+        echo "    return step$((i - 1))(total % 1000, xs)"
+    else
+        echo "    return total"
+    fi
+    echo "}"
+    i=$((i + 1))
+done > "$dir/big.bish"
+{
+    echo "xs = [1, 2, 3]"
+    echo "println(step$((n - 1))(0, xs))"
+} >> "$dir/big.bish"
+
+"$bish" -o "$dir/normal.sh" "$dir/big.bish" || exit 1
+"$bish" --minify -o "$dir/minified.sh" "$dir/big.bish" || exit 1
+[ "$(bash "$dir/normal.sh")" = "$(bash "$dir/minified.sh")" ] || {
+    echo "Minified output prints something else." >&2
+    exit 1
+}
+
+now() { date +%s.%N; }
+elapsed() { awk "BEGIN { printf \"%.1f\", ($2 - $1) * 1000 / $runs }"; }
+
+# Time R runs of the given command.
+time_runs() {
+    t0=$(now)
+    i=0
+    while [ $i -lt $runs ]; do
+        "$@" > /dev/null || exit 1
+        i=$((i + 1))
+    done
+    t1=$(now)
+    elapsed $t0 $t1
+}
+
+echo "$n functions, mean of $runs runs:"
+for f in normal minified; do
+    printf "  %-10s %8s bytes  parse %7s ms  run %7s ms\n" "$f:" \
+           "$(wc -c < "$dir/$f.sh")" \
+           "$(time_runs bash -n "$dir/$f.sh")" \
+           "$(time_runs bash "$dir/$f.sh")"
+done
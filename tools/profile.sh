@@ -0,0 +1,58 @@
+#!/bin/sh
+# Profile a script compiled with --source-map by the lines of Bish it
+# was compiled from. Runs the script with bash tracing each command
+# it runs, charges the time until the next command to the Bish line
+# the command was generated from (using <SCRIPT>.map), and prints the
+# N lines (20 by default) taking the most time, with the number of
+# bash commands run for each.
+#
+# USAGE: profile.sh [-n <N>] <SCRIPT> [<ARGS>...]
+
+top=20
+if [ "$1" = "-n" ]; then
+    top=$2
+    shift 2
+fi
+script=$1
+shift
+map="$script.map"
+[ -f "$map" ] || {
+    echo "No source map $map; compile the script with --source-map." >&2
+    exit 1
+}
+trace=$(mktemp)
+trap 'rm -f "$trace"' EXIT
+
+# Bash doesn't take PS4 from the environment when run as root, so set
+# it in the shell running the script.
+bash -c 'exec 9> "$1"; BASH_XTRACEFD=9; PS4="+\${EPOCHREALTIME} \${LINENO} "; script=$0; shift; set -x; . "$script" "$@"' \
+     "$script" "$trace" "$@" > /dev/null
+
+awk -v map="$map" '
+BEGIN {
+    # The map has an entry per line: "sources" are quoted file names,
+    # and "lines" are [first, last, source, source line].
+    while ((getline l < map) > 0) {
+        if (l ~ /"sources"/) { section = "sources"; continue }
+        if (l ~ /"lines"/) { section = "lines"; continue }
+        if (section == "sources" && l ~ /^ *"/) {
+            gsub(/^ *"|",?$/, "", l)
+            sources[nsources++] = l
+        } else if (section == "lines" && l ~ /^ *\[/) {
+            gsub(/[^0-9]+/, " ", l)
+            split(l, r, " ")
+            for (i = r[1]; i <= r[2]; i++) where[i] = sources[r[3]] ":" r[4]
+        }
+    }
+}
+/^\++[0-9]/ {
+    sub(/^\++/, "")
+    t = $1 * 1000
+    if (prev != "") time[prev] += t - prev_t
+    prev = ($2 in where) ? where[$2] : "(generated)"
+    count[prev]++
+    prev_t = t
+}
+END {
+    for (w in time) printf "%10.3f ms %8d  %s\n", time[w], count[w], w
+}' "$trace" | sort -rn | head -n "$top"